@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -7,12 +8,57 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 
 #define NOT_IMPLEMENTED_FOR(VALUE) \
 	case VALUE: do { printf("%s:%d: case not implemented yet: %s\n", __FILE__, __LINE__, #VALUE); abort(); } while (0)
 
-static char const* ABI_REGISTERS[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+enum reg
+{
+	REG_NONE,
+	REG_RAX,
+	REG_RCX,
+	REG_RDX,
+	REG_RBX,
+	REG_RSP,
+	REG_RBP,
+	REG_RSI,
+	REG_RDI,
+	REG_R8,
+	REG_R9,
+	REG_R10,
+	REG_R11,
+	REG_R12,
+	REG_R13,
+	REG_R14,
+	REG_R15,
+};
+
+// Indexed by register and then by log2 of the operand size
+static char const* REG_NAMES[][4] = {
+	[REG_RAX] = { "al",   "ax",   "eax",  "rax" },
+	[REG_RCX] = { "cl",   "cx",   "ecx",  "rcx" },
+	[REG_RDX] = { "dl",   "dx",   "edx",  "rdx" },
+	[REG_RBX] = { "bl",   "bx",   "ebx",  "rbx" },
+	[REG_RSP] = { "spl",  "sp",   "esp",  "rsp" },
+	[REG_RBP] = { "bpl",  "bp",   "ebp",  "rbp" },
+	[REG_RSI] = { "sil",  "si",   "esi",  "rsi" },
+	[REG_RDI] = { "dil",  "di",   "edi",  "rdi" },
+	[REG_R8]  = { "r8b",  "r8w",  "r8d",  "r8" },
+	[REG_R9]  = { "r9b",  "r9w",  "r9d",  "r9" },
+	[REG_R10] = { "r10b", "r10w", "r10d", "r10" },
+	[REG_R11] = { "r11b", "r11w", "r11d", "r11" },
+	[REG_R12] = { "r12b", "r12w", "r12d", "r12" },
+	[REG_R13] = { "r13b", "r13w", "r13d", "r13" },
+	[REG_R14] = { "r14b", "r14w", "r14d", "r14" },
+	[REG_R15] = { "r15b", "r15w", "r15d", "r15" },
+};
+
+static enum reg const ABI_REGISTERS[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
 
 struct string_builder
 {
@@ -38,16 +84,54 @@ struct string_builder
 
 #define da_back(da) ((da).items[(da).count-1])
 
+enum time_report { TIME_REPORT_NONE, TIME_REPORT_TEXT, TIME_REPORT_JSON };
+static enum time_report time_report = TIME_REPORT_NONE;
+
+// Size of the input, counters and time spent in phases of compilation, in seconds.
+// Times of work done inside of the phases are measured only for --time-report.
+static struct {
+	size_t lines, tokens, scans;
+	size_t furthest; // Tokens ending before it have been already counted
+	size_t interned, symbols, peak_symbols, stack_slots, labels;
+	long bytes; // -1 when the output can't tell its position
+	double read, parse, optimize, output;
+	double scan, intern, lookup, functions, data;
+} compile_stats;
+
+// Position in the output when it is a regular file, -1 for pipes and devices
+long output_position(FILE *out)
+{
+	struct stat st;
+	if (fflush(out) != 0 || fstat(fileno(out), &st) < 0 || !S_ISREG(st.st_mode)) {
+		return -1;
+	}
+	return ftell(out);
+}
+
+double seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define TIMED(field, ...) do { \
+	double timed_start = time_report ? seconds() : 0; \
+	__VA_ARGS__; \
+	if (time_report) compile_stats.field += seconds() - timed_start; \
+} while (0)
+
 struct string_pool
 {
 	char const* str;
 	size_t strlen, total;
 	struct string_pool *next;
+	bool used;
 };
 
 static struct string_pool *string_intering_pool = NULL;
 
-static char const* inter(char const *str)
+static char const* inter_uncounted(char const *str)
 {
 	size_t len = strlen(str);
 
@@ -60,20 +144,63 @@ static char const* inter(char const *str)
 	struct string_pool *p = malloc(sizeof(struct string_pool));
 	p->str = strdup(str);
 	p->strlen = len;
+	p->used = false;
 	p->next = string_intering_pool;
 	p->total = p->strlen + 1 + (p->next ? p->next->total : 0);
 	string_intering_pool = p;
+	++compile_stats.interned;
 	return p->str;
 }
 
-size_t string_offset(char const* str)
+static char const* inter(char const *str)
+{
+	char const* interned;
+	TIMED(intern, interned = inter_uncounted(str));
+	return interned;
+}
+
+struct string_pool* string_node(char const* str)
 {
 	for (struct string_pool *p = string_intering_pool; p != NULL; p = p->next) {
 		if (p->str <= str && str <= p->str + p->strlen) {
-			return p->total - (str -  p->str);
+			return p;
 		}
 	}
-	return -1;
+	return NULL;
+}
+
+// Drops strings not marked as used and recomputes offsets of the remaining ones
+size_t remove_unused_strings(void)
+{
+	size_t removed = 0;
+	struct string_pool **link = &string_intering_pool;
+	while (*link) {
+		if ((*link)->used) {
+			link = &(*link)->next;
+		} else {
+			struct string_pool *unused = *link;
+			*link = unused->next;
+			free(unused);
+			++removed;
+		}
+	}
+
+	size_t count = 0;
+	for (struct string_pool *p = string_intering_pool; p != NULL; p = p->next) ++count;
+	struct string_pool **nodes = malloc(count * sizeof(*nodes));
+	count = 0;
+	for (struct string_pool *p = string_intering_pool; p != NULL; p = p->next) nodes[count++] = p;
+	for (size_t i = count; i-- > 0;) {
+		nodes[i]->total = nodes[i]->strlen + 1 + (i + 1 < count ? nodes[i+1]->total : 0);
+	}
+	free(nodes);
+	return removed;
+}
+
+size_t string_offset(char const* str)
+{
+	struct string_pool *p = string_node(str);
+	return p ? p->total - (str - p->str) : (size_t)-1;
 }
 
 struct token
@@ -248,15 +375,90 @@ char const* token_short_name(struct token tok)
 }
 
 static char const* source = NULL;
+static bool whole_program = false; // Externs defined by one of the modules are reached directly
 static bool warnings_enabled = false;
+static bool optimizations_enabled = true;
+static bool stats_enabled = false;
+static bool nolibc = false; // Program is linked statically with libb, without PLT and GOT
+static bool function_sections = false; // Each function in its own section, removable by ld --gc-sections
+static bool annotate = false; // Source lines and function summaries are printed as comments
+static bool debug_info = false; // DWARF line table, unwind tables and names of functions and locals
+
+// Calls of libb profiler around every function and optionally counters of its labels
+static enum instrument {
+	INSTRUMENT_NONE,
+	INSTRUMENT_FUNCTIONS,
+	INSTRUMENT_BLOCKS,
+} instrument = INSTRUMENT_NONE;
+
+// Counts of a profile written by a -finstrument build, read by --profile-use
+struct profile_count {
+	char const* function;
+	size_t label; // PROFILE_CALLS for calls of the function
+	int64_t count;
+};
+
+#define PROFILE_CALLS SIZE_MAX
+
+// Sorted by function and label
+static struct {
+	struct profile_count *items;
+	size_t count, capacity;
+	int64_t hot_calls; // Functions called at least this many times are hot
+	char const* path;
+} profile_counts;
+
+// Loops recognized by replace_search_loop and libb functions replacing them
+enum idiom {
+	IDIOM_WFIND,
+	IDIOM_WCOMPARE,
+	IDIOM_BFIND,
+	IDIOM_COUNT,
+};
+
+static char const* const IDIOM_NAMES[IDIOM_COUNT] = {
+	[IDIOM_WFIND]    = "wfind",
+	[IDIOM_WCOMPARE] = "wcompare",
+	[IDIOM_BFIND]    = "bfind",
+};
+
+// Module local variable holding detected SIMD support (-1 until detected)
+#define SIMD_LEVEL  "__b_simd_level"
+#define SIMD_DETECT "__b_simd_detect"
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
 static char const* current_filename = NULL;
 static char const* current_function = NULL;
 
-void calc_location(struct token tok, size_t *line, size_t *column)
+// Source files compiled together, source and current_filename belong to the one being parsed
+struct module
 {
-	char const *p = source;
+	char const* filename;
+	char const* source;
+	size_t size; // Including the terminating zero
+};
+
+static struct {
+	struct module *items;
+	size_t count, capacity;
+} modules;
+static size_t current_module = 0;
+
+// Module which source contains the position, the current one for positions outside of sources
+struct module const* module_of(char const* p)
+{
+	for (size_t i = 0; i < modules.count; ++i) {
+		if (p >= modules.items[i].source && p < modules.items[i].source + modules.items[i].size) {
+			return &modules.items[i];
+		}
+	}
+	return &modules.items[current_module];
+}
 
-	do switch (*p) {
+void calc_location(struct token tok, size_t *line, size_t *column)
+{
+	for (char const *p = module_of(tok.p)->source; *p && p != tok.p; ++p) switch (*p) {
 	case '\n':
 		++*line; [[fallthrough]];
 	case '\r':
@@ -264,14 +466,50 @@ void calc_location(struct token tok, size_t *line, size_t *column)
 		break;
 	default:
 		++*column;
-	} while (*++p && p != tok.p);
+	}
+}
+
+// Line of the source position. Counts only newlines after the previous position
+// when positions grow, as they do while parsing.
+size_t source_line(char const* p)
+{
+	static char const* last = NULL, *base = NULL;
+	static size_t line = 1;
+	if (!last || p < last || base != source) {
+		last = base = source;
+		line = 1;
+	}
+	for (; last < p && *last; ++last) {
+		line += *last == '\n';
+	}
+	return line;
+}
+
+// Start of the source line of the module, NULL past the end of its source
+char const* line_start(struct module const* module, size_t line)
+{
+	static struct {
+		char const **items;
+		size_t count, capacity;
+	} starts;
+	static struct module const* cached = NULL;
+
+	if (cached != module) {
+		cached = module;
+		starts.count = 0;
+		da_append(&starts, module->source);
+		for (char const* p = module->source; *p; ++p) {
+			if (*p == '\n') da_append(&starts, p + 1);
+		}
+	}
+	return line >= 1 && line <= starts.count ? starts.items[line - 1] : NULL;
 }
 
 void dump_location(FILE *out, struct token tok)
 {
 	size_t line = 1, column = 1;
 	calc_location(tok, &line, &column);
-	fprintf(out, "%s:%zu:%zu: ", current_filename, line, column);
+	fprintf(out, "%s:%zu:%zu: ", module_of(tok.p)->filename, line, column);
 }
 
 __attribute__ ((format (printf, 2, 3)))
@@ -319,6 +557,7 @@ struct tokenizer
 };
 
 struct token scan(struct tokenizer *ctx);
+struct token scan_token(struct tokenizer *ctx);
 void dump_token(FILE *out, struct token tok);
 char const* token_short_name(struct token tok);
 
@@ -365,6 +604,9 @@ struct data
 {
 	size_t id;
 	bool is_vec;
+	bool used;
+	bool read_only; // never written and address never taken in the whole file
+	bool constant;  // read only scalar which value replaced all uses
 	struct token declared_size;
 
 	struct token *items;
@@ -372,6 +614,42 @@ struct data
 };
 
 
+struct function
+{
+	char const* name;
+	size_t id;
+	bool used;
+	bool simd_dispatch;
+	size_t stack_capacity;
+	size_t frame; // Bytes reserved below rbp, known after finish_function
+	size_t prologue; // Instructions of the prologue, known after finish_function
+	size_t line; // Line of the definition
+	size_t module; // Index of the module with the definition
+
+	// Local variables for the debug info
+	struct {
+		struct symbol *items;
+		size_t count, capacity;
+	} locals;
+
+	// Stack offsets of locals that loops keep in registers, they get no location in the debug info
+	struct {
+		size_t *items;
+		size_t count, capacity;
+	} promoted;
+
+	// Profile record in .data and ids of the labels with counters in it, see libb_profile_enter
+	char const* profile_record;
+	struct {
+		size_t *items;
+		size_t count, capacity;
+	} blocks;
+
+	// Body as generated by the parser, complete function after finish_function
+	struct instruction *items;
+	size_t count, capacity;
+};
+
 // TODO: Add literal value type
 struct value
 {
@@ -380,8 +658,14 @@ struct value
 		RVALUE,
 		LVALUE_AUTO,
 		LVALUE_PTR,
+		LVALUE_GLOBAL, // accessed directly as [sym_<id>]
+		LVALUE_EXTERN, // address is loaded from GOT
 	} kind;
-	union { size_t offset; };
+	union {
+		size_t offset;
+		size_t id;
+		char const* name;
+	};
 };
 
 struct control
@@ -390,6 +674,159 @@ struct control
 	struct value lhs; // value to compare to in switch
 	size_t next;      // next case for switch, next iteration for while
 	size_t end;       // end of switch, end of while
+	size_t cases;     // first case of the switch in compiler->cases
+};
+
+struct switch_case
+{
+	size_t body;   // label after the test of the case
+	bool literal;  // value is known, the case can be tested out of order
+	int64_t value;
+};
+
+struct operand
+{
+	enum operand_kind
+	{
+		OPERAND_NONE,
+		OPERAND_REG,
+		OPERAND_IMM,
+		OPERAND_MEM,
+		OPERAND_LABEL,
+		OPERAND_VREG, // xmm (size 16) or ymm (size 32)
+	} kind;
+
+	// Size in bytes, 0 when it is implied by the other operand
+	unsigned size;
+
+	// Register for OPERAND_REG, base and index for OPERAND_MEM, number of OPERAND_VREG
+	enum reg reg, index;
+	unsigned scale;
+
+	// Immediate value for OPERAND_IMM, displacement otherwise
+	int64_t disp;
+
+	// Symbolic part of the memory operand or jump target
+	enum reference
+	{
+		REF_NONE,
+		REF_SYMBOL,  // sym_<id>
+		REF_EXTERN,  // <name>
+		REF_PLT,     // <name> WRT ..plt
+		REF_GOT,     // <name> WRT ..gotpcrel
+		REF_STRINGS, // strend - offset of name
+		REF_LOCAL,   // .local_<id>
+		REF_LABEL,   // .label_<id>
+	} ref;
+	size_t id;
+	char const* name;
+};
+
+enum condition
+{
+	CC_E,
+	CC_NE,
+	CC_L,
+	CC_LE,
+	CC_G,
+	CC_GE,
+	CC_B,
+	CC_AE,
+	CC_S,
+	CC_NS,
+};
+
+enum opcode
+{
+	// Removed instruction, skipped when printing
+	OP_NOP,
+	OP_LABEL,
+	OP_COMMENT,
+
+	OP_ADD,
+	OP_AND,
+	OP_CALL,
+	OP_CMP,
+	OP_CQO,
+	OP_DEC,
+	OP_IDIV,
+	OP_IMUL,
+	OP_INC,
+	OP_JCC,
+	OP_JMP,
+	OP_LEA,
+	OP_LEAVE,
+	OP_MOV,
+	OP_MOVSX,
+	OP_MOVSXD,
+	OP_MOVZX,
+	OP_NEG,
+	OP_NOT,
+	OP_OR,
+	OP_PUSH,
+	OP_RET,
+	OP_SETCC,
+	OP_SHL,
+	OP_SHR,
+	OP_SUB,
+	OP_TEST,
+	OP_XOR,
+
+	// Atomic instructions, xchg with memory operand is locked implicitly
+	OP_CMPXCHG,
+	OP_MFENCE,
+	OP_PAUSE,
+	OP_XADD,
+	OP_XCHG,
+
+	// SSE2 instructions, printed as AVX2 ones when destination is ymm register
+	OP_MOVDQU,
+	OP_MOVQ,
+	OP_PADDQ,
+	OP_PAND,
+	OP_POR,
+	OP_PSLLQ,
+	OP_PSRLQ,
+	OP_PSUBQ,
+	OP_PUNPCKLQDQ,
+	OP_PXOR,
+	OP_VPBROADCASTQ,
+	OP_VZEROUPPER,
+};
+
+// Call of an intrinsic through extrn, see INTRINSICS
+struct intrinsic_call
+{
+	char const* name;
+	struct token open;
+	size_t args;
+};
+
+struct instruction
+{
+	enum opcode op;
+	enum condition cc;
+	struct operand dst, src;
+	char const* comment;
+	size_t line; // Source line of the statement that generated it, 0 if unknown
+};
+
+// Jumps which target is not known yet, as indexes into compiler code
+struct jumps
+{
+	size_t *items;
+	size_t count, capacity;
+};
+
+// Truth value of a comparison or logical operator that is still kept in flags.
+// Jumps leaving early from && and || have already stored their value into the slot.
+struct pending_condition
+{
+	bool active;
+	size_t offset;         // slot that holds the value once materialized
+	enum condition cc;     // condition that is true when value is non-zero
+	bool stored;           // fallthrough value has been already stored into the slot
+	struct jumps true_jumps, false_jumps;
 };
 
 struct compiler
@@ -421,6 +858,66 @@ struct compiler
 		struct control *items;
 		size_t count, capacity;
 	} control;
+
+	// Instructions of the function that is currently compiled
+	struct {
+		struct instruction *items;
+		size_t count, capacity;
+	} code;
+
+	// Compiled functions, printed once the whole program is known
+	struct {
+		struct function *items;
+		size_t count, capacity;
+	} functions;
+
+	struct pending_condition condition;
+
+	// Vectorized loops of the current function use runtime detection of SIMD_LEVEL
+	bool simd_dispatch;
+
+	// Stack offsets of variables the loop optimizer kept in registers in the current function
+	struct {
+		size_t *items;
+		size_t count, capacity;
+	} promoted;
+
+	// Loop idioms replaced by calls to libb anywhere in the program
+	unsigned libb_calls;
+
+	// Calls that become intrinsics unless one of the modules defines a function of the name
+	struct {
+		struct intrinsic_call *items;
+		size_t count, capacity;
+	} intrinsic_calls;
+
+	// Source line of the statement being compiled
+	size_t line;
+
+	// Local variables of the current function for the debug info
+	struct {
+		struct symbol *items;
+		size_t count, capacity;
+	} locals;
+
+	// Profile record of the current function and its labels with counters
+	char const* profile_record;
+	struct {
+		size_t *items;
+		size_t count, capacity;
+	} blocks;
+
+	// Arms of if statements that the profile found cold, placed after the end of the function
+	struct {
+		struct instruction *items;
+		size_t count, capacity;
+	} cold;
+
+	// Cases of the switch statements being compiled
+	struct {
+		struct switch_case *items;
+		size_t count, capacity;
+	} cases;
 };
 
 size_t alloc_stack_sized(struct compiler *compiler, size_t size)
@@ -429,6 +926,7 @@ size_t alloc_stack_sized(struct compiler *compiler, size_t size)
 		compiler->stack_capacity = 16;
 	}
 
+	compile_stats.stack_slots += size;
 	size_t offset = (compiler->stack_current_offset += sizeof(uint64_t) * size);
 	// TODO: Why we allocate in this way?
 	while (compiler->stack_current_offset > compiler->stack_capacity) {
@@ -463,6 +961,7 @@ void leave_scope(struct compiler *compiler)
 		warnf(scope.items[i].definition, "symbol %s is not used\n", scope.items[i].name);
 	}
 
+	compile_stats.symbols -= scope.count;
 	--compiler->nesting;
 }
 
@@ -476,7 +975,7 @@ struct symbol* search_symbol_in_scope(struct compiler *compiler, char const* ide
 	return NULL;
 }
 
-struct symbol* search_symbol(struct compiler *compiler, char const* identifier)
+struct symbol* search_symbol_uncounted(struct compiler *compiler, char const* identifier)
 {
 	for (int level = compiler->nesting; level >= 0; --level) {
 		struct scope scope = compiler->scope[level];
@@ -488,6 +987,13 @@ struct symbol* search_symbol(struct compiler *compiler, char const* identifier)
 	return NULL;
 }
 
+struct symbol* search_symbol(struct compiler *compiler, char const* identifier)
+{
+	struct symbol *symbol;
+	TIMED(lookup, symbol = search_symbol_uncounted(compiler, identifier));
+	return symbol;
+}
+
 struct symbol define_symbol(struct compiler *compiler, struct symbol symbol, struct token name)
 {
 	struct symbol *s;
@@ -501,16 +1007,52 @@ struct symbol define_symbol(struct compiler *compiler, struct symbol symbol, str
 	assert(compiler->last_symbol_id > 0);
 	symbol.id = compiler->last_symbol_id;
 	da_append(&compiler->scope[compiler->nesting], symbol);
+	if (debug_info && (symbol.kind == LOCAL || symbol.kind == LOCAL_VECTOR)) {
+		da_append(&compiler->locals, symbol);
+	}
+	if (++compile_stats.symbols > compile_stats.peak_symbols) {
+		compile_stats.peak_symbols = compile_stats.symbols;
+	}
 	return symbol;
 }
 
 void parse_program(struct parser *p, struct compiler *compiler);
 bool parse_statement(struct parser *p, struct compiler *compiler);
+void print_stats(FILE *out);
+void print_time_report(FILE *out);
+void print_simd_detect(void);
+void print_text_section(char const* name);
+void load_profile(char const* path);
+void check_profile(struct compiler *compiler);
+int64_t profile_count(char const* function, size_t label);
+void print_function(struct function const* fun);
+void print_debug_sections(struct compiler const* compiler);
+void print_data(struct data const* data);
+void print_profile_record(struct function const* fun);
+bool is_zero_data(struct data const* data);
+uint64_t data_size(struct data const* data);
+void mark_used_definitions(struct compiler *compiler);
+void inline_constants(struct compiler *compiler);
+void resolve_externs(struct compiler *compiler);
+void lower_intrinsics(struct compiler *compiler);
+struct symbol const* find_definition(struct compiler *compiler, char const* name);
+void finish_function(struct compiler *compiler, struct function *body);
 
 void print_help(FILE *out)
 {
-	fprintf(out, "usage: b [-h] [-w] [-o output_file] [input_file]\n");
-	fprintf(out, "   -w / --warning / --warnings     Prints warnings"); // TODO: Match gcc syntax
+	fprintf(out, "usage: b [-h] [-w] [-O0] [--stats] [--time-report] [-nolibc] [-ffunction-sections] [-S] [--annotate] [-g] [-finstrument[=blocks]] [--profile-use=file] [-fwhole-program] [-o output_file] [input_file...]\n");
+	fprintf(out, "   -w / --warning / --warnings     Prints warnings\n"); // TODO: Match gcc syntax
+	fprintf(out, "   -O0 / -O1                       Disables / enables optimizations (enabled by default)\n");
+	fprintf(out, "   --stats                         Prints what optimizations did to stderr\n");
+	fprintf(out, "   --time-report[=text|json]       Prints time of compilation phases and compiler counters to stderr\n");
+	fprintf(out, "   -nolibc                         Generates code for static linking with libb instead of libc\n");
+	fprintf(out, "   -ffunction-sections             Places each function in its own section\n");
+	fprintf(out, "   -S                              Outputs assembly (the only output format)\n");
+	fprintf(out, "   --annotate                      Comments assembly with source lines, frame sizes and instruction counts\n");
+	fprintf(out, "   -g                              Emits DWARF line table, unwind tables and names of functions and locals\n");
+	fprintf(out, "   -finstrument[=blocks]           Counts calls and cycles of functions (and executions of labels) into prof.data\n");
+	fprintf(out, "   --profile-use=file              Places cold functions and if arms apart and tests hot cases first\n");
+	fprintf(out, "   -fwhole-program                 Calls functions and reaches globals defined by input files directly (implied by many files)\n");
 }
 
 #define shift(argv, argc) (argc-- <= 0 ? NULL : *(argv++))
@@ -519,7 +1061,7 @@ int main(int argc, char **argv)
 {
 	(void)/* program name */shift(argv, argc);
 
-	FILE *input_stream = NULL;
+	struct { char const **items; size_t count, capacity; } filenames = {};
 	char const* output_filename = NULL;
 
 	for (char const *arg; (arg = shift(argv, argc));) {
@@ -534,6 +1076,71 @@ int main(int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp("-O0", arg) == 0 || strcmp("-O1", arg) == 0) {
+				optimizations_enabled = arg[2] == '1';
+				continue;
+			}
+
+			if (strcmp("--stats", arg) == 0) {
+				stats_enabled = true;
+				continue;
+			}
+
+			if (strcmp("--time-report", arg) == 0 || strcmp("--time-report=text", arg) == 0) {
+				time_report = TIME_REPORT_TEXT;
+				continue;
+			}
+
+			if (strcmp("--time-report=json", arg) == 0) {
+				time_report = TIME_REPORT_JSON;
+				continue;
+			}
+
+			if (strcmp("-nolibc", arg) == 0) {
+				nolibc = true;
+				continue;
+			}
+
+			if (strcmp("-ffunction-sections", arg) == 0) {
+				function_sections = true;
+				continue;
+			}
+
+			// Output is always assembly, -S is accepted for the habit of other compilers
+			if (strcmp("-S", arg) == 0) {
+				continue;
+			}
+
+			if (strcmp("-finstrument", arg) == 0 || strcmp("-finstrument=functions", arg) == 0) {
+				instrument = INSTRUMENT_FUNCTIONS;
+				continue;
+			}
+
+			if (strcmp("-finstrument=blocks", arg) == 0) {
+				instrument = INSTRUMENT_BLOCKS;
+				continue;
+			}
+
+			if (strncmp("--profile-use=", arg, strlen("--profile-use=")) == 0) {
+				load_profile(arg + strlen("--profile-use="));
+				continue;
+			}
+
+			if (strcmp("-g", arg) == 0) {
+				debug_info = true;
+				continue;
+			}
+
+			if (strcmp("--annotate", arg) == 0) {
+				annotate = true;
+				continue;
+			}
+
+			if (strcmp("-fwhole-program", arg) == 0) {
+				whole_program = true;
+				continue;
+			}
+
 			if (strcmp("-o", arg) == 0 || strcmp("--output", arg) == 0) {
 				output_filename = shift(argv, argc);
 				if (!output_filename) {
@@ -547,24 +1154,11 @@ int main(int argc, char **argv)
 			return 1;
 		}
 
-		if (current_filename == NULL) {
-			current_filename = arg;
-		} else {
-			fprintf(stderr, "b: error: file was already provided: %s\n", current_filename);
-			return 1;
-		}
+		da_append(&filenames, arg);
 	}
 
-	if (current_filename) {
-		input_stream = fopen(current_filename, "r");
-		if (!input_stream) {
-			perror("b: error:");
-			return 1;
-		}
-	} else {
-		input_stream = stdin;
-		current_filename = "(stdin)";
-	}
+	// Modules compiled together form the whole program
+	whole_program |= filenames.count > 1;
 
 	if (output_filename) {
 		if (!freopen(output_filename, "w", stdout)) {
@@ -578,29 +1172,51 @@ int main(int argc, char **argv)
 	};
 
 
-	// TODO: optimize me
-	struct string_builder sb = {};
+	double start = seconds();
 
-	for (;;) {
-		char buf[4096];
-		size_t read = fread(&buf, 1, sizeof(buf), input_stream);
-		if (read == 0) {
-			break;
+	for (size_t f = 0; f == 0 || f < filenames.count; ++f) {
+		FILE *input_stream = stdin;
+		char const* filename = "(stdin)";
+		if (filenames.count > 0) {
+			filename = filenames.items[f];
+			input_stream = fopen(filename, "r");
+			if (!input_stream) {
+				perror("b: error:");
+				return 1;
+			}
+		}
+
+		// TODO: optimize me
+		struct string_builder sb = {};
+
+		for (;;) {
+			char buf[4096];
+			size_t read = fread(&buf, 1, sizeof(buf), input_stream);
+			if (read == 0) {
+				break;
+			}
+
+			for (size_t i = 0; i < read; ++i) {
+				da_append(&sb, buf[i]);
+			}
+		}
+		da_append(&sb, '\0');
+		if (input_stream != stdin) {
+			fclose(input_stream);
 		}
 
-		for (size_t i = 0; i < read; ++i) {
-			da_append(&sb, buf[i]);
+		for (size_t i = 0; i < sb.count; ++i) {
+			compile_stats.lines += sb.items[i] == '\n';
 		}
+		da_append(&modules, ((struct module) { .filename = filename, .source = sb.items, .size = sb.count }));
 	}
-	da_append(&sb, '\0');
-	source = sb.items;
-
-	struct parser parser = {
-		.tokenizer = { .source = sb.items, .head = 0, },
-	};
+	compile_stats.read = seconds() - start;
 
 #if 0
 	struct token tok;
+	struct parser parser = {
+		.tokenizer = { .source = modules.items[0].source, .head = 0, },
+	};
 
 	while ((tok = scan(&parser.tokenizer)).kind != TOK_EOF) {
 		dump_token(stdout, tok);
@@ -613,54 +1229,109 @@ int main(int argc, char **argv)
 	}
 
 #else
+	long output_start = time_report ? output_position(stdout) : -1;
+
 	printf("BITS 64\n");
 	printf("DEFAULT rel\n");
 
 	printf("section \".text\" exec nowrite\n");
-	parse_program(&parser, &compiler);
-
-	// TODO: Move globals without init to bss
-	printf("section \".data\" write\n");
-	for (size_t i = 0; i < compiler.data_section.count; ++i) {
-		struct data data = compiler.data_section.items[i];
-		uint64_t actual_size = data.count;
+	start = seconds();
+	for (size_t i = 0; i < modules.count; ++i) {
+		current_module = i;
+		source = modules.items[i].source;
+		current_filename = modules.items[i].filename;
+
+		struct parser parser = {
+			.tokenizer = { .source = source, .head = 0, },
+		};
+		parse_program(&parser, &compiler);
+	}
+	compile_stats.parse = seconds() - start;
+	lower_intrinsics(&compiler);
+	if (profile_counts.path) {
+		check_profile(&compiler);
+	}
 
-		if (data.is_vec) {
-			if (actual_size < data.declared_size.ival) {
-				actual_size = data.declared_size.ival;
-			}
-			printf("sym_%zu: dq $+8\n", data.id);
-			// TODO: error message
-			assert(actual_size != 0);
-		} else {
-			printf("sym_%zu:\n", data.id);
-			if (actual_size == 0) {
-				printf("\tdq 0\n");
-				continue;
-			}
+	start = seconds();
+	if (whole_program) {
+		resolve_externs(&compiler);
+	}
+	if (optimizations_enabled) {
+		inline_constants(&compiler);
+	}
+	for (size_t i = 0; i < compiler.functions.count; ++i) {
+		finish_function(&compiler, &compiler.functions.items[i]);
+	}
+	mark_used_definitions(&compiler);
+	compile_stats.optimize = seconds() - start;
+	start = seconds();
+
+	for (size_t i = 0; i < compiler.defined_externs.count; ++i) {
+		char const* name = compiler.defined_externs.items[i];
+		if (!whole_program || !find_definition(&compiler, name)) {
+			printf("\textern %s\n", name);
 		}
+	}
+	for (size_t i = 0; i < IDIOM_COUNT; ++i) {
+		if (compiler.libb_calls & (1u << i)) {
+			printf("\textern %s\n", IDIOM_NAMES[i]);
+		}
+	}
+	if (instrument) {
+		printf("\textern libb_profile_enter\n");
+		printf("\textern libb_profile_exit\n");
+	}
 
+	bool simd_dispatch = false;
+	double functions_start = seconds();
+	for (size_t i = 0; i < compiler.functions.count; ++i) {
+		struct function const* fun = &compiler.functions.items[i];
+		if (fun->used) {
+			print_function(fun);
+			simd_dispatch |= fun->simd_dispatch;
+		}
+	}
+	if (simd_dispatch) {
+		print_simd_detect();
+	}
+	compile_stats.functions = seconds() - functions_start;
 
-		printf("\tdq ");
-
-		for (size_t i = 0; i < actual_size; ++i) {
-			if (i > 0) { printf(","); }
-			if (i < data.count) {
-				switch (data.items[i].kind) {
-				case TOK_STRING:
-					printf("strend - %zu", string_offset(data.items[i].text));
-					break;
-
-				case TOK_INTEGER: printf("%"PRIu64, data.items[i].ival); break;
-
-				default:
-					assert(0 && "not implemented yet");
-				}
-			} else {
-				printf("0");
+	double data_start = seconds();
+	printf("section \".data\" write\n");
+	if (simd_dispatch) {
+		printf("%s: dq -1\n", SIMD_LEVEL);
+	}
+	if (instrument) {
+		for (size_t i = 0; i < compiler.functions.count; ++i) {
+			struct function const* fun = &compiler.functions.items[i];
+			if (fun->used) {
+				print_profile_record(fun);
 			}
 		}
-		printf("\n");
+	}
+	for (size_t i = 0; i < compiler.data_section.count; ++i) {
+		struct data const* data = &compiler.data_section.items[i];
+		if (data->used) {
+			print_data(data);
+		}
+	}
+
+	// Pointers that need relocation but are never changed after it
+	printf("section \".data.rel.ro\" progbits alloc write align=8\n");
+	for (size_t i = 0; i < compiler.data_section.count; ++i) {
+		struct data const* data = &compiler.data_section.items[i];
+		if (data->used && data->is_vec && data->read_only) {
+			printf("sym_%zu: dq vec_%zu\n", data->id, data->id);
+		}
+	}
+
+	// Globals without any non-zero word take only space in memory, not in the file
+	printf("section \".bss\" nobits write\n");
+	for (size_t i = 0; i < compiler.data_section.count; ++i) {
+		struct data const* data = &compiler.data_section.items[i];
+		if (data->used && is_zero_data(data)) {
+			printf("%s_%zu: resq %"PRIu64"\n", data->is_vec ? "vec" : "sym", data->id, data_size(data));
+		}
 	}
 
 	printf("section \".rodata\"\n");
@@ -671,72 +1342,3633 @@ int main(int argc, char **argv)
 			for (char const *s = p->str; *s; ++s) {
 				printf(",0x%02x", *s);
 			}
-			printf(",0x00");
+			printf(",0x00");
+		}
+		printf("\nstrend:\n");
+	}
+
+	if (debug_info) {
+		print_debug_sections(&compiler);
+	}
+	compile_stats.data = seconds() - data_start;
+
+	// TODO: better solution to presever assert
+	leave_scope(&compiler);
+	compile_stats.output = seconds() - start;
+	compile_stats.labels = compiler.last_local_id;
+
+	if (time_report) {
+		long output_end = output_position(stdout);
+		compile_stats.bytes = output_start >= 0 && output_end >= 0 ? output_end - output_start : -1;
+		print_time_report(stderr);
+	}
+
+	if (stats_enabled) {
+		print_stats(stderr);
+	}
+#endif
+}
+
+struct token peek_token(struct parser *p)
+{
+	size_t save = p->tokenizer.head;
+	struct token next = scan(&p->tokenizer);
+	p->tokenizer.head = save;
+	return next;
+}
+
+bool expect_token(struct parser *p, struct token *tok, enum token_kind kind)
+{
+	size_t save = p->tokenizer.head;
+	*tok = scan(&p->tokenizer);
+
+	if (tok->kind != kind) {
+		p->tokenizer.head = save;
+		return false;
+	}
+	return true;
+}
+
+bool expect_token2(struct parser *p, struct token *tok1, enum token_kind kind1, struct token *tok2, enum token_kind kind2)
+{
+	size_t save = p->tokenizer.head;
+
+	if ((*tok1 = scan(&p->tokenizer)).kind == kind1
+	&&  (*tok2 = scan(&p->tokenizer)).kind == kind2) {
+		return true;
+	}
+
+	p->tokenizer.head = save;
+	return false;
+}
+
+
+bool expect_token_if(struct parser *p, struct token *tok, bool(*predicate)(enum token_kind))
+{
+	size_t save = p->tokenizer.head;
+	if (predicate((*tok = scan(&p->tokenizer)).kind)) {
+		return true;
+	}
+	p->tokenizer.head = save;
+	return false;
+}
+
+struct operand reg(enum reg r)
+{
+	return (struct operand) { .kind = OPERAND_REG, .reg = r, .size = 8 };
+}
+
+struct operand reg8(enum reg r)
+{
+	return (struct operand) { .kind = OPERAND_REG, .reg = r, .size = 1 };
+}
+
+struct operand sized_reg(enum reg r, unsigned size)
+{
+	return (struct operand) { .kind = OPERAND_REG, .reg = r, .size = size };
+}
+
+struct operand imm(int64_t value)
+{
+	return (struct operand) { .kind = OPERAND_IMM, .disp = value };
+}
+
+// [rbp-offset]
+struct operand stack(size_t offset)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .reg = REG_RBP, .disp = -(int64_t)offset };
+}
+
+// [base]
+struct operand deref(enum reg base)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .reg = base };
+}
+
+// [base+index*scale]
+struct operand indexed(enum reg base, enum reg index, unsigned scale)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .reg = base, .index = index, .scale = scale };
+}
+
+struct operand qword(struct operand op)
+{
+	op.size = 8;
+	return op;
+}
+
+// [sym_<id>]
+struct operand symbol_address(size_t id)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .ref = REF_SYMBOL, .id = id };
+}
+
+// [<name>]
+struct operand extern_address(char const* name)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .ref = REF_EXTERN, .name = name };
+}
+
+// [<name> WRT ..gotpcrel], GOT entry holding address of the external symbol
+struct operand got_address(char const* name)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .ref = REF_GOT, .name = name };
+}
+
+// [strend-offset], offset is known only after unused strings are removed
+struct operand string_address(char const* str)
+{
+	return (struct operand) { .kind = OPERAND_MEM, .ref = REF_STRINGS, .name = str };
+}
+
+struct operand local_label(size_t id)
+{
+	return (struct operand) { .kind = OPERAND_LABEL, .ref = REF_LOCAL, .id = id };
+}
+
+struct operand user_label(size_t id)
+{
+	return (struct operand) { .kind = OPERAND_LABEL, .ref = REF_LABEL, .id = id };
+}
+
+struct operand symbol_target(size_t id)
+{
+	return (struct operand) { .kind = OPERAND_LABEL, .ref = REF_SYMBOL, .id = id };
+}
+
+struct operand plt_target(char const* name)
+{
+	if (nolibc) {
+		return (struct operand) { .kind = OPERAND_LABEL, .ref = REF_EXTERN, .name = name };
+	}
+	return (struct operand) { .kind = OPERAND_LABEL, .ref = REF_PLT, .name = name };
+}
+
+void materialize_condition(struct compiler *compiler);
+
+// Instructions that don't modify flags and don't change control flow can be placed
+// between comparison and the branch that uses it
+bool preserves_condition(struct instruction const* in)
+{
+	switch (in->op) {
+	case OP_NOP:
+	case OP_COMMENT:
+	case OP_MOV:
+	case OP_LEA:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool is_slot(struct operand op, size_t offset)
+{
+	return op.kind == OPERAND_MEM && op.reg == REG_RBP && op.index == REG_NONE
+		&& op.ref == REF_NONE && op.disp == -(int64_t)offset;
+}
+
+void emit_instruction(struct compiler *compiler, struct instruction in)
+{
+	struct pending_condition *cond = &compiler->condition;
+	if (cond->active) {
+		// Pending jumps have to be joined before any instruction that isn't part of the fallthrough path only
+		bool joined = cond->true_jumps.count == 0 && cond->false_jumps.count == 0;
+		if (!joined || !preserves_condition(&in) || is_slot(in.dst, cond->offset) || is_slot(in.src, cond->offset)) {
+			materialize_condition(compiler);
+		}
+	}
+	if (!in.line) {
+		in.line = compiler->line;
+	}
+	da_append(&compiler->code, in);
+}
+
+void emit2(struct compiler *compiler, enum opcode op, struct operand dst, struct operand src)
+{
+	emit_instruction(compiler, (struct instruction) { .op = op, .dst = dst, .src = src });
+}
+
+void emit1(struct compiler *compiler, enum opcode op, struct operand dst)
+{
+	emit2(compiler, op, dst, (struct operand) {});
+}
+
+void emit0(struct compiler *compiler, enum opcode op)
+{
+	emit2(compiler, op, (struct operand) {}, (struct operand) {});
+}
+
+void emit_jcc(struct compiler *compiler, enum condition cc, struct operand target)
+{
+	emit_instruction(compiler, (struct instruction) { .op = OP_JCC, .cc = cc, .dst = target });
+}
+
+void emit_setcc(struct compiler *compiler, enum condition cc, struct operand dst)
+{
+	emit_instruction(compiler, (struct instruction) { .op = OP_SETCC, .cc = cc, .dst = dst });
+}
+
+// Offset of the block counters in the profile record, after calls, cycles, self cycles,
+// name, next, registered and number of blocks. Every block is a pair of label and count.
+#define PROFILE_BLOCKS 56
+
+void emit_label(struct compiler *compiler, struct operand label)
+{
+	emit1(compiler, OP_LABEL, label);
+	if (instrument == INSTRUMENT_BLOCKS && label.ref == REF_LOCAL) {
+		struct operand counter = extern_address(compiler->profile_record);
+		counter.disp = PROFILE_BLOCKS + 16 * compiler->blocks.count + 8;
+		da_append(&compiler->blocks, label.id);
+		emit1(compiler, OP_INC, qword(counter));
+	}
+}
+
+__attribute__ ((format (printf, 2, 3)))
+void emit_comment(struct compiler *compiler, char const* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	char *comment = malloc(len + 1);
+	va_start(args, fmt);
+	vsnprintf(comment, len + 1, fmt, args);
+	va_end(args);
+
+	emit_instruction(compiler, (struct instruction) { .op = OP_COMMENT, .comment = comment });
+}
+
+
+static char const* MNEMONICS[] = {
+	[OP_ADD] = "add",
+	[OP_AND] = "and",
+	[OP_CALL] = "call",
+	[OP_CMP] = "cmp",
+	[OP_CQO] = "cqo",
+	[OP_DEC] = "dec",
+	[OP_IDIV] = "idiv",
+	[OP_IMUL] = "imul",
+	[OP_INC] = "inc",
+	[OP_JCC] = "j",
+	[OP_JMP] = "jmp",
+	[OP_LEA] = "lea",
+	[OP_LEAVE] = "leave",
+	[OP_MOV] = "mov",
+	[OP_MOVSX] = "movsx",
+	[OP_MOVSXD] = "movsxd",
+	[OP_MOVZX] = "movzx",
+	[OP_NEG] = "neg",
+	[OP_NOT] = "not",
+	[OP_OR] = "or",
+	[OP_PUSH] = "push",
+	[OP_RET] = "ret",
+	[OP_SETCC] = "set",
+	[OP_SHL] = "shl",
+	[OP_SHR] = "shr",
+	[OP_SUB] = "sub",
+	[OP_TEST] = "test",
+	[OP_XOR] = "xor",
+	[OP_CMPXCHG] = "lock cmpxchg",
+	[OP_MFENCE] = "mfence",
+	[OP_PAUSE] = "pause",
+	[OP_XADD] = "lock xadd",
+	[OP_XCHG] = "xchg",
+	[OP_MOVDQU] = "movdqu",
+	[OP_MOVQ] = "movq",
+	[OP_PADDQ] = "paddq",
+	[OP_PAND] = "pand",
+	[OP_POR] = "por",
+	[OP_PSLLQ] = "psllq",
+	[OP_PSRLQ] = "psrlq",
+	[OP_PSUBQ] = "psubq",
+	[OP_PUNPCKLQDQ] = "punpcklqdq",
+	[OP_PXOR] = "pxor",
+	[OP_VPBROADCASTQ] = "vpbroadcastq",
+	[OP_VZEROUPPER] = "vzeroupper",
+};
+
+static char const* CONDITION_SUFFIX[] = {
+	[CC_E] = "e",
+	[CC_NE] = "ne",
+	[CC_L] = "l",
+	[CC_LE] = "le",
+	[CC_G] = "g",
+	[CC_GE] = "ge",
+	[CC_B] = "b",
+	[CC_AE] = "ae",
+	[CC_S] = "s",
+	[CC_NS] = "ns",
+};
+
+static char const* SIZE_NAMES[] = {
+	[1] = "BYTE",
+	[2] = "WORD",
+	[4] = "DWORD",
+	[8] = "QWORD",
+};
+
+enum condition invert_condition(enum condition cc)
+{
+	switch (cc) {
+	case CC_E:  return CC_NE;
+	case CC_NE: return CC_E;
+	case CC_L:  return CC_GE;
+	case CC_LE: return CC_G;
+	case CC_G:  return CC_LE;
+	case CC_GE: return CC_L;
+	case CC_B:  return CC_AE;
+	case CC_AE: return CC_B;
+	case CC_S:  return CC_NS;
+	case CC_NS: return CC_S;
+	}
+	assert(0 && "unreachable");
+}
+
+char const* reg_name(enum reg r, unsigned size)
+{
+	switch (size) {
+	case 1:  return REG_NAMES[r][0];
+	case 2:  return REG_NAMES[r][1];
+	case 4:  return REG_NAMES[r][2];
+	default: return REG_NAMES[r][3];
+	}
+}
+
+void print_reference(FILE *out, struct operand op)
+{
+	switch (op.ref) {
+	case REF_NONE:                                                 break;
+	case REF_SYMBOL:  fprintf(out, "sym_%zu", op.id);              break;
+	case REF_EXTERN:  fprintf(out, "%s", op.name);                 break;
+	case REF_PLT:     fprintf(out, "%s WRT ..plt", op.name);       break;
+	case REF_GOT:     fprintf(out, "%s WRT ..gotpcrel", op.name);  break;
+	case REF_STRINGS: fprintf(out, "strend");                      break;
+	case REF_LOCAL:   fprintf(out, ".local_%zu", op.id);           break;
+	case REF_LABEL:   fprintf(out, ".label_%zu", op.id);           break;
+	}
+}
+
+void print_operand(FILE *out, struct operand op)
+{
+	switch (op.kind) {
+	case OPERAND_NONE:
+		break;
+
+	case OPERAND_REG:
+		fprintf(out, "%s", reg_name(op.reg, op.size));
+		break;
+
+	case OPERAND_IMM:
+		fprintf(out, "%"PRId64, op.disp);
+		break;
+
+	case OPERAND_LABEL:
+		print_reference(out, op);
+		break;
+
+	case OPERAND_VREG:
+		fprintf(out, "%cmm%u", op.size == 32 ? 'y' : 'x', op.reg);
+		break;
+
+	case OPERAND_MEM:
+		if (op.size) {
+			fprintf(out, "%s ", SIZE_NAMES[op.size]);
+		}
+		fprintf(out, "[");
+		if (op.reg)   fprintf(out, "%s", reg_name(op.reg, 8));
+		if (op.index) fprintf(out, "+%s*%u", reg_name(op.index, 8), op.scale);
+		print_reference(out, op);
+		int64_t disp = op.disp;
+		if (op.ref == REF_STRINGS) disp -= string_offset(op.name);
+		if (disp)     fprintf(out, "%+"PRId64, disp);
+		fprintf(out, "]");
+		break;
+	}
+}
+
+void print_instruction(FILE *out, struct instruction const* in)
+{
+	switch (in->op) {
+	case OP_NOP:
+		return;
+
+	case OP_LABEL:
+		print_operand(out, in->dst);
+		fprintf(out, ":\n");
+		return;
+
+	case OP_COMMENT:
+		fprintf(out, "\t; %s\n", in->comment);
+		return;
+
+	default:
+		break;
+	}
+
+	// AVX2 forms of SSE2 instructions use VEX prefix and three operands
+	bool avx = (in->dst.kind == OPERAND_VREG && in->dst.size == 32) || (in->src.kind == OPERAND_VREG && in->src.size == 32);
+	bool three_operands = avx && in->op >= OP_PADDQ && in->op <= OP_PXOR;
+
+	fprintf(out, "\t%s%s", avx && in->op != OP_VPBROADCASTQ ? "v" : "", MNEMONICS[in->op]);
+	if (in->op == OP_JCC || in->op == OP_SETCC) {
+		fprintf(out, "%s", CONDITION_SUFFIX[in->cc]);
+	}
+	if (in->dst.kind != OPERAND_NONE) {
+		fprintf(out, " ");
+		print_operand(out, in->dst);
+	}
+	if (three_operands) {
+		fprintf(out, ", ");
+		print_operand(out, in->dst);
+	}
+	if (in->src.kind != OPERAND_NONE) {
+		fprintf(out, ", ");
+		print_operand(out, in->src);
+	}
+	fprintf(out, "\n");
+}
+
+#define REG_BIT(r) (1u << (r))
+
+#define CALLER_SAVED_REGS (REG_BIT(REG_RAX) | REG_BIT(REG_RCX) | REG_BIT(REG_RDX) | REG_BIT(REG_RSI) \
+	| REG_BIT(REG_RDI) | REG_BIT(REG_R8) | REG_BIT(REG_R9) | REG_BIT(REG_R10) | REG_BIT(REG_R11))
+
+unsigned address_regs(struct operand op)
+{
+	if (op.kind != OPERAND_MEM) return 0;
+	return (op.reg ? REG_BIT(op.reg) : 0) | (op.index ? REG_BIT(op.index) : 0);
+}
+
+unsigned operand_regs(struct operand op)
+{
+	return op.kind == OPERAND_REG ? REG_BIT(op.reg) : address_regs(op);
+}
+
+// Computes registers that instruction reads and writes, conservatively
+void instruction_regs(struct instruction const* in, unsigned *read, unsigned *written)
+{
+	unsigned dst = in->dst.kind == OPERAND_REG ? REG_BIT(in->dst.reg) : 0;
+
+	*read = address_regs(in->dst) | operand_regs(in->src);
+	*written = 0;
+
+	switch (in->op) {
+	case OP_NOP:
+	case OP_LABEL:
+	case OP_COMMENT:
+	case OP_JMP:
+	case OP_JCC:
+		break;
+
+	case OP_MOV:
+	case OP_MOVSX:
+	case OP_MOVSXD:
+	case OP_MOVZX:
+	case OP_LEA:
+	case OP_SETCC:
+		*written = dst;
+		// Writes to 8 and 16 bit registers preserve rest of the register
+		if (in->dst.kind == OPERAND_REG && in->dst.size < 4) {
+			*read |= dst;
+		}
+		break;
+
+	case OP_XOR:
+	case OP_SUB:
+		// Zeroing idiom doesn't depend on the previous value
+		if (in->dst.kind == OPERAND_REG && in->src.kind == OPERAND_REG && in->dst.reg == in->src.reg) {
+			*read = 0;
+			*written = dst;
+			break;
+		}
+		[[fallthrough]];
+	case OP_ADD:
+	case OP_AND:
+	case OP_DEC:
+	case OP_IMUL:
+	case OP_INC:
+	case OP_NEG:
+	case OP_NOT:
+	case OP_OR:
+	case OP_SHL:
+	case OP_SHR:
+		*read |= dst;
+		*written = dst;
+		break;
+
+	case OP_CMP:
+	case OP_TEST:
+	case OP_PUSH:
+		*read |= dst;
+		break;
+
+	case OP_CQO:
+		*read |= REG_BIT(REG_RAX);
+		*written = REG_BIT(REG_RDX);
+		break;
+
+	case OP_IDIV:
+		*read |= dst | REG_BIT(REG_RAX) | REG_BIT(REG_RDX);
+		*written = REG_BIT(REG_RAX) | REG_BIT(REG_RDX);
+		break;
+
+	case OP_CALL:
+		// rax holds number of vector registers used by variadic functions
+		*read |= dst | REG_BIT(REG_RAX);
+		for (size_t i = 0; i < ARRAY_LEN(ABI_REGISTERS); ++i) {
+			*read |= REG_BIT(ABI_REGISTERS[i]);
+		}
+		*written = CALLER_SAVED_REGS;
+		break;
+
+	case OP_RET:
+		*read |= REG_BIT(REG_RAX);
+		break;
+
+	case OP_LEAVE:
+		*read |= REG_BIT(REG_RBP);
+		*written = REG_BIT(REG_RBP) | REG_BIT(REG_RSP);
+		break;
+
+	// Old value of the memory operand is returned in the source register
+	case OP_XADD:
+	case OP_XCHG:
+		*written = operand_regs(in->src);
+		break;
+
+	case OP_CMPXCHG:
+		*read |= REG_BIT(REG_RAX);
+		*written = REG_BIT(REG_RAX);
+		break;
+
+	case OP_MFENCE:
+	case OP_PAUSE:
+		break;
+
+	// Vector registers are not tracked, only registers used for addressing
+	case OP_MOVDQU:
+	case OP_MOVQ:
+	case OP_PADDQ:
+	case OP_PAND:
+	case OP_POR:
+	case OP_PSLLQ:
+	case OP_PSRLQ:
+	case OP_PSUBQ:
+	case OP_PUNPCKLQDQ:
+	case OP_PXOR:
+	case OP_VPBROADCASTQ:
+	case OP_VZEROUPPER:
+		break;
+	}
+}
+
+bool fits_imm32(int64_t value)
+{
+	return value == (int32_t)value;
+}
+
+bool is_qword_reg(struct operand op)
+{
+	return op.kind == OPERAND_REG && op.size == 8;
+}
+
+bool is_load(struct instruction const* in)
+{
+	return in->op == OP_MOV && is_qword_reg(in->dst) && in->src.kind == OPERAND_MEM;
+}
+
+bool is_jump(struct instruction const* in)
+{
+	return (in->op == OP_JMP || in->op == OP_JCC) && in->dst.kind == OPERAND_LABEL;
+}
+
+bool is_store(struct instruction const* in)
+{
+	return in->op == OP_MOV && in->dst.kind == OPERAND_MEM && is_qword_reg(in->src);
+}
+
+struct optimizer
+{
+	struct instruction *code;
+	size_t count;
+
+	// Positions of .local_<id> and .label_<id> labels inside code
+	size_t *locals, locals_count;
+	size_t *labels, labels_count;
+
+	// Deepest stack offset which address was taken. Slots at this or lower offset
+	// may be reached through pointer arithmetic.
+	size_t escaped;
+
+	bool *visited;
+	struct {
+		size_t *items;
+		size_t count, capacity;
+	} pending;
+
+	// Instructions that can be executed when entering function from the top
+	bool *reachable;
+};
+
+enum access
+{
+	ACCESS_NONE,
+	ACCESS_READ,
+	ACCESS_WRITE,
+};
+
+enum access reg_access(struct instruction const* in, struct operand location)
+{
+	unsigned read, written;
+	instruction_regs(in, &read, &written);
+	if (read & REG_BIT(location.reg)) return ACCESS_READ;
+	if (written & REG_BIT(location.reg)) return ACCESS_WRITE;
+	return ACCESS_NONE;
+}
+
+bool is_stack_slot(struct operand op)
+{
+	return op.kind == OPERAND_MEM && op.reg == REG_RBP && op.index == REG_NONE && op.ref == REF_NONE;
+}
+
+enum access slot_access(struct instruction const* in, struct operand location)
+{
+	if (is_stack_slot(in->src) && in->src.disp == location.disp) {
+		return ACCESS_READ;
+	}
+	if (is_stack_slot(in->dst) && in->dst.disp == location.disp) {
+		bool full = in->op == OP_MOV && (is_qword_reg(in->src) || in->dst.size == 8);
+		return full ? ACCESS_WRITE : ACCESS_READ;
+	}
+	return ACCESS_NONE;
+}
+
+size_t label_position(struct optimizer *opt, struct operand label)
+{
+	if (label.kind == OPERAND_LABEL && label.ref == REF_LOCAL && label.id < opt->locals_count) {
+		return opt->locals[label.id];
+	}
+	if (label.kind == OPERAND_LABEL && label.ref == REF_LABEL && label.id < opt->labels_count) {
+		return opt->labels[label.id];
+	}
+	return -1;
+}
+
+// Returns true if value of location after instruction at index i is never read on any path
+bool dead_after(struct optimizer *opt, size_t i, struct operand location, enum access (*access)(struct instruction const*, struct operand))
+{
+	memset(opt->visited, 0, opt->count * sizeof(*opt->visited));
+	opt->pending.count = 0;
+	da_append(&opt->pending, i + 1);
+
+	while (opt->pending.count > 0) {
+		for (size_t j = opt->pending.items[--opt->pending.count]; j < opt->count && !opt->visited[j]; ++j) {
+			opt->visited[j] = true;
+
+			struct instruction const* in = &opt->code[j];
+			enum access a = access(in, location);
+			if (a == ACCESS_READ) return false;
+			if (a == ACCESS_WRITE) break;
+
+			if (in->op == OP_RET) break;
+
+			if (in->op == OP_JMP || in->op == OP_JCC) {
+				size_t target = label_position(opt, in->dst);
+				if (target == (size_t)-1) return false;
+				if (in->op == OP_JMP) {
+					j = target - 1;
+					continue;
+				}
+				da_append(&opt->pending, target);
+			}
+		}
+	}
+	return true;
+}
+
+bool reg_dead_after(struct optimizer *opt, size_t i, enum reg r)
+{
+	return dead_after(opt, i, reg(r), reg_access);
+}
+
+// Returns true if flags set by instruction at index i are overwritten before any jcc or setcc
+// reads them on the fallthrough path. Other paths are not followed.
+bool flags_dead_after(struct optimizer *opt, size_t i)
+{
+	for (size_t j = i + 1; j < opt->count; ++j) {
+		switch (opt->code[j].op) {
+		case OP_NOP: case OP_LABEL: case OP_COMMENT:
+		case OP_MOV: case OP_MOVSX: case OP_MOVSXD: case OP_MOVZX: case OP_LEA:
+			continue;
+		case OP_ADD: case OP_AND: case OP_CMP: case OP_IMUL: case OP_NEG: case OP_OR:
+		case OP_SUB: case OP_TEST: case OP_XOR: case OP_CALL: case OP_RET:
+			return true;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// Like reg_access, but ret doesn't count as a read. Only useful for rax reaching
+// ret without being assigned, since the result of function without return(x) is unspecified.
+enum access reg_access_until_ret(struct instruction const* in, struct operand location)
+{
+	return in->op == OP_RET ? ACCESS_NONE : reg_access(in, location);
+}
+
+bool same_location(struct operand a, struct operand b)
+{
+	return a.kind == OPERAND_MEM && b.kind == OPERAND_MEM
+		&& a.reg == b.reg
+		&& a.index == b.index
+		&& a.scale == b.scale
+		&& a.disp == b.disp
+		&& a.ref == b.ref
+		&& a.id == b.id
+		&& a.name == b.name;
+}
+
+bool same_label(struct operand a, struct operand b)
+{
+	return a.kind == OPERAND_LABEL && b.kind == OPERAND_LABEL && a.ref == b.ref && a.id == b.id;
+}
+
+#define PEEPHOLE_WINDOW 16
+
+bool may_write_memory(struct instruction const* in)
+{
+	switch (in->op) {
+	case OP_CMP:
+	case OP_TEST:
+	case OP_PUSH:
+	case OP_IDIV:
+		return false;
+	case OP_CALL:
+	// Other threads may write memory, so values loaded before barriers are not reused
+	case OP_MFENCE:
+	case OP_PAUSE:
+		return true;
+	default:
+		return in->dst.kind == OPERAND_MEM;
+	}
+}
+
+// Searches for the closest instruction before load at index i that stored or loaded
+// the same location, with neither location nor register holding it changed in between
+size_t find_available_value(struct optimizer *opt, size_t i)
+{
+	struct instruction const* code = opt->code;
+	struct operand location = code[i].src;
+	bool private_slot = is_stack_slot(location) && (size_t)-location.disp > opt->escaped;
+	unsigned clobbered = 0;
+
+	for (size_t j = i - 1, n = 0; j < i && n < PEEPHOLE_WINDOW; --j) {
+		struct instruction const* in = &code[j];
+		switch (in->op) {
+		case OP_NOP:
+		case OP_COMMENT:
+			continue;
+		case OP_LABEL:
+		case OP_JMP:
+		case OP_JCC:
+		case OP_RET:
+			return -1;
+		default:
+			++n;
+		}
+
+		if (in->op == OP_MOV && same_location(in->dst, location)) {
+			if (is_qword_reg(in->src) && !(clobbered & REG_BIT(in->src.reg))) return j;
+			if (in->src.kind == OPERAND_IMM && in->dst.size == 8) return j;
+			return -1;
+		}
+
+		if (is_load(in) && same_location(in->src, location)
+		&& !(clobbered & REG_BIT(in->dst.reg)) && !(address_regs(location) & REG_BIT(in->dst.reg))) {
+			return j;
+		}
+
+		unsigned read, written;
+		instruction_regs(in, &read, &written);
+		clobbered |= written;
+
+		if (clobbered & address_regs(location)) return -1;
+		if (same_location(in->dst, location) && may_write_memory(in)) return -1;
+		if (!private_slot && may_write_memory(in)) return -1;
+	}
+	return -1;
+}
+
+// mov [m], rA; ...; mov rB, [m] => mov [m], rA; ...; mov rB, rA
+bool peephole_store_reload(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (!is_load(&code[i])) return false;
+
+	size_t j = find_available_value(opt, i);
+	if (j == (size_t)-1 || code[j].op != OP_MOV || code[j].dst.kind != OPERAND_MEM) return false;
+
+	if (code[j].src.kind == OPERAND_REG && code[j].src.reg == code[i].dst.reg) {
+		code[i].op = OP_NOP;
+	} else {
+		code[i].src = code[j].src;
+		code[i].src.size = code[j].src.kind == OPERAND_REG ? 8 : 0;
+	}
+	return true;
+}
+
+// mov rA, [m]; ...; mov rB, [m] => mov rA, [m]; ...; mov rB, rA
+bool peephole_load_reuse(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (!is_load(&code[i])) return false;
+
+	size_t j = find_available_value(opt, i);
+	if (j == (size_t)-1 || !is_load(&code[j])) return false;
+
+	if (code[j].dst.reg == code[i].dst.reg) {
+		code[i].op = OP_NOP;
+	} else {
+		code[i].src = code[j].dst;
+	}
+	return true;
+}
+
+// mov rA, rA   =>
+// lea rA, [rA] =>
+bool peephole_self_move(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (code[i].op == OP_MOV && is_qword_reg(code[i].dst) && is_qword_reg(code[i].src) && code[i].dst.reg == code[i].src.reg) {
+		code[i].op = OP_NOP;
+		return true;
+	}
+	if (code[i].op == OP_LEA && is_qword_reg(code[i].dst) && same_location(code[i].src, deref(code[i].dst.reg))) {
+		code[i].op = OP_NOP;
+		return true;
+	}
+	return false;
+}
+
+// jmp L; <unreachable>; L: => jmp L; L:
+bool peephole_unreachable(struct optimizer *opt, size_t i)
+{
+	if (opt->reachable[i]) return false;
+	opt->code[i].op = OP_NOP;
+	return true;
+}
+
+// jmp L; L: => L:
+bool peephole_jump_to_next(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (code[i].op != OP_JMP || code[i].dst.kind != OPERAND_LABEL) return false;
+
+	for (size_t j = i + 1; j < opt->count; ++j) {
+		switch (code[j].op) {
+		case OP_LABEL:
+			if (same_label(code[i].dst, code[j].dst)) {
+				code[i].op = OP_NOP;
+				return true;
+			}
+			[[fallthrough]];
+		case OP_NOP:
+		case OP_COMMENT:
+			continue;
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+// jcc L1; jmp L2; L1: => jncc L2; L1:
+bool peephole_branch_over_jump(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 2 >= opt->count || code[i].op != OP_JCC || code[i+1].op != OP_JMP || code[i+2].op != OP_LABEL) return false;
+	if (!same_label(code[i].dst, code[i+2].dst) || code[i+1].dst.kind != OPERAND_LABEL) return false;
+
+	code[i].cc = invert_condition(code[i].cc);
+	code[i].dst = code[i+1].dst;
+	code[i+1].op = OP_NOP;
+	return true;
+}
+
+// cmp rA, 0 => test rA, rA
+bool peephole_compare_zero(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (code[i].op != OP_CMP || code[i].dst.kind != OPERAND_REG) return false;
+	if (code[i].src.kind != OPERAND_IMM || code[i].src.disp != 0) return false;
+
+	code[i].op = OP_TEST;
+	code[i].src = code[i].dst;
+	return true;
+}
+
+bool evaluate_condition(enum condition cc, int64_t a, int64_t b)
+{
+	switch (cc) {
+	case CC_E:  return a == b;
+	case CC_NE: return a != b;
+	case CC_L:  return a < b;
+	case CC_LE: return a <= b;
+	case CC_G:  return a > b;
+	case CC_GE: return a >= b;
+	case CC_B:  return (uint64_t)a < (uint64_t)b;
+	case CC_AE: return (uint64_t)a >= (uint64_t)b;
+	case CC_S:  return (int64_t)((uint64_t)a - (uint64_t)b) < 0;
+	case CC_NS: return (int64_t)((uint64_t)a - (uint64_t)b) >= 0;
+	}
+	assert(0 && "unreachable");
+	return false;
+}
+
+// mov rA, imm; test rA, rA; jcc L => mov rA, imm; test rA, rA; jmp L (or nothing when never taken)
+bool peephole_constant_branch(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i < 2 || code[i].op != OP_JCC) return false;
+	struct instruction const* cmp = &code[i-1], *mov = &code[i-2];
+	if (mov->op != OP_MOV || !is_qword_reg(mov->dst) || mov->src.kind != OPERAND_IMM) return false;
+	if (!is_qword_reg(cmp->dst) || cmp->dst.reg != mov->dst.reg) return false;
+
+	int64_t rhs;
+	if (cmp->op == OP_TEST && is_qword_reg(cmp->src) && cmp->src.reg == cmp->dst.reg) {
+		rhs = 0;
+	} else if (cmp->op == OP_CMP && cmp->src.kind == OPERAND_IMM) {
+		rhs = cmp->src.disp;
+	} else {
+		return false;
+	}
+
+	if (evaluate_condition(code[i].cc, mov->src.disp, rhs)) {
+		code[i].op = OP_JMP;
+	} else {
+		code[i].op = OP_NOP;
+	}
+	return true;
+}
+
+// cmp x, y => (when flags are overwritten before they are read)
+bool peephole_dead_compare(struct optimizer *opt, size_t i)
+{
+	if (opt->code[i].op != OP_CMP && opt->code[i].op != OP_TEST) return false;
+	if (!flags_dead_after(opt, i)) return false;
+	opt->code[i].op = OP_NOP;
+	return true;
+}
+
+// mov rA, imm; mov [m], rA => mov QWORD [m], imm  (when rA is dead)
+bool peephole_store_immediate(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 1 >= opt->count || code[i].op != OP_MOV || !is_qword_reg(code[i].dst) || code[i].src.kind != OPERAND_IMM) return false;
+	if (code[i].src.disp != (int32_t)code[i].src.disp) return false;
+	if (!is_store(&code[i+1]) || code[i+1].src.reg != code[i].dst.reg) return false;
+	if (address_regs(code[i+1].dst) & REG_BIT(code[i].dst.reg)) return false;
+	if (!reg_dead_after(opt, i + 1, code[i].dst.reg)) return false;
+
+	code[i+1].src = code[i].src;
+	code[i+1].dst.size = 8;
+	code[i].op = OP_NOP;
+	return true;
+}
+
+// mov rA, [m]; op rB, rA => op rB, [m]         (when rA is dead)
+// mov rA, [m]; cmp rA, x  => cmp QWORD [m], x  (when rA is dead)
+bool peephole_fold_load(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 1 >= opt->count || !is_load(&code[i])) return false;
+
+	struct instruction *load = &code[i], *use = &code[i+1];
+	enum reg r = load->dst.reg;
+
+	switch (use->op) {
+	case OP_ADD: case OP_AND: case OP_CMP: case OP_IMUL: case OP_OR: case OP_SUB: case OP_XOR:
+		break;
+	default:
+		return false;
+	}
+
+	if (is_qword_reg(use->dst) && use->dst.reg != r && is_qword_reg(use->src) && use->src.reg == r) {
+		if (!reg_dead_after(opt, i + 1, r)) return false;
+		use->src = load->src;
+		load->op = OP_NOP;
+		return true;
+	}
+
+	if (use->op == OP_CMP && is_qword_reg(use->dst) && use->dst.reg == r
+	&& ((is_qword_reg(use->src) && use->src.reg != r)
+		|| (use->src.kind == OPERAND_IMM && use->src.disp == (int32_t)use->src.disp))) {
+		if (!reg_dead_after(opt, i + 1, r)) return false;
+		use->dst = qword(load->src);
+		load->op = OP_NOP;
+		return true;
+	}
+
+	return false;
+}
+
+// mov rA, imm; op rB, rA              => op rB, imm                (when rA is dead)
+// mov rcx, imm; shl rB, cl            => shl rB, imm
+// mov rA, imm; lea rB, [rC+rA*scale]  => lea rB, [rC+imm*scale]
+bool peephole_fold_immediate(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 1 >= opt->count || code[i].op != OP_MOV || !is_qword_reg(code[i].dst) || code[i].src.kind != OPERAND_IMM) return false;
+
+	struct instruction *use = &code[i+1];
+	enum reg r = code[i].dst.reg;
+	int64_t value = code[i].src.disp;
+
+	switch (use->op) {
+	case OP_ADD: case OP_AND: case OP_CMP: case OP_IMUL: case OP_OR: case OP_SUB: case OP_XOR:
+		if (!is_qword_reg(use->dst) || use->dst.reg == r || !is_qword_reg(use->src) || use->src.reg != r) return false;
+		if (value != (int32_t)value) return false;
+		break;
+
+	case OP_SHL: case OP_SHR:
+		if (use->dst.kind != OPERAND_REG || use->dst.reg == r || use->src.kind != OPERAND_REG || use->src.reg != r) return false;
+		if (value < 0 || value > 63) return false;
+		break;
+
+	case OP_LEA:
+		if (use->src.index != r || use->src.reg == r) return false;
+		if (value * use->src.scale + use->src.disp != (int32_t)(value * use->src.scale + use->src.disp)) return false;
+		break;
+
+	default:
+		return false;
+	}
+
+	if (!reg_dead_after(opt, i + 1, r)) return false;
+
+	if (use->op == OP_LEA) {
+		use->src.disp += value * use->src.scale;
+		use->src.index = REG_NONE;
+		use->src.scale = 0;
+	} else {
+		use->src = imm(value);
+	}
+	code[i].op = OP_NOP;
+	return true;
+}
+
+// mov rA, x => (when rA is dead)
+bool peephole_dead_move(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	switch (code[i].op) {
+	case OP_MOV: case OP_MOVSX: case OP_MOVSXD: case OP_MOVZX: case OP_LEA: case OP_SETCC:
+		break;
+	default:
+		return false;
+	}
+	if (code[i].dst.kind != OPERAND_REG) return false;
+	if (!reg_dead_after(opt, i, code[i].dst.reg)) return false;
+	code[i].op = OP_NOP;
+	return true;
+}
+
+// lea rA, [m]; ...; op x, [rA+d] => ...; op x, [m+d] (when rA is dead afterwards
+// and registers of m keep their values in between)
+bool peephole_fold_address(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (code[i].op != OP_LEA || !is_qword_reg(code[i].dst) || code[i].src.ref != REF_NONE) return false;
+	enum reg r = code[i].dst.reg;
+	unsigned address = address_regs(code[i].src);
+	if (address & REG_BIT(r)) return false;
+
+	// Find first use of rA
+	size_t j = i + 1;
+	for (; j < opt->count && j < i + PEEPHOLE_WINDOW; ++j) {
+		if (code[j].op == OP_LABEL || is_jump(&code[j])) return false;
+		unsigned read, written;
+		instruction_regs(&code[j], &read, &written);
+		if (read & REG_BIT(r)) break;
+		if (written & (address | REG_BIT(r))) return false;
+	}
+	if (j == opt->count || j == i + PEEPHOLE_WINDOW) return false;
+
+	struct instruction use = code[j];
+	struct operand *mem = use.src.kind == OPERAND_MEM && use.src.reg == r ? &use.src : &use.dst;
+	if (mem->kind != OPERAND_MEM || mem->reg != r || mem->index != REG_NONE || mem->ref != REF_NONE) return false;
+	if (!fits_imm32(code[i].src.disp + mem->disp)) return false;
+
+	int64_t disp = mem->disp;
+	unsigned size = mem->size;
+	*mem = code[i].src;
+	mem->disp += disp;
+	mem->size = size;
+
+	unsigned read, written;
+	instruction_regs(&use, &read, &written);
+	if (read & REG_BIT(r)) return false;
+
+	struct instruction original = code[j];
+	code[j] = use;
+	if (!reg_dead_after(opt, i, r)) {
+		code[j] = original;
+		return false;
+	}
+	code[i].op = OP_NOP;
+	return true;
+}
+
+// Replaces rA in operand with rB, which is rA - offset
+bool substitute_reg(struct operand *op, enum reg from, enum reg to, int64_t offset)
+{
+	if (op->kind == OPERAND_REG && op->reg == from) {
+		if (offset != 0 || op->size < 8) return false;
+		op->reg = to;
+		return true;
+	}
+	if (op->kind != OPERAND_MEM) return true;
+	int64_t disp = op->disp;
+	if (op->reg == from) {
+		op->reg = to;
+		disp += offset;
+	}
+	if (op->index == from) {
+		op->index = to;
+		disp += offset * op->scale;
+	}
+	if (!fits_imm32(disp)) return false;
+	op->disp = disp;
+	return true;
+}
+
+// inc, dec, add or sub of a constant to register r
+bool constant_step(struct instruction const* in, enum reg r, int64_t *step)
+{
+	if (!is_qword_reg(in->dst) || in->dst.reg != r) return false;
+	switch (in->op) {
+	case OP_INC: *step = 1; return true;
+	case OP_DEC: *step = -1; return true;
+	case OP_ADD: *step = in->src.disp; return in->src.kind == OPERAND_IMM;
+	case OP_SUB: *step = -in->src.disp; return in->src.kind == OPERAND_IMM;
+	default: return false;
+	}
+}
+
+// mov rA, rB; add rA, imm => lea rA, [rB+imm] (also sub, inc and dec, when flags are
+// overwritten before they are read)
+bool peephole_offset_copy(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 1 >= opt->count) return false;
+	if (code[i].op != OP_MOV || !is_qword_reg(code[i].dst) || !is_qword_reg(code[i].src)) return false;
+	if (code[i].src.reg == REG_RSP || code[i].dst.reg == code[i].src.reg) return false;
+
+	int64_t step;
+	if (!constant_step(&code[i+1], code[i].dst.reg, &step) || !fits_imm32(step)) return false;
+	if (!flags_dead_after(opt, i + 1)) return false;
+
+	code[i].op = OP_LEA;
+	code[i].src = (struct operand) { .kind = OPERAND_MEM, .reg = code[i].src.reg, .disp = step };
+	code[i+1].op = OP_NOP;
+	return true;
+}
+
+// mov rA, rB; op x, [rA+...]          => op x, [rB+...]           (when rA is dead afterwards)
+// lea rA, [rB+d]; op x, [y+rA*s]      => op x, [y+rB*s+d*s]
+// mov rA, rB; inc rB; op x, [y+rA*s]  => inc rB; op x, [y+rB*s-s]
+bool peephole_copy_propagate(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (!is_qword_reg(code[i].dst)) return false;
+	enum reg from = code[i].dst.reg, to;
+	int64_t offset = 0; // rA = rB + offset, where rB is the value of rB at the copy
+	if (code[i].op == OP_MOV && is_qword_reg(code[i].src)) {
+		to = code[i].src.reg;
+	} else if (code[i].op == OP_LEA && code[i].src.index == REG_NONE && code[i].src.ref == REF_NONE
+			&& code[i].src.reg != REG_NONE && code[i].src.reg != REG_RBP) {
+		to = code[i].src.reg;
+		offset = code[i].src.disp;
+	} else {
+		return false;
+	}
+	if (from == to) return false;
+
+	// Uses of rA are rewritten while rB keeps its value or is only incremented
+	struct { size_t at; struct instruction original; } changes[PEEPHOLE_WINDOW];
+	size_t changes_count = 0;
+	int64_t delta = 0;
+	for (size_t j = i + 1; j < opt->count && j < i + PEEPHOLE_WINDOW; ++j) {
+		if (code[j].op == OP_LABEL || is_jump(&code[j])) break;
+		unsigned read, written;
+		instruction_regs(&code[j], &read, &written);
+		if (read & REG_BIT(from)) {
+			struct instruction in = code[j];
+			if (!substitute_reg(&in.src, from, to, offset - delta)) break;
+			// Destination register is only read by comparisons
+			bool compare = in.op == OP_CMP || in.op == OP_TEST;
+			if ((in.dst.kind == OPERAND_MEM || compare) && !substitute_reg(&in.dst, from, to, offset - delta)) break;
+			instruction_regs(&in, &read, &written);
+			if (read & REG_BIT(from)) break;
+			// Partial register writes keep rest of the register
+			if (in.dst.kind == OPERAND_REG && in.dst.reg == to && in.dst.size < 4) break;
+			changes[changes_count].at = j;
+			changes[changes_count++].original = code[j];
+			code[j] = in;
+		}
+		if (written & REG_BIT(from)) break;
+		if (written & REG_BIT(to)) {
+			struct instruction const* in = &code[j];
+			int64_t step;
+			if (!constant_step(in, to, &step)) break;
+			delta += step;
+		}
+	}
+	if (changes_count == 0) return false;
+
+	if (!reg_dead_after(opt, i, from)) {
+		while (changes_count > 0) {
+			--changes_count;
+			code[changes[changes_count].at] = changes[changes_count].original;
+		}
+		return false;
+	}
+	code[i].op = OP_NOP;
+	return true;
+}
+
+// op rA, x; mov rB, rA => op rB, x (when rA is dead afterwards)
+bool peephole_retarget(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 1 >= opt->count) return false;
+	switch (code[i].op) {
+	case OP_MOV: case OP_MOVSX: case OP_MOVSXD: case OP_MOVZX: case OP_LEA:
+		break;
+	default:
+		return false;
+	}
+	if (!is_qword_reg(code[i].dst)) return false;
+	struct instruction const* copy = &code[i+1];
+	if (copy->op != OP_MOV || !is_qword_reg(copy->dst) || !is_qword_reg(copy->src)) return false;
+	if (copy->src.reg != code[i].dst.reg || copy->dst.reg == copy->src.reg) return false;
+	if (!reg_dead_after(opt, i + 1, code[i].dst.reg)) return false;
+
+	code[i].dst.reg = copy->dst.reg;
+	code[i+1].op = OP_NOP;
+	return true;
+}
+
+// mov rA, rB; op rA, x; mov rB, rA => op rB, x (when rA is dead afterwards)
+bool peephole_accumulate(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (i + 2 >= opt->count) return false;
+	struct instruction const* load = &code[i], *op = &code[i+1], *store = &code[i+2];
+	if (load->op != OP_MOV || !is_qword_reg(load->dst) || !is_qword_reg(load->src)) return false;
+	enum reg a = load->dst.reg, b = load->src.reg;
+	if (a == b) return false;
+
+	switch (op->op) {
+	case OP_ADD: case OP_AND: case OP_IMUL: case OP_OR: case OP_SUB: case OP_XOR:
+		break;
+	default:
+		return false;
+	}
+	if (!is_qword_reg(op->dst) || op->dst.reg != a || (operand_regs(op->src) & REG_BIT(a))) return false;
+	if (store->op != OP_MOV || !is_qword_reg(store->dst) || store->dst.reg != b || !is_qword_reg(store->src) || store->src.reg != a) return false;
+	if (!reg_dead_after(opt, i + 2, a)) return false;
+
+	code[i+1].dst.reg = b;
+	code[i].op = OP_NOP;
+	code[i+2].op = OP_NOP;
+	return true;
+}
+
+// mov [rbp-N], x => (when slot is never read afterwards)
+bool peephole_dead_store(struct optimizer *opt, size_t i)
+{
+	struct instruction *code = opt->code;
+	if (code[i].op != OP_MOV || !is_stack_slot(code[i].dst)) return false;
+	if ((size_t)-code[i].dst.disp <= opt->escaped) return false;
+	if (!dead_after(opt, i, code[i].dst, slot_access)) return false;
+	code[i].op = OP_NOP;
+	return true;
+}
+
+struct peephole
+{
+	char const* name;
+	bool (*apply)(struct optimizer *opt, size_t i);
+	size_t hits;
+};
+
+static struct peephole PEEPHOLES[] = {
+	{ .name = "unreachable",       .apply = peephole_unreachable },
+	{ .name = "store-reload",      .apply = peephole_store_reload },
+	{ .name = "load-reuse",        .apply = peephole_load_reuse },
+	{ .name = "self-move",         .apply = peephole_self_move },
+	{ .name = "jump-to-next",      .apply = peephole_jump_to_next },
+	{ .name = "branch-over-jump",  .apply = peephole_branch_over_jump },
+	{ .name = "compare-zero",      .apply = peephole_compare_zero },
+	{ .name = "constant-branch",   .apply = peephole_constant_branch },
+	{ .name = "dead-compare",      .apply = peephole_dead_compare },
+	{ .name = "store-immediate",   .apply = peephole_store_immediate },
+	{ .name = "fold-load",         .apply = peephole_fold_load },
+	{ .name = "fold-immediate",    .apply = peephole_fold_immediate },
+	{ .name = "fold-address",      .apply = peephole_fold_address },
+	{ .name = "offset-copy",       .apply = peephole_offset_copy },
+	{ .name = "copy-propagate",    .apply = peephole_copy_propagate },
+	{ .name = "retarget",          .apply = peephole_retarget },
+	{ .name = "accumulate",        .apply = peephole_accumulate },
+	{ .name = "dead-move",         .apply = peephole_dead_move },
+	{ .name = "dead-store",        .apply = peephole_dead_store },
+};
+
+void find_reachable(struct optimizer *opt)
+{
+	opt->reachable = realloc(opt->reachable, (opt->count + 1) * sizeof(*opt->reachable));
+	memset(opt->reachable, 0, opt->count * sizeof(*opt->reachable));
+	opt->pending.count = 0;
+	da_append(&opt->pending, 0);
+
+	while (opt->pending.count > 0) {
+		for (size_t j = opt->pending.items[--opt->pending.count]; j < opt->count && !opt->reachable[j]; ++j) {
+			struct instruction const* in = &opt->code[j];
+			opt->reachable[j] = true;
+
+			// Labels used as values or targets of unknown jumps make everything reachable
+			struct operand const* operands[] = { &in->dst, &in->src };
+			for (size_t k = 0; k < ARRAY_LEN(operands); ++k) {
+				if (operands[k]->ref != REF_LOCAL && operands[k]->ref != REF_LABEL) continue;
+				if (in->op == OP_LABEL) continue;
+				size_t target = label_position(opt, *operands[k]);
+				if (target == (size_t)-1 || (in->op != OP_JMP && in->op != OP_JCC)) {
+					memset(opt->reachable, 1, opt->count * sizeof(*opt->reachable));
+					return;
+				}
+				da_append(&opt->pending, target);
+			}
+			if (in->op == OP_JMP || in->op == OP_RET) break;
+		}
+	}
+}
+
+void analyze_function(struct compiler *compiler, struct optimizer *opt)
+{
+	opt->code = compiler->code.items;
+	opt->count = compiler->code.count;
+	opt->escaped = 0;
+
+	// Functions are optimized after the whole program was parsed, so label counts come from the code
+	opt->locals_count = opt->labels_count = 0;
+	for (size_t i = 0; i < opt->count; ++i) {
+		struct instruction const* in = &opt->code[i];
+		if (in->op == OP_LABEL && in->dst.ref == REF_LOCAL && in->dst.id >= opt->locals_count) {
+			opt->locals_count = in->dst.id + 1;
+		}
+		if (in->op == OP_LABEL && in->dst.ref == REF_LABEL && in->dst.id >= opt->labels_count) {
+			opt->labels_count = in->dst.id + 1;
+		}
+	}
+
+	opt->locals = realloc(opt->locals, (opt->locals_count + 1) * sizeof(*opt->locals));
+	memset(opt->locals, 0xff, (opt->locals_count + 1) * sizeof(*opt->locals));
+
+	opt->labels = realloc(opt->labels, (opt->labels_count + 1) * sizeof(*opt->labels));
+	memset(opt->labels, 0xff, (opt->labels_count + 1) * sizeof(*opt->labels));
+
+	opt->visited = realloc(opt->visited, (opt->count + 1) * sizeof(*opt->visited));
+
+	for (size_t i = 0; i < opt->count; ++i) {
+		struct instruction const* in = &opt->code[i];
+		if (in->op == OP_LABEL && in->dst.ref == REF_LOCAL && in->dst.id < opt->locals_count) {
+			opt->locals[in->dst.id] = i;
+		}
+		if (in->op == OP_LABEL && in->dst.ref == REF_LABEL && in->dst.id < opt->labels_count) {
+			opt->labels[in->dst.id] = i;
+		}
+		if (in->op == OP_LEA && is_stack_slot(in->src) && (size_t)-in->src.disp > opt->escaped) {
+			opt->escaped = -in->src.disp;
+		}
+	}
+
+	find_reachable(opt);
+}
+
+// Callee saved registers are never used by the code generator. Loop optimizer keeps
+// variables and addresses in them, since they survive calls made inside the loop.
+static enum reg const CALLEE_SAVED_REGISTERS[] = { REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15 };
+
+static struct {
+	size_t loops, promoted, hoisted, vectorized, idioms, reduced;
+} loop_stats;
+
+void insert_instruction(struct compiler *compiler, size_t at, struct instruction in)
+{
+	da_append(&compiler->code, in);
+	struct instruction *code = compiler->code.items;
+	memmove(&code[at+1], &code[at], (compiler->code.count - 1 - at) * sizeof(*code));
+	code[at] = in;
+}
+
+// Loop code[head..tail] is simple when it's entered only by falling through the head
+// label and left only by falling through the back edge at the tail or by jumping to
+// labels that directly follow it (up to *exit_end).
+bool is_simple_loop(struct optimizer *opt, size_t head, size_t tail, size_t *exit_end)
+{
+	struct instruction const* code = opt->code;
+
+	size_t exit = tail + 1;
+	while (exit < opt->count && (code[exit].op == OP_LABEL || code[exit].op == OP_NOP || code[exit].op == OP_COMMENT)) {
+		++exit;
+	}
+
+	for (size_t i = 0; i < opt->count; ++i) {
+		if (!is_jump(&code[i])) continue;
+		size_t target = label_position(opt, code[i].dst);
+		if (target == (size_t)-1) return false;
+
+		bool from_inside = head <= i && i <= tail;
+		bool to_inside = head <= target && target <= tail;
+		if (!from_inside && to_inside) return false;
+		if (from_inside && !to_inside && (target <= tail || target >= exit)) return false;
+	}
+
+	*exit_end = exit;
+	return true;
+}
+
+unsigned scratch_registers(struct optimizer *opt, size_t head, size_t tail)
+{
+	static enum reg const SCRATCH[] = { REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11 };
+	unsigned free = 0;
+	for (size_t i = 0; i < ARRAY_LEN(SCRATCH); ++i) {
+		if (reg_dead_after(opt, head, SCRATCH[i]) && reg_dead_after(opt, tail, SCRATCH[i])) {
+			free |= REG_BIT(SCRATCH[i]);
+		}
+	}
+	return free;
+}
+
+enum reg take_register(unsigned *free)
+{
+	for (enum reg r = REG_RAX; r <= REG_R15; ++r) {
+		if (*free & REG_BIT(r)) {
+			*free &= ~REG_BIT(r);
+			return r;
+		}
+	}
+	return REG_NONE;
+}
+
+struct loop_candidate
+{
+	bool address; // lea rA, [m] of a stack slot or of a constant instead of variable access
+	bool written;
+	struct operand location;
+	size_t uses;
+	unsigned rank; // variables carried between iterations go first, then invariants, addresses and temporaries
+	enum reg reg;
+};
+
+// Address that is the same in every iteration. Addresses of globals are left
+// to be folded into memory operands.
+bool is_constant_address(struct operand op)
+{
+	if (op.kind != OPERAND_MEM || op.index != REG_NONE) return false;
+	return is_stack_slot(op) || (op.reg == REG_NONE && op.ref == REF_STRINGS);
+}
+
+struct loop_candidate* count_candidate(struct loop_candidate *candidates, size_t *count, size_t capacity, bool address, struct operand location)
+{
+	for (size_t i = 0; i < *count; ++i) {
+		if (candidates[i].address == address && same_location(candidates[i].location, location)) {
+			++candidates[i].uses;
+			return &candidates[i];
+		}
+	}
+	if (*count == capacity) return NULL;
+	location.size = 0;
+	candidates[*count] = (struct loop_candidate) { .address = address, .location = location, .uses = 1 };
+	return &candidates[(*count)++];
+}
+
+// Promotes the most used local variables of the loop into callee saved registers,
+// loading them before the loop and storing the written ones back on exit. Variables
+// the loop only reads and addresses of local arrays and constants are computed once
+// before the loop. Loops without calls also use caller saved registers that are free
+// around them. Stores that are not needed after the loop and loads of variables that
+// are written first are removed by peepholes.
+bool optimize_loop(struct compiler *compiler, struct optimizer *opt, size_t head, size_t tail)
+{
+	size_t exit;
+	if (!is_simple_loop(opt, head, tail, &exit)) return false;
+
+	struct instruction *code = opt->code;
+	struct loop_candidate candidates[32];
+	size_t candidates_count = 0;
+	unsigned used = 0;
+	bool calls = false;
+
+	for (size_t i = head; i <= tail; ++i) {
+		unsigned read, written;
+		instruction_regs(&code[i], &read, &written);
+		used |= read | written | operand_regs(code[i].dst) | operand_regs(code[i].src);
+		calls |= code[i].op == OP_CALL;
+
+		if (code[i].op == OP_LEA) {
+			if (is_constant_address(code[i].src)) {
+				count_candidate(candidates, &candidates_count, ARRAY_LEN(candidates), true, code[i].src);
+			}
+			continue;
+		}
+
+		struct operand ops[] = { code[i].dst, code[i].src };
+		for (size_t j = 0; j < ARRAY_LEN(ops); ++j) {
+			if (is_stack_slot(ops[j]) && (size_t)-ops[j].disp > opt->escaped) {
+				struct loop_candidate *c = count_candidate(candidates, &candidates_count, ARRAY_LEN(candidates), false, ops[j]);
+				if (c && j == 0 && code[i].op != OP_CMP && code[i].op != OP_TEST && code[i].op != OP_PUSH) {
+					c->written = true;
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < candidates_count; ++i) {
+		struct loop_candidate *c = &candidates[i];
+		if (c->address) {
+			c->rank = 1;
+		} else if (!c->written) {
+			c->rank = 2;
+		} else {
+			c->rank = dead_after(opt, head, c->location, slot_access) ? 0 : 3;
+		}
+	}
+
+	unsigned scratch = calls ? 0 : scratch_registers(opt, head, tail) & ~used
+		& (REG_BIT(REG_R8) | REG_BIT(REG_R9) | REG_BIT(REG_R10) | REG_BIT(REG_R11) | REG_BIT(REG_RSI) | REG_BIT(REG_RDI));
+
+	// Pick candidates in order of rank and uses
+	size_t promoted = 0, next_reg = 0;
+	struct loop_candidate chosen[ARRAY_LEN(CALLEE_SAVED_REGISTERS) + 6];
+	for (;;) {
+		while (next_reg < ARRAY_LEN(CALLEE_SAVED_REGISTERS) && (used & REG_BIT(CALLEE_SAVED_REGISTERS[next_reg]))) {
+			++next_reg;
+		}
+		enum reg r = next_reg < ARRAY_LEN(CALLEE_SAVED_REGISTERS) ? CALLEE_SAVED_REGISTERS[next_reg] : take_register(&scratch);
+		if (r == REG_NONE) break;
+
+		struct loop_candidate *best = NULL;
+		for (size_t i = 0; i < candidates_count; ++i) {
+			struct loop_candidate *c = &candidates[i];
+			if (c->uses < (c->address || !c->written ? 1 : 2)) continue;
+			if (!best || c->rank > best->rank || (c->rank == best->rank && c->uses > best->uses)) best = c;
+		}
+		if (!best) break;
+
+		if (next_reg < ARRAY_LEN(CALLEE_SAVED_REGISTERS)) ++next_reg;
+		best->reg = r;
+		chosen[promoted++] = *best;
+		best->uses = 0;
+	}
+	if (promoted == 0) return false;
+
+	bool stores = false;
+	for (size_t j = 0; j < promoted; ++j) {
+		stores |= chosen[j].written;
+	}
+
+	for (size_t i = head; i <= tail; ++i) {
+		for (size_t j = 0; j < promoted; ++j) {
+			struct loop_candidate const* c = &chosen[j];
+			if (c->address) {
+				if (code[i].op == OP_LEA && same_location(code[i].src, c->location)) {
+					code[i].op = OP_MOV;
+					code[i].src = reg(c->reg);
+				}
+				continue;
+			}
+			if (code[i].op == OP_LEA) continue;
+			if (is_stack_slot(code[i].dst) && code[i].dst.disp == c->location.disp) code[i].dst = reg(c->reg);
+			if (is_stack_slot(code[i].src) && code[i].src.disp == c->location.disp) code[i].src = reg(c->reg);
+		}
+	}
+
+	// Jumps leaving the loop go through the stores as well
+	if (stores) {
+		struct operand exit_label = local_label(compiler->last_local_id++);
+		for (size_t i = head; i <= tail; ++i) {
+			if (is_jump(&code[i]) && label_position(opt, code[i].dst) > tail) {
+				code[i].dst = exit_label;
+			}
+		}
+
+		size_t at = tail + 1;
+		insert_instruction(compiler, at++, (struct instruction) { .op = OP_LABEL, .dst = exit_label });
+		for (size_t j = 0; j < promoted; ++j) {
+			if (!chosen[j].written) continue;
+			struct instruction store = { .op = OP_MOV, .dst = chosen[j].location, .src = reg(chosen[j].reg) };
+			insert_instruction(compiler, at++, store);
+		}
+	}
+
+	for (size_t j = 0; j < promoted; ++j) {
+		struct instruction load = { .op = chosen[j].address ? OP_LEA : OP_MOV, .dst = reg(chosen[j].reg), .src = chosen[j].location };
+		insert_instruction(compiler, head + j, load);
+		++*(chosen[j].written ? &loop_stats.promoted : &loop_stats.hoisted);
+		if (chosen[j].written) da_append(&compiler->promoted, (size_t)-chosen[j].location.disp);
+	}
+
+	++loop_stats.loops;
+	return true;
+}
+
+// Optimizes first loop (innermost first) where something could be done.
+// Backward jump from tail to a label at head is treated as a loop.
+bool optimize_loops(struct compiler *compiler, struct optimizer *opt)
+{
+	analyze_function(compiler, opt);
+	for (size_t tail = 0; tail < opt->count; ++tail) {
+		if (!is_jump(&opt->code[tail])) continue;
+		size_t head = label_position(opt, opt->code[tail].dst);
+		if (head < tail && optimize_loop(compiler, opt, head, tail)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Auto-vectorizer
+//
+// Loops left by the loop optimizer in the form:
+//   .body:
+//     ... straight line code ...
+//     cmp i, n
+//     jl .body
+// where i is incremented by one, memory is accessed only as b[i] and there is a single
+// store a[i] = expr made of + - & | ^ << >> over loaded words and loop invariants,
+// get a vector version in front of them. It processes 4 words per iteration with AVX2
+// or 2 words with SSE2, chosen at runtime; the scalar loop handles the remainder.
+
+// Detects AVX2 support (CPU and OS saving ymm registers), preserving all registers
+void print_simd_detect(void)
+{
+	print_text_section(SIMD_DETECT);
+	printf("%s:\n", SIMD_DETECT);
+	printf("\tpush rax\n");
+	printf("\tpush rbx\n");
+	printf("\tpush rcx\n");
+	printf("\tpush rdx\n");
+	printf("\tmov QWORD [%s], %d\n", SIMD_LEVEL, SIMD_SSE2);
+	printf("\txor eax, eax\n");
+	printf("\tcpuid\n");
+	printf("\tcmp eax, 7\n");
+	printf("\tjb .done\n");
+	printf("\tmov eax, 1\n");
+	printf("\tcpuid\n");
+	printf("\tand ecx, 0x18000000\n"); // OSXSAVE and AVX
+	printf("\tcmp ecx, 0x18000000\n");
+	printf("\tjne .done\n");
+	printf("\txor ecx, ecx\n");
+	printf("\txgetbv\n");
+	printf("\tand eax, 6\n"); // xmm and ymm state
+	printf("\tcmp eax, 6\n");
+	printf("\tjne .done\n");
+	printf("\tmov eax, 7\n");
+	printf("\txor ecx, ecx\n");
+	printf("\tcpuid\n");
+	printf("\ttest ebx, 0x20\n"); // AVX2
+	printf("\tjz .done\n");
+	printf("\tmov QWORD [%s], %d\n", SIMD_LEVEL, SIMD_AVX2);
+	printf(".done:\n");
+	printf("\tpop rdx\n");
+	printf("\tpop rcx\n");
+	printf("\tpop rbx\n");
+	printf("\tpop rax\n");
+	printf("\tret\n");
+}
+
+#define AFFINE_MAX_TERMS 4
+#define VECTOR_MAX_LOCATIONS 32
+#define VECTOR_MAX_NODES 64
+#define VECTOR_MAX_DEPTH 8
+#define VECTOR_MAX_INVARIANTS 8
+
+// constant + sum of coeff * (initial value of location key).
+// Key is register number for registers and (negative) displacement for stack slots.
+struct affine
+{
+	int64_t constant;
+	size_t count;
+	struct { int64_t key, coeff; } terms[AFFINE_MAX_TERMS];
+};
+
+struct vvalue
+{
+	enum { VALUE_UNKNOWN, VALUE_AFFINE, VALUE_VECTOR } kind;
+	struct affine affine;
+	size_t node;
+};
+
+struct vnode
+{
+	enum opcode op;       // OP_MOVDQU for load, OP_MOVZX for byte load, OP_MOVQ for invariant, packed operation otherwise
+	struct affine affine; // address for loads, value for invariants
+	size_t lhs, rhs;
+	unsigned vreg;        // register with broadcasted invariant
+};
+
+struct vectorizer
+{
+	struct optimizer *opt;
+
+	struct { int64_t key; struct vvalue value; bool written; } locations[VECTOR_MAX_LOCATIONS];
+	size_t locations_count;
+
+	struct vnode nodes[VECTOR_MAX_NODES];
+	size_t nodes_count;
+
+	bool stored;
+	struct affine store_address;
+	struct vvalue store_value;
+
+	bool compared;
+	struct vvalue cmp_lhs, cmp_rhs;
+
+	// Emitted code
+	struct {
+		struct instruction *items;
+		size_t count, capacity;
+	} code;
+};
+
+bool affine_add(struct affine *a, struct affine const* b, int64_t sign)
+{
+	a->constant += sign * b->constant;
+	for (size_t i = 0; i < b->count; ++i) {
+		size_t j = 0;
+		while (j < a->count && a->terms[j].key != b->terms[i].key) ++j;
+		if (j == a->count) {
+			if (a->count == AFFINE_MAX_TERMS) return false;
+			a->terms[a->count].key = b->terms[i].key;
+			a->terms[a->count++].coeff = 0;
+		}
+		a->terms[j].coeff += sign * b->terms[i].coeff;
+		if (a->terms[j].coeff == 0) {
+			a->terms[j] = a->terms[--a->count];
+		}
+	}
+	return true;
+}
+
+void affine_scale(struct affine *a, int64_t k)
+{
+	a->constant *= k;
+	for (size_t i = 0; i < a->count; ++i) {
+		a->terms[i].coeff *= k;
+	}
+	if (k == 0) a->count = 0;
+}
+
+int64_t affine_coeff(struct affine const* a, int64_t key)
+{
+	for (size_t i = 0; i < a->count; ++i) {
+		if (a->terms[i].key == key) return a->terms[i].coeff;
+	}
+	return 0;
+}
+
+// Terms of both are the same, constants may differ
+bool affine_same_terms(struct affine const* a, struct affine const* b)
+{
+	if (a->count != b->count) return false;
+	for (size_t i = 0; i < a->count; ++i) {
+		if (affine_coeff(b, a->terms[i].key) != a->terms[i].coeff) return false;
+	}
+	return true;
+}
+
+struct vvalue affine_value(int64_t constant)
+{
+	return (struct vvalue) { .kind = VALUE_AFFINE, .affine = { .constant = constant } };
+}
+
+bool location_key(struct vectorizer *v, struct operand op, int64_t *key)
+{
+	if (op.kind == OPERAND_REG) {
+		*key = op.reg;
+		return true;
+	}
+	if (is_stack_slot(op) && (size_t)-op.disp > v->opt->escaped) {
+		*key = op.disp;
+		return true;
+	}
+	return false;
+}
+
+size_t find_location(struct vectorizer *v, int64_t key)
+{
+	for (size_t i = 0; i < v->locations_count; ++i) {
+		if (v->locations[i].key == key) return i;
+	}
+	if (v->locations_count == VECTOR_MAX_LOCATIONS) return -1;
+
+	size_t i = v->locations_count++;
+	v->locations[i].key = key;
+	v->locations[i].written = false;
+	v->locations[i].value = (struct vvalue) { .kind = VALUE_AFFINE, .affine = { .count = 1, .terms = { { key, 1 } } } };
+	return i;
+}
+
+bool read_location(struct vectorizer *v, int64_t key, struct vvalue *value)
+{
+	size_t i = find_location(v, key);
+	if (i == (size_t)-1) return false;
+	*value = v->locations[i].value;
+	return true;
+}
+
+bool write_location(struct vectorizer *v, int64_t key, struct vvalue value)
+{
+	size_t i = find_location(v, key);
+	if (i == (size_t)-1) return false;
+	v->locations[i].value = value;
+	v->locations[i].written = true;
+	return true;
+}
+
+bool is_invariant(struct vectorizer *v, struct affine const* a)
+{
+	for (size_t i = 0; i < a->count; ++i) {
+		for (size_t j = 0; j < v->locations_count; ++j) {
+			if (v->locations[j].key == a->terms[i].key && v->locations[j].written) return false;
+		}
+	}
+	return true;
+}
+
+bool address_value(struct vectorizer *v, struct operand op, struct affine *address)
+{
+	if (op.kind != OPERAND_MEM || op.ref != REF_NONE) return false;
+	*address = (struct affine) { .constant = op.disp };
+
+	struct vvalue part;
+	if (op.reg) {
+		if (!read_location(v, op.reg, &part) || part.kind != VALUE_AFFINE) return false;
+		if (!affine_add(address, &part.affine, 1)) return false;
+	}
+	if (op.index) {
+		if (!read_location(v, op.index, &part) || part.kind != VALUE_AFFINE) return false;
+		affine_scale(&part.affine, op.scale);
+		if (!affine_add(address, &part.affine, 1)) return false;
+	}
+	return true;
+}
+
+size_t vector_node(struct vectorizer *v, struct vnode node)
+{
+	if (v->nodes_count == VECTOR_MAX_NODES) return -1;
+	v->nodes[v->nodes_count] = node;
+	return v->nodes_count++;
+}
+
+bool operand_value(struct vectorizer *v, struct operand op, struct vvalue *value)
+{
+	int64_t key;
+	if (op.kind == OPERAND_IMM) {
+		*value = affine_value(op.disp);
+		return true;
+	}
+	if (location_key(v, op, &key)) {
+		return read_location(v, key, value);
+	}
+
+	// Load from memory, has to happen before the store
+	struct affine address;
+	if (v->stored || !address_value(v, op, &address)) return false;
+	size_t node = vector_node(v, (struct vnode) { .op = OP_MOVDQU, .affine = address });
+	if (node == (size_t)-1) return false;
+	*value = (struct vvalue) { .kind = VALUE_VECTOR, .node = node };
+	return true;
+}
+
+size_t value_node(struct vectorizer *v, struct vvalue value)
+{
+	if (value.kind == VALUE_VECTOR) return value.node;
+	return vector_node(v, (struct vnode) { .op = OP_MOVQ, .affine = value.affine });
+}
+
+// Symbolically executes one instruction of the loop body
+bool vectorizer_step(struct vectorizer *v, struct instruction const* in)
+{
+	static enum opcode const PACKED[] = {
+		[OP_ADD] = OP_PADDQ,
+		[OP_AND] = OP_PAND,
+		[OP_OR]  = OP_POR,
+		[OP_SHL] = OP_PSLLQ,
+		[OP_SHR] = OP_PSRLQ,
+		[OP_SUB] = OP_PSUBQ,
+		[OP_XOR] = OP_PXOR,
+	};
+
+	int64_t key;
+	struct vvalue lhs, rhs;
+
+	switch (in->op) {
+	case OP_NOP:
+	case OP_LABEL:
+	case OP_COMMENT:
+		return true;
+
+	case OP_MOV:
+		if (in->dst.kind == OPERAND_REG && in->dst.size != 8) return false;
+		if (!operand_value(v, in->src, &rhs)) return false;
+		if (location_key(v, in->dst, &key)) {
+			return write_location(v, key, rhs);
+		}
+		if (v->stored || rhs.kind == VALUE_UNKNOWN || !address_value(v, in->dst, &v->store_address)) return false;
+		v->stored = true;
+		v->store_value = rhs;
+		return true;
+
+	case OP_LEA:
+		{
+			struct affine address;
+			if (!location_key(v, in->dst, &key) || !address_value(v, in->src, &address)) return false;
+			return write_location(v, key, (struct vvalue) { .kind = VALUE_AFFINE, .affine = address });
+		}
+
+	case OP_MOVZX:
+		{
+			struct affine address;
+			if (in->src.size != 1 || v->stored || !location_key(v, in->dst, &key) || !address_value(v, in->src, &address)) return false;
+			size_t node = vector_node(v, (struct vnode) { .op = OP_MOVZX, .affine = address });
+			if (node == (size_t)-1) return false;
+			return write_location(v, key, (struct vvalue) { .kind = VALUE_VECTOR, .node = node });
+		}
+
+	case OP_CMP:
+		if (!operand_value(v, in->dst, &v->cmp_lhs) || !operand_value(v, in->src, &v->cmp_rhs)) return false;
+		v->compared = true;
+		return true;
+
+	case OP_INC:
+	case OP_DEC:
+	case OP_NEG:
+	case OP_NOT:
+		if (!location_key(v, in->dst, &key) || !read_location(v, key, &lhs)) return false;
+		v->compared = false;
+		if (lhs.kind == VALUE_AFFINE) {
+			switch (in->op) {
+			case OP_INC: lhs.affine.constant += 1; break;
+			case OP_DEC: lhs.affine.constant -= 1; break;
+			case OP_NEG: affine_scale(&lhs.affine, -1); break;
+			case OP_NOT: affine_scale(&lhs.affine, -1); lhs.affine.constant -= 1; break;
+			default: assert(0 && "unreachable");
+			}
+		} else {
+			lhs.kind = VALUE_UNKNOWN;
+		}
+		return write_location(v, key, lhs);
+
+	case OP_ADD:
+	case OP_AND:
+	case OP_IMUL:
+	case OP_OR:
+	case OP_SHL:
+	case OP_SHR:
+	case OP_SUB:
+	case OP_XOR:
+		v->compared = false;
+		if (!location_key(v, in->dst, &key)) return false;
+		if ((in->op == OP_XOR || in->op == OP_SUB) && in->src.kind == OPERAND_REG && in->src.reg == in->dst.reg) {
+			return write_location(v, key, affine_value(0));
+		}
+		if (!read_location(v, key, &lhs) || !operand_value(v, in->src, &rhs)) return false;
+
+		if (lhs.kind == VALUE_AFFINE && rhs.kind == VALUE_AFFINE) {
+			bool lconst = lhs.affine.count == 0, rconst = rhs.affine.count == 0;
+			int64_t l = lhs.affine.constant, r = rhs.affine.constant;
+			switch (in->op) {
+			case OP_ADD: if (!affine_add(&lhs.affine, &rhs.affine, 1)) return false; break;
+			case OP_SUB: if (!affine_add(&lhs.affine, &rhs.affine, -1)) return false; break;
+			case OP_IMUL:
+				if (rconst) affine_scale(&lhs.affine, r);
+				else if (lconst) { affine_scale(&rhs.affine, l); lhs = rhs; }
+				else lhs.kind = VALUE_UNKNOWN;
+				break;
+			case OP_SHL:
+				if (rconst && r >= 0 && r < 63) affine_scale(&lhs.affine, (int64_t)1 << r);
+				else lhs.kind = VALUE_UNKNOWN;
+				break;
+			default:
+				if (!lconst || !rconst) {
+					lhs.kind = VALUE_UNKNOWN;
+					break;
+				}
+				switch (in->op) {
+				case OP_AND: lhs = affine_value(l & r); break;
+				case OP_OR:  lhs = affine_value(l | r); break;
+				case OP_XOR: lhs = affine_value(l ^ r); break;
+				case OP_SHR: lhs = affine_value((uint64_t)l >> (r & 63)); break;
+				default: assert(0 && "unreachable");
+				}
+			}
+			return write_location(v, key, lhs);
+		}
+
+		if (lhs.kind == VALUE_UNKNOWN || rhs.kind == VALUE_UNKNOWN || in->op == OP_IMUL) {
+			return write_location(v, key, (struct vvalue) { .kind = VALUE_UNKNOWN });
+		}
+		// Packed shifts don't mask the count like scalar ones, so only constant counts are allowed
+		if ((in->op == OP_SHL || in->op == OP_SHR) && (rhs.kind != VALUE_AFFINE || rhs.affine.count != 0)) return false;
+
+		size_t a = value_node(v, lhs), b = value_node(v, rhs);
+		if (a == (size_t)-1 || b == (size_t)-1) return false;
+		size_t node = vector_node(v, (struct vnode) { .op = PACKED[in->op], .lhs = a, .rhs = b });
+		if (node == (size_t)-1) return false;
+		return write_location(v, key, (struct vvalue) { .kind = VALUE_VECTOR, .node = node });
+
+	default:
+		return false;
+	}
+}
+
+size_t vector_depth(struct vectorizer *v, size_t node)
+{
+	struct vnode const* n = &v->nodes[node];
+	switch (n->op) {
+	case OP_MOVDQU:
+	case OP_MOVQ:
+		return 1;
+	default:
+		{
+			size_t l = vector_depth(v, n->lhs), r = vector_depth(v, n->rhs) + 1;
+			return l > r ? l : r;
+		}
+	}
+}
+
+void vemit(struct vectorizer *v, enum opcode op, struct operand dst, struct operand src)
+{
+	da_append(&v->code, ((struct instruction) { .op = op, .dst = dst, .src = src }));
+}
+
+void vemit_jcc(struct vectorizer *v, enum condition cc, size_t label)
+{
+	da_append(&v->code, ((struct instruction) { .op = OP_JCC, .cc = cc, .dst = local_label(label) }));
+}
+
+void vemit_label(struct vectorizer *v, size_t label)
+{
+	da_append(&v->code, ((struct instruction) { .op = OP_LABEL, .dst = local_label(label) }));
+}
+
+struct operand vreg(unsigned n, unsigned size)
+{
+	return (struct operand) { .kind = OPERAND_VREG, .reg = n, .size = size };
+}
+
+struct operand key_operand(int64_t key)
+{
+	return key > 0 ? reg(key) : stack(-key);
+}
+
+// Computes terms of affine value (without constant) into register r
+bool vemit_terms(struct vectorizer *v, enum reg r, struct affine const* a)
+{
+	bool first = true;
+	for (size_t i = 0; i < a->count; ++i) {
+		if (a->terms[i].coeff != 1 && a->terms[i].coeff != -1) return false;
+		if (first && a->terms[i].coeff == 1) {
+			vemit(v, OP_MOV, reg(r), key_operand(a->terms[i].key));
+			first = false;
+		}
+	}
+	if (first) {
+		vemit(v, OP_XOR, reg(r), reg(r));
+	}
+	bool skipped = false;
+	for (size_t i = 0; i < a->count; ++i) {
+		if (a->terms[i].coeff == 1 && !skipped) {
+			skipped = true;
+			continue;
+		}
+		vemit(v, a->terms[i].coeff == 1 ? OP_ADD : OP_SUB, reg(r), key_operand(a->terms[i].key));
+	}
+	return true;
+}
+
+struct vector_plan
+{
+	enum reg index, bound, tmp;
+	bool index_in_slot;
+	int64_t index_key;
+
+	// Distinct address bases (terms without constant and index)
+	struct affine bases[8];
+	enum reg base_regs[8];
+	size_t bases_count;
+};
+
+size_t plan_base(struct vector_plan *plan, struct affine const* address)
+{
+	for (size_t i = 0; i < plan->bases_count; ++i) {
+		if (affine_same_terms(&plan->bases[i], address)) return i;
+	}
+	if (plan->bases_count == ARRAY_LEN(plan->bases)) return -1;
+	plan->bases[plan->bases_count] = *address;
+	plan->bases[plan->bases_count].constant = 0;
+	return plan->bases_count++;
+}
+
+struct operand vector_address(struct vector_plan const* plan, struct affine const* address)
+{
+	for (size_t i = 0; i < plan->bases_count; ++i) {
+		if (affine_same_terms(&plan->bases[i], address)) {
+			struct operand op = indexed(plan->base_regs[i], plan->index, 8);
+			op.disp = address->constant;
+			return op;
+		}
+	}
+	assert(0 && "unreachable");
+}
+
+void vemit_expression(struct vectorizer *v, struct vector_plan const* plan, size_t node, unsigned k, unsigned size)
+{
+	struct vnode const* n = &v->nodes[node];
+	switch (n->op) {
+	case OP_MOVDQU:
+		vemit(v, OP_MOVDQU, vreg(k, size), vector_address(plan, &n->affine));
+		return;
+
+	case OP_MOVQ:
+		vemit(v, OP_MOVDQU, vreg(k, size), vreg(n->vreg, size));
+		return;
+
+	default:
+		vemit_expression(v, plan, n->lhs, k, size);
+		struct vnode const* rhs = &v->nodes[n->rhs];
+		if (n->op == OP_PSLLQ || n->op == OP_PSRLQ) {
+			vemit(v, n->op, vreg(k, size), imm(rhs->affine.constant & 63));
+		} else if (rhs->op == OP_MOVQ) {
+			vemit(v, n->op, vreg(k, size), vreg(rhs->vreg, size));
+		} else {
+			vemit_expression(v, plan, n->rhs, k + 1, size);
+			vemit(v, n->op, vreg(k, size), vreg(k + 1, size));
+		}
+		return;
+	}
+}
+
+// while (index + lanes <= bound) { ...; index += lanes; }
+// Jumps to label when there are less than lanes iterations left
+void vemit_lanes_check(struct vectorizer *v, struct vector_plan const* plan, unsigned lanes, size_t label)
+{
+	struct operand next = deref(plan->index);
+	next.disp = lanes;
+	vemit(v, OP_LEA, reg(plan->tmp), next);
+	vemit(v, OP_CMP, reg(plan->tmp), reg(plan->bound));
+	vemit_jcc(v, CC_G, label);
+}
+
+void vemit_vector_loop(struct compiler *compiler, struct vectorizer *v, struct vector_plan const* plan, size_t store, unsigned lanes)
+{
+	unsigned size = lanes * 8;
+	size_t loop = compiler->last_local_id++;
+
+	struct operand next = deref(plan->index);
+	next.disp = lanes;
+
+	vemit_label(v, loop);
+	vemit_expression(v, plan, store, 0, size);
+	vemit(v, OP_MOVDQU, vector_address(plan, &v->store_address), vreg(0, size));
+	vemit(v, OP_ADD, reg(plan->index), imm(lanes));
+	vemit(v, OP_LEA, reg(plan->tmp), next);
+	vemit(v, OP_CMP, reg(plan->tmp), reg(plan->bound));
+	vemit_jcc(v, CC_LE, loop);
+}
+
+// Registers that can be freely used in front of the loop
+bool vectorize_loop(struct compiler *compiler, struct optimizer *opt, size_t head, size_t tail)
+{
+	static struct vectorizer v;
+	struct instruction const* code = opt->code;
+
+	if (code[tail].op != OP_JCC) return false;
+	for (size_t i = head + 1; i < tail; ++i) {
+		if (code[i].op == OP_LABEL && code[i].dst.ref == REF_LABEL) return false;
+	}
+	size_t exit;
+	if (!is_simple_loop(opt, head, tail, &exit)) return false;
+
+	v.opt = opt;
+	v.locations_count = 0;
+	v.nodes_count = 0;
+	v.stored = false;
+	v.compared = false;
+	v.code.count = 0;
+
+	for (size_t i = head + 1; i < tail; ++i) {
+		if (is_jump(&code[i]) || !vectorizer_step(&v, &code[i])) return false;
+	}
+	if (!v.compared || !v.stored) return false;
+
+	// Loop continues while index + 1 < bound
+	struct vvalue index, bound;
+	switch (code[tail].cc) {
+	case CC_L:  index = v.cmp_lhs; bound = v.cmp_rhs; break;
+	case CC_LE: index = v.cmp_lhs; bound = v.cmp_rhs; bound.affine.constant += 1; break;
+	case CC_G:  index = v.cmp_rhs; bound = v.cmp_lhs; break;
+	case CC_GE: index = v.cmp_rhs; bound = v.cmp_lhs; bound.affine.constant += 1; break;
+	default: return false;
+	}
+	if (index.kind != VALUE_AFFINE || bound.kind != VALUE_AFFINE) return false;
+	if (index.affine.count != 1 || index.affine.terms[0].coeff != 1 || index.affine.constant != 1) return false;
+	int64_t index_key = index.affine.terms[0].key;
+
+	struct vvalue final;
+	if (!read_location(&v, index_key, &final) || final.kind != VALUE_AFFINE) return false;
+	if (!affine_same_terms(&final.affine, &index.affine) || final.affine.constant != 1) return false;
+	if (!is_invariant(&v, &bound.affine) || !fits_imm32(bound.affine.constant)) return false;
+
+	// Values computed by the loop other than index are not needed after it
+	for (size_t i = 0; i < v.locations_count; ++i) {
+		int64_t key = v.locations[i].key;
+		if (!v.locations[i].written || key == index_key) continue;
+		bool dead = key > 0
+			? dead_after(opt, tail, reg(key), key == REG_RAX ? reg_access_until_ret : reg_access)
+			: dead_after(opt, tail, stack(-key), slot_access);
+		if (!dead) return false;
+	}
+
+	size_t store = value_node(&v, v.store_value);
+	if (store == (size_t)-1 || vector_depth(&v, store) > VECTOR_MAX_DEPTH) return false;
+
+	// Every access is base[index] with loop invariant base
+	struct affine *addresses[VECTOR_MAX_NODES + 1];
+	size_t addresses_count = 0;
+	addresses[addresses_count++] = &v.store_address;
+	for (size_t i = 0; i < v.nodes_count; ++i) {
+		struct vnode *n = &v.nodes[i];
+		if (n->op == OP_MOVDQU) {
+			addresses[addresses_count++] = &n->affine;
+		} else if (n->op == OP_MOVZX) {
+			return false;
+		} else if (n->op == OP_MOVQ) {
+			if (affine_coeff(&n->affine, index_key) != 0 || !is_invariant(&v, &n->affine)) return false;
+		}
+	}
+	for (size_t i = 0; i < addresses_count; ++i) {
+		if (affine_coeff(addresses[i], index_key) != 8) return false;
+		struct affine increment = { .count = 1, .terms = { { index_key, 8 } } };
+		affine_add(addresses[i], &increment, -1);
+		if (!is_invariant(&v, addresses[i]) || !fits_imm32(addresses[i]->constant)) return false;
+	}
+
+	// Registers
+	struct vector_plan plan = { .index_key = index_key };
+	unsigned free = scratch_registers(opt, head, tail);
+	plan.tmp = take_register(&free);
+	plan.bound = take_register(&free);
+	plan.index_in_slot = index_key < 0;
+	plan.index = plan.index_in_slot ? take_register(&free) : (enum reg)index_key;
+	for (size_t i = 0; i < addresses_count; ++i) {
+		size_t base = plan_base(&plan, addresses[i]);
+		if (base == (size_t)-1) return false;
+		if (base + 1 == plan.bases_count) {
+			plan.base_regs[base] = take_register(&free);
+			if (!plan.base_regs[base]) return false;
+		}
+	}
+	if (!plan.tmp || !plan.bound || !plan.index) return false;
+
+	size_t skip = compiler->last_local_id++;
+	size_t vexit = compiler->last_local_id++;
+	size_t remainder = compiler->last_local_id++;
+	size_t avx = compiler->last_local_id++;
+	size_t detected = compiler->last_local_id++;
+
+	if (plan.index_in_slot) {
+		vemit(&v, OP_MOV, reg(plan.index), stack(-index_key));
+	}
+	if (!vemit_terms(&v, plan.bound, &bound.affine)) return false;
+	if (bound.affine.constant) {
+		vemit(&v, OP_ADD, reg(plan.bound), imm(bound.affine.constant));
+	}
+	for (size_t i = 0; i < plan.bases_count; ++i) {
+		if (!vemit_terms(&v, plan.base_regs[i], &plan.bases[i])) return false;
+	}
+
+	// Stored words can't be loaded by the following iterations of the same vector
+	for (size_t i = 1; i < addresses_count; ++i) {
+		int64_t distance = v.store_address.constant - addresses[i]->constant;
+		if (affine_same_terms(&v.store_address, addresses[i])) {
+			if (distance > 0 && distance < 32) return false;
+			continue;
+		}
+		struct operand a = vector_address(&plan, &v.store_address), b = vector_address(&plan, addresses[i]);
+		vemit(&v, OP_MOV, reg(plan.tmp), reg(a.reg));
+		vemit(&v, OP_SUB, reg(plan.tmp), reg(b.reg));
+		if (!fits_imm32(distance - 1)) return false;
+		if (distance - 1 != 0) {
+			vemit(&v, OP_ADD, reg(plan.tmp), imm(distance - 1));
+		}
+		vemit(&v, OP_CMP, reg(plan.tmp), imm(31));
+		vemit_jcc(&v, CC_B, skip);
+	}
+
+	// Broadcast invariants into xmm8 and above
+	unsigned invariants = 0;
+	for (size_t i = 0; i < v.nodes_count; ++i) {
+		struct vnode *n = &v.nodes[i];
+		if (n->op != OP_MOVQ) continue;
+		if (invariants == VECTOR_MAX_INVARIANTS) return false;
+		n->vreg = 8 + invariants++;
+		if (!vemit_terms(&v, plan.tmp, &n->affine)) return false;
+		if (n->affine.constant) {
+			vemit(&v, OP_ADD, reg(plan.tmp), imm(n->affine.constant));
+		}
+		vemit(&v, OP_MOVQ, vreg(n->vreg, 16), reg(plan.tmp));
+		vemit(&v, OP_PUNPCKLQDQ, vreg(n->vreg, 16), vreg(n->vreg, 16));
+	}
+
+	// Loop ending with conditional jump may be entered without checking the condition,
+	// so the scalar loop has to run when there is not enough iterations for any vector loop.
+	vemit_lanes_check(&v, &plan, 2, skip);
+
+	// Runtime dispatch, SIMD_LEVEL is detected on the first use
+	vemit(&v, OP_MOV, reg(plan.tmp), extern_address(SIMD_LEVEL));
+	vemit(&v, OP_TEST, reg(plan.tmp), reg(plan.tmp));
+	vemit_jcc(&v, CC_NS, detected);
+	vemit(&v, OP_CALL, (struct operand) { .kind = OPERAND_LABEL, .ref = REF_EXTERN, .name = SIMD_DETECT }, (struct operand) {});
+	vemit(&v, OP_MOV, reg(plan.tmp), extern_address(SIMD_LEVEL));
+	vemit_label(&v, detected);
+	vemit(&v, OP_CMP, reg(plan.tmp), imm(SIMD_AVX2));
+	vemit_jcc(&v, CC_GE, avx);
+
+	vemit_vector_loop(compiler, &v, &plan, store, 2);
+	vemit(&v, OP_JMP, local_label(remainder), (struct operand) {});
+
+	vemit_label(&v, avx);
+	vemit_lanes_check(&v, &plan, 4, remainder);
+	for (size_t i = 0; i < v.nodes_count; ++i) {
+		if (v.nodes[i].op == OP_MOVQ) {
+			vemit(&v, OP_VPBROADCASTQ, vreg(v.nodes[i].vreg, 32), vreg(v.nodes[i].vreg, 16));
+		}
+	}
+	vemit_vector_loop(compiler, &v, &plan, store, 4);
+	vemit(&v, OP_VZEROUPPER, (struct operand) {}, (struct operand) {});
+
+	vemit_label(&v, remainder);
+	if (plan.index_in_slot) {
+		vemit(&v, OP_MOV, stack(-index_key), reg(plan.index));
+	}
+	vemit(&v, OP_CMP, reg(plan.index), reg(plan.bound));
+	vemit_jcc(&v, CC_GE, vexit);
+	vemit_label(&v, skip);
+
+	insert_instruction(compiler, tail + 1, (struct instruction) { .op = OP_LABEL, .dst = local_label(vexit) });
+	for (size_t i = 0; i < v.code.count; ++i) {
+		insert_instruction(compiler, head + i, v.code.items[i]);
+	}
+
+	compiler->simd_dispatch = true;
+	++loop_stats.vectorized;
+	return true;
+}
+
+// Search loops
+//   while (i < n && a[i] != x) ++i;        i += wfind(&a[i], n - i, x)
+//   while (i < n && a[i] == b[i]) ++i;     i += wcompare(&a[i], &b[i], n - i)
+//   while (i < n && char(s, i) != c) ++i;  i += bfind(s + i, n - i, c)
+// are left by the loop optimizer with the bound check jumping out of the loop and the
+// element check closing it. Early exit keeps them from being vectorized in place,
+// so they are replaced by calls to SIMD routines of libb.
+bool replace_search_loop(struct compiler *compiler, struct optimizer *opt, size_t head, size_t tail)
+{
+	static struct vectorizer v;
+	struct instruction const* code = opt->code;
+
+	if (code[tail].op != OP_JCC) return false;
+	size_t exit;
+	if (!is_simple_loop(opt, head, tail, &exit)) return false;
+
+	v.opt = opt;
+	v.locations_count = 0;
+	v.nodes_count = 0;
+	v.stored = false;
+	v.compared = false;
+	v.code.count = 0;
+
+	bool checked = false;
+	struct vvalue bound_lhs = {}, bound_rhs = {};
+	enum condition bound_cc = CC_E;
+	for (size_t i = head + 1; i < tail; ++i) {
+		if (code[i].op == OP_LABEL && code[i].dst.ref == REF_LABEL) return false;
+		if (is_jump(&code[i])) {
+			if (checked || code[i].op != OP_JCC || !v.compared) return false;
+			checked = true;
+			bound_lhs = v.cmp_lhs;
+			bound_rhs = v.cmp_rhs;
+			bound_cc = code[i].cc;
+			v.compared = false;
+			continue;
+		}
+		if (!vectorizer_step(&v, &code[i])) return false;
+	}
+	if (!checked || !v.compared || v.stored) return false;
+
+	// Loop is left when index >= bound
+	struct vvalue index, bound;
+	switch (bound_cc) {
+	case CC_GE: index = bound_lhs; bound = bound_rhs; break;
+	case CC_G:  index = bound_lhs; bound = bound_rhs; bound.affine.constant += 1; break;
+	case CC_LE: index = bound_rhs; bound = bound_lhs; break;
+	case CC_L:  index = bound_rhs; bound = bound_lhs; bound.affine.constant += 1; break;
+	default: return false;
+	}
+	if (index.kind != VALUE_AFFINE || bound.kind != VALUE_AFFINE) return false;
+	if (index.affine.count != 1 || index.affine.terms[0].coeff != 1 || index.affine.constant != 1) return false;
+	int64_t index_key = index.affine.terms[0].key;
+
+	struct vvalue final;
+	if (!read_location(&v, index_key, &final) || final.kind != VALUE_AFFINE) return false;
+	if (!affine_same_terms(&final.affine, &index.affine) || final.affine.constant != 1) return false;
+	if (!is_invariant(&v, &bound.affine) || !fits_imm32(bound.affine.constant)) return false;
+
+	// Index has to survive the call
+	if (index_key > 0 && (REG_BIT(index_key) & CALLER_SAVED_REGS)) return false;
+
+	struct vvalue lhs = v.cmp_lhs, rhs = v.cmp_rhs;
+	if (lhs.kind != VALUE_VECTOR) {
+		lhs = v.cmp_rhs;
+		rhs = v.cmp_lhs;
+	}
+	if (lhs.kind != VALUE_VECTOR) return false;
+
+	struct vnode const* load = &v.nodes[lhs.node];
+	if (load->op != OP_MOVDQU && load->op != OP_MOVZX) return false;
+	int64_t size = load->op == OP_MOVZX ? 1 : 8;
+
+	enum idiom idiom;
+	struct affine addresses[2] = { load->affine };
+	size_t addresses_count = 1;
+	struct affine needle = {};
+	switch (code[tail].cc) {
+	case CC_NE:
+		if (rhs.kind != VALUE_AFFINE) return false;
+		idiom = size == 1 ? IDIOM_BFIND : IDIOM_WFIND;
+		needle = rhs.affine;
+		if (affine_coeff(&needle, index_key) != 0 || !is_invariant(&v, &needle) || !fits_imm32(needle.constant)) return false;
+		break;
+	case CC_E:
+		if (size != 8 || rhs.kind != VALUE_VECTOR || v.nodes[rhs.node].op != OP_MOVDQU) return false;
+		idiom = IDIOM_WCOMPARE;
+		addresses[addresses_count++] = v.nodes[rhs.node].affine;
+		break;
+	default:
+		return false;
+	}
+
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		if (strcmp(compiler->functions.items[i].name, IDIOM_NAMES[idiom]) == 0) return false;
+	}
+
+	for (size_t i = 0; i < addresses_count; ++i) {
+		if (affine_coeff(&addresses[i], index_key) != size) return false;
+		struct affine increment = { .count = 1, .terms = { { index_key, size } } };
+		affine_add(&addresses[i], &increment, -1);
+		if (!is_invariant(&v, &addresses[i]) || !fits_imm32(addresses[i].constant - size)) return false;
+	}
+
+	// Values computed by the loop other than index are not needed after it
+	for (size_t i = 0; i < v.locations_count; ++i) {
+		int64_t key = v.locations[i].key;
+		if (!v.locations[i].written || key == index_key) continue;
+		bool dead = key > 0
+			? dead_after(opt, tail, reg(key), key == REG_RAX ? reg_access_until_ret : reg_access)
+			: dead_after(opt, tail, stack(-key), slot_access);
+		if (!dead) return false;
+	}
+	if (scratch_registers(opt, head, tail) != CALLER_SAVED_REGS) return false;
+
+	// Index is advanced to the first checked element before the call and by the result after it
+	struct operand index_location = key_operand(index_key);
+	vemit(&v, OP_MOV, reg(REG_RAX), index_location);
+	vemit(&v, OP_INC, reg(REG_RAX), (struct operand) {});
+	vemit(&v, OP_MOV, index_location, reg(REG_RAX));
+
+	enum reg count = idiom == IDIOM_WCOMPARE ? REG_RDX : REG_RSI;
+	if (!vemit_terms(&v, count, &bound.affine)) return false;
+	if (bound.affine.constant) {
+		vemit(&v, OP_ADD, reg(count), imm(bound.affine.constant));
+	}
+	vemit(&v, OP_SUB, reg(count), reg(REG_RAX));
+
+	for (size_t i = 0; i < addresses_count; ++i) {
+		enum reg pointer = i == 0 ? REG_RDI : REG_RSI;
+		if (!vemit_terms(&v, pointer, &addresses[i])) return false;
+		struct operand element = indexed(pointer, REG_RAX, size);
+		element.disp = addresses[i].constant - size;
+		vemit(&v, OP_LEA, reg(pointer), element);
+	}
+	if (idiom != IDIOM_WCOMPARE) {
+		if (!vemit_terms(&v, REG_RDX, &needle)) return false;
+		if (needle.constant) {
+			vemit(&v, OP_ADD, reg(REG_RDX), imm(needle.constant));
+		}
+	}
+	vemit(&v, OP_CALL, plt_target(IDIOM_NAMES[idiom]), (struct operand) {});
+	vemit(&v, OP_ADD, index_location, reg(REG_RAX));
+
+	for (size_t i = head + 1; i <= tail; ++i) {
+		compiler->code.items[i].op = OP_NOP;
+	}
+	for (size_t i = 0; i < v.code.count; ++i) {
+		insert_instruction(compiler, head + 1 + i, v.code.items[i]);
+	}
+
+	compiler->libb_calls |= 1u << idiom;
+	++loop_stats.idioms;
+	return true;
+}
+
+// Loops are visited from the end, so that code inserted in front of the loop
+// doesn't move loops that are yet to be visited
+void vectorize_loops(struct compiler *compiler, struct optimizer *opt)
+{
+	analyze_function(compiler, opt);
+	for (size_t tail = opt->count; tail-- > 0;) {
+		if (!is_jump(&opt->code[tail])) continue;
+		size_t head = label_position(opt, opt->code[tail].dst);
+		if (head < tail && (vectorize_loop(compiler, opt, head, tail) || replace_search_loop(compiler, opt, head, tail))) {
+			analyze_function(compiler, opt);
+			tail = head;
+		}
+	}
+}
+
+bool is_induction_address(struct operand op, enum reg base, enum reg index, unsigned scale)
+{
+	return op.kind == OPERAND_MEM && op.ref == REF_NONE && op.reg == base && op.index == index && op.scale == scale;
+}
+
+// Memory operands [base+i*s+d] of a loop, where base doesn't change inside the loop and
+// i changes only by a constant step, get a pointer that is advanced together with i:
+//       lea rP, [base+i*s]
+//   .head:
+//       ...  [rP+d] ...
+//       inc i
+//       add rP, s
+// Runs after the vectorizer, which recognizes the loops by their indexed operands.
+bool reduce_loop(struct compiler *compiler, struct optimizer *opt, size_t head, size_t tail)
+{
+	size_t exit;
+	if (!is_simple_loop(opt, head, tail, &exit)) return false;
+	struct instruction *code = opt->code;
+
+	unsigned used = 0;
+	bool calls = false;
+	for (size_t i = head; i <= tail; ++i) {
+		unsigned read, written;
+		instruction_regs(&code[i], &read, &written);
+		used |= read | written;
+		calls |= code[i].op == OP_CALL;
+	}
+
+	for (size_t i = head; i <= tail; ++i) {
+		struct operand ops[] = { code[i].dst, code[i].src };
+		for (size_t j = 0; j < ARRAY_LEN(ops); ++j) {
+			struct operand m = ops[j];
+			if (m.kind != OPERAND_MEM || m.ref != REF_NONE || m.reg == REG_NONE || m.index == REG_NONE || m.reg == m.index) continue;
+
+			// Base is invariant and the index is changed by exactly one constant step
+			size_t update = (size_t)-1;
+			int64_t step = 0;
+			bool affine = true;
+			for (size_t k = head; k <= tail && affine; ++k) {
+				unsigned read, written;
+				instruction_regs(&code[k], &read, &written);
+				if (written & REG_BIT(m.reg)) affine = false;
+				if (written & REG_BIT(m.index)) {
+					affine = update == (size_t)-1 && constant_step(&code[k], m.index, &step);
+					update = k;
+				}
+			}
+			if (!affine || update == (size_t)-1 || !fits_imm32(step * (int64_t)m.scale)) continue;
+
+			enum reg pointer = REG_NONE;
+			unsigned free = calls ? 0 : scratch_registers(opt, head, tail) & ~used;
+			for (size_t k = 0; k < ARRAY_LEN(CALLEE_SAVED_REGISTERS) && pointer == REG_NONE; ++k) {
+				enum reg r = CALLEE_SAVED_REGISTERS[k];
+				if (!(used & REG_BIT(r)) && reg_dead_after(opt, head, r)) pointer = r;
+			}
+			if (pointer == REG_NONE) pointer = take_register(&free);
+			if (pointer == REG_NONE) return false;
+
+			for (size_t k = head; k <= tail; ++k) {
+				struct operand *kops[] = { &code[k].dst, &code[k].src };
+				for (size_t l = 0; l < ARRAY_LEN(kops); ++l) {
+					if (!is_induction_address(*kops[l], m.reg, m.index, m.scale)) continue;
+					kops[l]->reg = pointer;
+					kops[l]->index = REG_NONE;
+					kops[l]->scale = 0;
+				}
+			}
+
+			// add changes flags, which may still be read after the step of the index
+			int64_t bump = step * (int64_t)m.scale;
+			struct instruction advance = flags_dead_after(opt, update)
+				? (struct instruction) { .op = OP_ADD, .dst = reg(pointer), .src = imm(bump) }
+				: (struct instruction) { .op = OP_LEA, .dst = reg(pointer), .src = { .kind = OPERAND_MEM, .reg = pointer, .disp = bump } };
+			insert_instruction(compiler, update + 1, advance);
+			struct operand start = { .kind = OPERAND_MEM, .reg = m.reg, .index = m.index, .scale = m.scale };
+			insert_instruction(compiler, head, (struct instruction) { .op = OP_LEA, .dst = reg(pointer), .src = start });
+			++loop_stats.reduced;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Visited from the end like in vectorize_loops
+void reduce_loops(struct compiler *compiler, struct optimizer *opt)
+{
+	analyze_function(compiler, opt);
+	for (size_t tail = opt->count; tail-- > 0;) {
+		if (!is_jump(&opt->code[tail])) continue;
+		size_t head = label_position(opt, opt->code[tail].dst);
+		if (head < tail && reduce_loop(compiler, opt, head, tail)) {
+			analyze_function(compiler, opt);
+			tail += 3; // the loop moved by the lea and grew by the advance
+		}
+	}
+}
+
+void run_peepholes(struct compiler *compiler, struct optimizer *opt)
+{
+	for (bool changed = true; changed;) {
+		changed = false;
+		analyze_function(compiler, opt);
+
+		for (size_t i = 0; i < opt->count; ++i) {
+			for (size_t j = 0; j < ARRAY_LEN(PEEPHOLES) && opt->code[i].op != OP_NOP; ++j) {
+				if (PEEPHOLES[j].apply(opt, i)) {
+					++PEEPHOLES[j].hits;
+					changed = true;
+				}
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < opt->count; ++i) {
+			if (opt->code[i].op != OP_NOP) {
+				opt->code[kept++] = opt->code[i];
+			}
+		}
+		compiler->code.count = kept;
+	}
+}
+
+void optimize_function(struct compiler *compiler)
+{
+	static struct optimizer opt = {};
+
+	do {
+		run_peepholes(compiler, &opt);
+	} while (optimize_loops(compiler, &opt));
+	vectorize_loops(compiler, &opt);
+	reduce_loops(compiler, &opt);
+}
+
+int profile_count_compare(void const* a, void const* b)
+{
+	struct profile_count const* x = a, *y = b;
+	int order = strcmp(x->function, y->function);
+	if (order) return order;
+	return x->label < y->label ? -1 : x->label > y->label;
+}
+
+// Reads function and block lines of the profile, the other lines are ignored
+void load_profile(char const* path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "b: error: can't read profile %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	char line[4096], name[4096];
+	int64_t max_calls = 0;
+	while (fgets(line, sizeof(line), f)) {
+		struct profile_count c;
+		long long count;
+		size_t label;
+		if (sscanf(line, "function %4095s %lld", name, &count) == 2) {
+			c = (struct profile_count) { .label = PROFILE_CALLS, .count = count };
+			if (count > max_calls) max_calls = count;
+		} else if (sscanf(line, "block %4095s %zu %lld", name, &label, &count) == 3) {
+			c = (struct profile_count) { .label = label, .count = count };
+		} else {
+			continue;
+		}
+		c.function = strdup(name);
+		da_append(&profile_counts, c);
+	}
+	fclose(f);
+	profile_counts.path = path;
+
+	if (profile_counts.count) qsort(profile_counts.items, profile_counts.count, sizeof(*profile_counts.items), profile_count_compare);
+	profile_counts.hot_calls = max_calls / 16 > 1 ? max_calls / 16 : 2;
+}
+
+// Profile of another program, or of another version of this one, would lay out code
+// by counts of unrelated labels, so functions and labels it names have to exist
+void check_profile(struct compiler *compiler)
+{
+	for (size_t i = 0; i < profile_counts.count; ++i) {
+		struct profile_count const* c = &profile_counts.items[i];
+		bool first = i == 0 || strcmp(c->function, profile_counts.items[i - 1].function) != 0;
+		if (first && !find_definition(compiler, c->function)) {
+			fprintf(stderr, "b: error: profile %s does not match the program: there is no function %s\n", profile_counts.path, c->function);
+			exit(1);
+		}
+		if (c->label != PROFILE_CALLS && c->label >= compiler->last_local_id) {
+			fprintf(stderr, "b: error: profile %s does not match the program: %s has no label %zu\n", profile_counts.path, c->function, c->label);
+			exit(1);
+		}
+	}
+}
+
+// Count of the label (or calls) of the function, -1 when the profile doesn't have it
+int64_t profile_count(char const* function, size_t label)
+{
+	struct profile_count key = { .function = function, .label = label };
+	struct profile_count const* found = profile_counts.count ? bsearch(&key, profile_counts.items, profile_counts.count,
+		sizeof(*profile_counts.items), profile_count_compare) : NULL;
+	return found ? found->count : -1;
+}
+
+// Keeps body of the function until the whole program is known
+void flush_function(struct compiler *compiler, char const* name, size_t id, size_t line)
+{
+	struct function fun = {
+		.name = name,
+		.id = id,
+		.stack_capacity = compiler->stack_capacity,
+		.line = line,
+		.module = current_module,
+		.locals = { compiler->locals.items, compiler->locals.count, compiler->locals.capacity },
+		.profile_record = compiler->profile_record,
+		.blocks = { compiler->blocks.items, compiler->blocks.count, compiler->blocks.capacity },
+		.items = compiler->code.items,
+		.count = compiler->code.count,
+		.capacity = compiler->code.capacity,
+	};
+	da_append(&compiler->functions, fun);
+	compiler->code.items = NULL;
+	compiler->code.count = compiler->code.capacity = 0;
+	compiler->locals.items = NULL;
+	compiler->locals.count = compiler->locals.capacity = 0;
+	compiler->blocks.items = NULL;
+	compiler->blocks.count = compiler->blocks.capacity = 0;
+}
+
+// Optimizes the body and adds prologue and epilogue, which depend on the frame size
+void finish_function(struct compiler *compiler, struct function *body)
+{
+	compiler->code.items = body->items;
+	compiler->code.count = body->count;
+	compiler->code.capacity = body->capacity;
+	compiler->stack_capacity = body->stack_capacity;
+
+	if (optimizations_enabled) {
+		optimize_function(compiler);
+	}
+
+	struct function fun = *body;
+	fun.simd_dispatch = compiler->simd_dispatch;
+	fun.promoted.items = compiler->promoted.items;
+	fun.promoted.count = compiler->promoted.count;
+	fun.promoted.capacity = compiler->promoted.capacity;
+	fun.items = NULL;
+	fun.count = fun.capacity = 0;
+	compiler->simd_dispatch = false;
+	compiler->promoted.items = NULL;
+	compiler->promoted.count = compiler->promoted.capacity = 0;
+
+	da_append(&fun, ((struct instruction) { .op = OP_PUSH, .dst = reg(REG_RBP) }));
+	da_append(&fun, ((struct instruction) { .op = OP_MOV, .dst = reg(REG_RBP), .src = reg(REG_RSP) }));
+
+	// Callee saved registers used by the loop optimizer are preserved in slots below locals
+	size_t frame = compiler->stack_capacity;
+	struct instruction saves[ARRAY_LEN(CALLEE_SAVED_REGISTERS)];
+	size_t saves_count = 0;
+	for (size_t i = 0; i < ARRAY_LEN(CALLEE_SAVED_REGISTERS); ++i) {
+		enum reg r = CALLEE_SAVED_REGISTERS[i];
+		for (size_t j = 0; j < compiler->code.count; ++j) {
+			unsigned read, written;
+			instruction_regs(&compiler->code.items[j], &read, &written);
+			if ((read | written) & REG_BIT(r)) {
+				frame += 8;
+				saves[saves_count++] = (struct instruction) { .op = OP_MOV, .dst = stack(frame), .src = reg(r) };
+				break;
+			}
+		}
+	}
+	frame = (frame + 15) / 16 * 16;
+	fun.frame = frame;
+
+	if (frame) {
+		da_append(&fun, ((struct instruction) { .op = OP_SUB, .dst = reg(REG_RSP), .src = imm(frame) }));
+	}
+	for (size_t i = 0; i < saves_count; ++i) {
+		da_append(&fun, saves[i]);
+	}
+	fun.prologue = fun.count;
+
+	// Profiler calls get the record in r11 and preserve all the other registers
+	struct instruction profile_record = { .op = OP_LEA, .dst = reg(REG_R11), .src = extern_address(fun.profile_record) };
+	if (instrument) {
+		da_append(&fun, profile_record);
+		da_append(&fun, ((struct instruction) { .op = OP_CALL, .dst = plt_target("libb_profile_enter") }));
+	}
+
+	for (size_t i = 0; i < compiler->code.count; ++i) {
+		struct instruction const* in = &compiler->code.items[i];
+		if (in->op == OP_LEAVE) {
+			if (instrument) {
+				da_append(&fun, profile_record);
+				da_append(&fun, ((struct instruction) { .op = OP_CALL, .dst = plt_target("libb_profile_exit") }));
+			}
+			for (size_t j = 0; j < saves_count; ++j) {
+				da_append(&fun, ((struct instruction) { .op = OP_MOV, .dst = saves[j].src, .src = saves[j].dst }));
+			}
+		}
+		da_append(&fun, *in);
+	}
+	free(compiler->code.items);
+	compiler->code.items = NULL;
+	compiler->code.count = compiler->code.capacity = 0;
+	compiler->stack_capacity = 0;
+
+	*body = fun;
+}
+
+// With a profile functions that were never called are grouped in .text.unlikely
+// and the most called ones in .text.hot, where the linker places them together
+void print_text_section(char const* name)
+{
+	char const* section = ".text";
+	if (profile_counts.count) {
+		int64_t calls = profile_count(name, PROFILE_CALLS);
+		section = calls <= 0 ? ".text.unlikely" : calls >= profile_counts.hot_calls ? ".text.hot" : ".text";
+	}
+	if (function_sections) {
+		printf("section \"%s.%s\" progbits alloc exec nowrite align=16\n", section, name);
+	} else if (profile_counts.count) {
+		printf("section \"%s\" progbits alloc exec nowrite align=16\n", section);
+	}
+}
+
+// Instruction starts a row of the line table, rows begin with the line of the definition
+bool debug_line_changes(struct instruction const* in, size_t *line)
+{
+	if (!in->line || in->line == *line || in->op == OP_NOP) {
+		return false;
+	}
+	*line = in->line;
+	return true;
+}
+
+// Instruction is the first with different unwind rules: after the steps of the prologue and around epilogues
+bool debug_frame_changes(struct function const* fun, size_t i)
+{
+	return i == 1 || i == 2 || (i == fun->prologue && fun->items[i-1].op == OP_MOV) || (i > 0 && (fun->items[i-1].op == OP_LEAVE || fun->items[i-1].op == OP_RET));
+}
+
+void print_function(struct function const* fun)
+{
+	print_text_section(fun->name);
+	if (annotate) {
+		size_t instructions = 0;
+		for (size_t i = 0; i < fun->count; ++i) {
+			enum opcode op = fun->items[i].op;
+			instructions += op != OP_NOP && op != OP_LABEL && op != OP_COMMENT;
+		}
+		printf("; %s: frame %zu bytes, %zu instructions\n", fun->name, fun->frame, instructions);
+	}
+	if (debug_info) {
+		printf("global %s:function (sym_%zu.pc_%zu - sym_%zu)\n", fun->name, fun->id, fun->count, fun->id);
+	} else {
+		printf("global %s\n", fun->name);
+	}
+	printf("%s:\n", fun->name);
+	printf("sym_%zu:\n", fun->id);
+
+	size_t line = 0, debug_line = fun->line;
+	for (size_t i = 0; i < fun->count; ++i) {
+		struct instruction const* in = &fun->items[i];
+		if (debug_info && i > 0 && (debug_line_changes(in, &debug_line) || debug_frame_changes(fun, i))) {
+			printf(".pc_%zu:\n", i);
+		}
+		if (annotate && in->line && in->line != line && in->op != OP_NOP) {
+			line = in->line;
+			struct module const* module = &modules.items[fun->module];
+			char const* start = line_start(module, line);
+			if (start) start += strspn(start, " \t");
+			int length = start ? (int)strcspn(start, "\n") : 0;
+			printf("\t; %s:%zu: %.*s\n", module->filename, line, length, start ? start : "");
+		}
+		print_instruction(stdout, in);
+	}
+	if (debug_info) {
+		printf(".pc_%zu:\n", fun->count);
+	}
+}
+
+// DWARF numbers of general purpose registers
+static uint8_t const DWARF_REGISTERS[] = {
+	[REG_RAX] = 0, [REG_RDX] = 1, [REG_RCX] = 2, [REG_RBX] = 3,
+	[REG_RSI] = 4, [REG_RDI] = 5, [REG_RBP] = 6, [REG_RSP] = 7,
+	[REG_R8]  = 8,  [REG_R9]  = 9,  [REG_R10] = 10, [REG_R11] = 11,
+	[REG_R12] = 12, [REG_R13] = 13, [REG_R14] = 14, [REG_R15] = 15,
+};
+
+// LEB128 encoding of the value, returns number of bytes
+size_t encode_leb128(uint8_t out[static 10], int64_t value, bool is_signed)
+{
+	size_t bytes = 0;
+	for (bool more = true; more;) {
+		uint8_t byte = value & 0x7f;
+		value = is_signed ? value >> 7 : (int64_t)((uint64_t)value >> 7);
+		more = is_signed ? !((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) : value != 0;
+		out[bytes++] = byte | (more ? 0x80 : 0);
+	}
+	return bytes;
+}
+
+// Continues db directive with LEB128 encoding of the value, returns number of bytes
+size_t print_leb128(int64_t value, bool is_signed)
+{
+	uint8_t bytes[10];
+	size_t count = encode_leb128(bytes, value, is_signed);
+	for (size_t i = 0; i < count; ++i) {
+		printf(",0x%02x", bytes[i]);
+	}
+	return count;
+}
+
+// Bytes of the string with the terminating zero
+void print_cstring(char const* s)
+{
+	printf("\tdb ");
+	for (; *s; ++s) {
+		printf("0x%02x,", (unsigned char)*s);
+	}
+	printf("0x00\n");
+}
+
+// Address of the instruction, labels are printed by print_function
+void print_pc(struct function const* fun, size_t i)
+{
+	if (i == 0) {
+		printf("sym_%zu", fun->id);
+	} else {
+		printf("sym_%zu.pc_%zu", fun->id, i);
+	}
+}
+
+// Frame description entry with unwind rules of the rbp frame and callee saved registers
+void print_frame_description(struct function const* fun)
+{
+	printf("__b_fde_%zu:\n", fun->id);
+	printf("\tdd __b_fde_%zu_end - __b_fde_%zu - 4\n", fun->id, fun->id);
+	printf("\tdd __b_fde_%zu + 4 - __b_cie\n", fun->id);
+	printf("\tdd sym_%zu - $\n", fun->id);
+	printf("\tdd sym_%zu.pc_%zu - sym_%zu\n", fun->id, fun->count, fun->id);
+	printf("\tdb 0 ; augmentation data length\n");
+
+	size_t bytes = 17, last = 0;
+	bool remembered = false;
+	for (size_t i = 1; i < fun->count; ++i) {
+		if (!debug_frame_changes(fun, i)) {
+			continue;
+		}
+		printf("\tdb 0x04 ; DW_CFA_advance_loc4\n\tdd ");
+		print_pc(fun, i);
+		printf(" - ");
+		print_pc(fun, last);
+		printf("\n");
+		bytes += 5;
+		last = i;
+
+		if (i == 1) {
+			printf("\tdb 0x0e,0x10,0x86,0x02 ; DW_CFA_def_cfa_offset 16, DW_CFA_offset rbp\n");
+			bytes += 4;
+		}
+		if (i == 2) {
+			printf("\tdb 0x0d,0x06 ; DW_CFA_def_cfa_register rbp\n");
+			bytes += 2;
+		}
+		if (i == fun->prologue || fun->items[i-1].op == OP_LEAVE) {
+			bool leave = fun->items[i-1].op == OP_LEAVE;
+			if (leave) {
+				printf("\tdb 0x0a,0x0c,0x07,0x08,0xc6 ; DW_CFA_remember_state, DW_CFA_def_cfa rsp 8, DW_CFA_restore rbp\n");
+				bytes += 5;
+				remembered = true;
+			}
+			for (size_t j = 2; j < fun->prologue; ++j) {
+				struct instruction const* save = &fun->items[j];
+				if (save->op != OP_MOV || save->src.kind != OPERAND_REG) {
+					continue;
+				}
+				uint8_t r = DWARF_REGISTERS[save->src.reg];
+				if (leave) {
+					printf("\tdb 0x%02x ; DW_CFA_restore %s\n", 0xc0 | r, REG_NAMES[save->src.reg][3]);
+					bytes += 1;
+				} else {
+					printf("\tdb 0x%02x", 0x80 | r);
+					bytes += 1 + print_leb128((16 - save->dst.disp) / 8, false);
+					printf(" ; DW_CFA_offset %s\n", REG_NAMES[save->src.reg][3]);
+				}
+			}
+		}
+		if (fun->items[i-1].op == OP_RET && remembered) {
+			printf("\tdb 0x0b ; DW_CFA_restore_state\n");
+			bytes += 1;
+			remembered = false;
+		}
+	}
+
+	// Entries are aligned to the address size, DW_CFA_nop is 0
+	if (bytes % 8) {
+		printf("\ttimes %zu db 0\n", 8 - bytes % 8);
+	}
+	printf("__b_fde_%zu_end:\n", fun->id);
+}
+
+// Line number program of the function as a separate sequence, rows refer to the only file
+// x86 instruction takes at most 15 bytes
+#define MAX_INSTRUCTION_BYTES 15
+
+// Moves the address from instruction to instruction. DW_LNS_fixed_advance_pc takes
+// 16 bits, so distances that may not fit them set the address instead
+void print_line_advance(struct function const* fun, size_t from, size_t to)
+{
+	if ((to - from) * MAX_INSTRUCTION_BYTES <= UINT16_MAX) {
+		printf("\tdb 0x09 ; DW_LNS_fixed_advance_pc\n\tdw ");
+		print_pc(fun, to);
+		printf(" - ");
+		print_pc(fun, from);
+		printf("\n");
+	} else {
+		printf("\tdb 0x00,0x09,0x02 ; DW_LNE_set_address\n\tdq ");
+		print_pc(fun, to);
+		printf("\n");
+	}
+}
+
+void print_line_sequence(struct function const* fun)
+{
+	printf("\tdb 0x00,0x09,0x02 ; DW_LNE_set_address\n");
+	printf("\tdq sym_%zu\n", fun->id);
+	if (fun->module > 0) {
+		printf("\tdb 0x04");
+		print_leb128(fun->module + 1, false);
+		printf(" ; DW_LNS_set_file\n");
+	}
+	printf("\tdb 0x03");
+	print_leb128((int64_t)fun->line - 1, true);
+	printf(",0x01 ; DW_LNS_advance_line, DW_LNS_copy\n");
+
+	size_t line = fun->line, last = 0;
+	for (size_t i = 1; i < fun->count; ++i) {
+		size_t previous = line;
+		if (!debug_line_changes(&fun->items[i], &line)) {
+			continue;
+		}
+		printf("\tdb 0x03");
+		print_leb128((int64_t)line - (int64_t)previous, true);
+		printf(" ; DW_LNS_advance_line\n");
+		print_line_advance(fun, last, i);
+		printf("\tdb 0x01 ; DW_LNS_copy\n");
+		last = i;
+	}
+	print_line_advance(fun, last, fun->count);
+	printf("\tdb 0x00,0x01,0x01 ; DW_LNE_end_sequence\n");
+}
+
+bool is_promoted(struct function const* fun, size_t offset)
+{
+	for (size_t i = 0; i < fun->promoted.count; ++i) {
+		if (fun->promoted.items[i] == offset) return true;
+	}
+	return false;
+}
+
+// Function with its frame based locals, all of them are words. Slots of locals that
+// loops keep in registers are stale inside of them, so these locals have no location
+// and debuggers show them as optimized out.
+void print_subprogram(struct function const* fun)
+{
+	printf("\tdb 2 ; subprogram\n");
+	print_cstring(fun->name);
+	printf("\tdq sym_%zu\n", fun->id);
+	printf("\tdd sym_%zu.pc_%zu - sym_%zu\n", fun->id, fun->count, fun->id);
+	printf("\tdb 0x01,0x9c,0x%02zx", fun->module + 1);
+	print_leb128(fun->line, false);
+	printf(" ; frame base DW_OP_call_frame_cfa, file, line\n");
+	for (size_t i = 0; i < fun->locals.count; ++i) {
+		struct symbol const* local = &fun->locals.items[i];
+		if (local->kind == LOCAL && is_promoted(fun, local->offset)) {
+			printf("\tdb 5 ; variable without location\n");
+			print_cstring(local->name);
+			printf("\tdd __b_word - __b_info\n");
+			continue;
+		}
+		printf("\tdb 3 ; variable\n");
+		print_cstring(local->name);
+		// Vector evaluates to the address of its first word, the other locals live in their slot
+		bool vector = local->kind == LOCAL_VECTOR;
+		uint8_t offset[10];
+		size_t length = encode_leb128(offset, -(int64_t)local->offset - 16, true);
+		printf("\tdb 0x%02zx,0x91", 1 + length + vector);
+		for (size_t j = 0; j < length; ++j) {
+			printf(",0x%02x", offset[j]);
+		}
+		printf("%s ; DW_OP_fbreg%s\n", vector ? ",0x9f" : "", vector ? ", DW_OP_stack_value" : "");
+		printf("\tdd __b_word - __b_info\n");
+	}
+	printf("\tdb 0\n");
+}
+
+// Unwind tables, line table and names of the functions and locals for debuggers and profilers
+void print_debug_sections(struct compiler const* compiler)
+{
+	printf("section .eh_frame progbits alloc noexec nowrite align=8\n");
+	printf("__b_cie:\n");
+	printf("\tdd __b_cie_end - __b_cie - 4\n");
+	printf("\tdd 0 ; CIE id\n");
+	printf("\tdb 1,0x7a,0x52,0x00,1,0x78,16 ; version, \"zR\", code and data alignment, return address column\n");
+	printf("\tdb 1,0x1b ; augmentation: FDE addresses are pc relative\n");
+	printf("\tdb 0x0c,0x07,0x08,0x90,0x01 ; DW_CFA_def_cfa rsp 8, DW_CFA_offset rip\n");
+	printf("\ttimes 2 db 0\n");
+	printf("__b_cie_end:\n");
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		if (compiler->functions.items[i].used) {
+			print_frame_description(&compiler->functions.items[i]);
+		}
+	}
+
+	printf("section .debug_abbrev progbits noalloc noexec nowrite align=1\n");
+	printf("__b_abbrev:\n");
+	printf("\tdb 1,0x11,1,0x25,0x08,0x13,0x05,0x03,0x08,0x1b,0x08,0x10,0x17,0x11,0x01,0x55,0x17,0,0 ; compile unit\n");
+	printf("\tdb 2,0x2e,1,0x03,0x08,0x3f,0x19,0x11,0x01,0x12,0x06,0x40,0x18,0x3a,0x0b,0x3b,0x0f,0,0 ; subprogram\n");
+	printf("\tdb 3,0x34,0,0x03,0x08,0x02,0x18,0x49,0x13,0,0 ; variable\n");
+	printf("\tdb 4,0x24,0,0x03,0x08,0x3e,0x0b,0x0b,0x0b,0,0 ; base type\n");
+	printf("\tdb 5,0x34,0,0x03,0x08,0x49,0x13,0,0 ; variable without location\n");
+	printf("\tdb 0\n");
+
+	char directory[4096];
+	if (!getcwd(directory, sizeof(directory))) {
+		directory[0] = '\0';
+	}
+
+	printf("section .debug_info progbits noalloc noexec nowrite align=1\n");
+	printf("__b_info:\n");
+	printf("\tdd __b_info_end - __b_info - 4\n");
+	printf("\tdw 4\n");
+	printf("\tdd __b_abbrev\n");
+	printf("\tdb 8 ; address size\n");
+	printf("\tdb 1 ; compile unit\n");
+	print_cstring("b");
+	printf("\tdw 1 ; DW_LANG_C89, the closest to B\n");
+	print_cstring(modules.items[0].filename);
+	print_cstring(directory);
+	printf("\tdd __b_line\n");
+	printf("\tdq 0\n");
+	printf("\tdd __b_ranges\n");
+	printf("__b_word:\n");
+	printf("\tdb 4 ; base type\n");
+	print_cstring("word");
+	printf("\tdb 0x05,8 ; DW_ATE_signed\n");
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		if (compiler->functions.items[i].used) {
+			print_subprogram(&compiler->functions.items[i]);
+		}
+	}
+	printf("\tdb 0\n");
+	printf("__b_info_end:\n");
+
+	printf("section .debug_ranges progbits noalloc noexec nowrite align=1\n");
+	printf("__b_ranges:\n");
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function const* fun = &compiler->functions.items[i];
+		if (fun->used) {
+			printf("\tdq sym_%zu, sym_%zu.pc_%zu\n", fun->id, fun->id, fun->count);
+		}
+	}
+	printf("\tdq 0, 0\n");
+
+	printf("section .debug_line progbits noalloc noexec nowrite align=1\n");
+	printf("__b_line:\n");
+	printf("\tdd __b_line_end - __b_line - 4\n");
+	printf("\tdw 4\n");
+	printf("\tdd __b_line_program - __b_line - 10\n");
+	printf("\tdb 1,1,1,0xfb,14,13 ; instruction length, ops per instruction, is_stmt, line base and range, opcode base\n");
+	printf("\tdb 0,1,1,1,1,0,0,0,1,0,0,1 ; lengths of standard opcodes\n");
+	printf("\tdb 0 ; no include directories\n");
+	for (size_t i = 0; i < modules.count; ++i) {
+		print_cstring(modules.items[i].filename);
+		printf("\tdb 0,0,0 ; directory, time and size\n");
+	}
+	printf("\tdb 0 ; end of files\n");
+	printf("__b_line_program:\n");
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		if (compiler->functions.items[i].used) {
+			print_line_sequence(&compiler->functions.items[i]);
+		}
+	}
+	printf("__b_line_end:\n");
+}
+
+// Record filled by libb profiler, its layout is struct profile_record of libb
+void print_profile_record(struct function const* fun)
+{
+	printf("%s:\n", fun->profile_record);
+	printf("\tdq 0, 0, 0, %s.name, 0, 0, %zu\n", fun->profile_record, fun->blocks.count);
+	for (size_t i = 0; i < fun->blocks.count; ++i) {
+		printf("\tdq %zu, 0\n", fun->blocks.items[i]);
+	}
+	printf(".name:\n");
+	print_cstring(fun->name);
+	printf("align 8\n");
+}
+
+// Number of words of the global, vectors are as large as the larger of declared size and number of values
+uint64_t data_size(struct data const* data)
+{
+	uint64_t size = data->count;
+	if (data->is_vec && size < data->declared_size.ival) {
+		size = data->declared_size.ival;
+	}
+	// TODO: error message
+	assert(!data->is_vec || size != 0);
+	return size ? size : 1;
+}
+
+bool is_zero_data(struct data const* data)
+{
+	for (size_t i = 0; i < data->count; ++i) {
+		if (data->items[i].kind != TOK_INTEGER || data->items[i].ival != 0) return false;
+	}
+	return true;
+}
+
+// Prints global into .data. Zero words are reserved in .bss and pointers of read only
+// vectors are printed into .data.rel.ro, here only the remaining part is printed.
+void print_data(struct data const* data)
+{
+	uint64_t size = data_size(data);
+	bool zero = is_zero_data(data);
+
+	if (data->is_vec && !data->read_only) {
+		if (zero) {
+			printf("sym_%zu: dq vec_%zu\n", data->id, data->id);
+			return;
+		}
+		printf("sym_%zu: dq $+8\n", data->id);
+	} else if (zero) {
+		return;
+	} else {
+		printf("%s_%zu:\n", data->is_vec ? "vec" : "sym", data->id);
+	}
+
+	printf("\tdq ");
+	for (size_t i = 0; i < data->count; ++i) {
+		if (i > 0) { printf(","); }
+		switch (data->items[i].kind) {
+		case TOK_STRING:
+			printf("strend - %zu", string_offset(data->items[i].text));
+			break;
+
+		case TOK_INTEGER: printf("%"PRIu64, data->items[i].ival); break;
+
+		default:
+			assert(0 && "not implemented yet");
+		}
+	}
+	printf("\n");
+
+	if (size > data->count) {
+		printf("\ttimes %"PRIu64" dq 0\n", size - data->count);
+	}
+}
+
+static struct {
+	size_t functions, globals, strings, constants;
+} unused_stats;
+
+// Globals that are only read are replaced by their values (see "Constants" in ideas.txt).
+// Only plain loads of the global are reads, anything else can modify it.
+void inline_constants(struct compiler *compiler)
+{
+	struct data **data_of = calloc(compiler->last_symbol_id + 1, sizeof(*data_of));
+	for (size_t i = 0; i < compiler->data_section.count; ++i) {
+		struct data *data = &compiler->data_section.items[i];
+		data->read_only = true;
+		data_of[data->id] = data;
+	}
+
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function const* fun = &compiler->functions.items[i];
+		for (size_t j = 0; j < fun->count; ++j) {
+			struct instruction const* in = &fun->items[j];
+			if (in->dst.ref == REF_SYMBOL && data_of[in->dst.id]) {
+				data_of[in->dst.id]->read_only = false;
+			}
+			if (in->src.ref == REF_SYMBOL && data_of[in->src.id]) {
+				bool load = in->op == OP_MOV && in->dst.kind == OPERAND_REG && same_location(in->src, symbol_address(in->src.id));
+				data_of[in->src.id]->read_only &= load;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < compiler->data_section.count; ++i) {
+		struct data *data = &compiler->data_section.items[i];
+		data->constant = data->read_only && !data->is_vec;
+		unused_stats.constants += data->constant;
+	}
+
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function *fun = &compiler->functions.items[i];
+		for (size_t j = 0; j < fun->count; ++j) {
+			struct instruction *in = &fun->items[j];
+			if (in->src.ref != REF_SYMBOL || !data_of[in->src.id] || !data_of[in->src.id]->constant) continue;
+
+			struct data const* data = data_of[in->src.id];
+			if (data->count == 0) {
+				in->src = imm(0);
+			} else if (data->items[0].kind == TOK_INTEGER) {
+				in->src = imm(data->items[0].ival);
+			} else {
+				assert(data->items[0].kind == TOK_STRING);
+				in->op = OP_LEA;
+				in->src = string_address(data->items[0].text);
+			}
+		}
+	}
+
+	free(data_of);
+}
+
+// Global definition of the name in any of the modules
+struct symbol const* find_definition(struct compiler *compiler, char const* name)
+{
+	struct scope const* globals = &compiler->scope[0];
+	for (size_t i = 0; i < globals->count; ++i) {
+		if (globals->items[i].kind == GLOBAL && strcmp(globals->items[i].name, name) == 0) {
+			return &globals->items[i];
+		}
+	}
+	return NULL;
+}
+
+// Whole program: externs defined by one of the modules are called and accessed directly as sym_<id>
+// instead of through PLT and GOT, which lets constants of other modules to be inlined
+void resolve_externs(struct compiler *compiler)
+{
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function *fun = &compiler->functions.items[i];
+		for (size_t j = 0; j < fun->count; ++j) {
+			struct instruction *in = &fun->items[j];
+			struct operand *operands[] = { &in->dst, &in->src };
+			for (size_t k = 0; k < ARRAY_LEN(operands); ++k) {
+				struct operand *op = operands[k];
+				if (op->ref != REF_EXTERN && op->ref != REF_PLT && op->ref != REF_GOT) continue;
+
+				struct symbol const* symbol = find_definition(compiler, op->name);
+				if (!symbol) continue;
+
+				if (op->ref == REF_GOT) {
+					// mov r, [GOT] loads the address, load of the value right after it becomes mov r, [sym]
+					assert(in->op == OP_MOV && in->dst.kind == OPERAND_REG);
+					struct instruction *next = j + 1 < fun->count ? in + 1 : NULL;
+					if (next && next->op == OP_MOV && next->dst.kind == OPERAND_REG && next->dst.reg == in->dst.reg
+							&& same_location(next->src, deref(in->dst.reg))) {
+						next->op = OP_NOP;
+					} else {
+						in->op = OP_LEA;
+					}
+				}
+				*op = (struct operand) { .kind = op->kind, .size = op->size, .ref = REF_SYMBOL, .id = symbol->id };
+			}
+		}
+	}
+}
+
+// Marks definitions reachable from main (or every function when there is no main) and strings they use
+void mark_used_definitions(struct compiler *compiler)
+{
+	size_t symbols = compiler->last_symbol_id + 1;
+	bool *used = calloc(symbols, sizeof(*used));
+	size_t *function_of = malloc(symbols * sizeof(*function_of));
+	memset(function_of, 0xff, symbols * sizeof(*function_of));
+
+	struct { size_t *items; size_t count, capacity; } pending = {};
+	bool has_main = false;
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		function_of[compiler->functions.items[i].id] = i;
+		has_main |= strcmp(compiler->functions.items[i].name, "main") == 0;
+	}
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function const* fun = &compiler->functions.items[i];
+		if (!optimizations_enabled || !has_main || strcmp(fun->name, "main") == 0) {
+			used[fun->id] = true;
+			da_append(&pending, i);
+		}
+	}
+
+	while (pending.count > 0) {
+		struct function const* fun = &compiler->functions.items[pending.items[--pending.count]];
+		for (size_t i = 0; i < fun->count; ++i) {
+			struct operand const* operands[] = { &fun->items[i].dst, &fun->items[i].src };
+			for (size_t k = 0; k < ARRAY_LEN(operands); ++k) {
+				struct operand op = *operands[k];
+				size_t id = 0;
+				switch (op.ref) {
+				case REF_STRINGS:
+					string_node(op.name)->used = true;
+					continue;
+				case REF_SYMBOL:
+					id = op.id;
+					break;
+				case REF_EXTERN:
+				case REF_PLT:
+				case REF_GOT:
+					// Functions defined later in the same file are called through extrn
+					for (size_t j = 0; j < compiler->functions.count; ++j) {
+						if (strcmp(compiler->functions.items[j].name, op.name) == 0) {
+							id = compiler->functions.items[j].id;
+							break;
+						}
+					}
+					break;
+				default:
+					continue;
+				}
+				if (id == 0 || used[id]) continue;
+				used[id] = true;
+				if (function_of[id] != (size_t)-1) {
+					da_append(&pending, function_of[id]);
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < compiler->data_section.count; ++i) {
+		struct data *data = &compiler->data_section.items[i];
+		data->used = !optimizations_enabled || used[data->id];
+		unused_stats.globals += !data->used;
+		for (size_t j = 0; data->used && j < data->count; ++j) {
+			if (data->items[j].kind == TOK_STRING) {
+				string_node(data->items[j].text)->used = true;
+			}
 		}
-		printf("\nstrend:\n");
+	}
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function *fun = &compiler->functions.items[i];
+		fun->used = used[fun->id];
+		unused_stats.functions += !fun->used;
+	}
+	if (optimizations_enabled) {
+		unused_stats.strings = remove_unused_strings();
 	}
 
-	// TODO: better solution to presever assert
-	leave_scope(&compiler);
-
-#endif
-}
-
-struct token peek_token(struct parser *p)
-{
-	size_t save = p->tokenizer.head;
-	struct token next = scan(&p->tokenizer);
-	p->tokenizer.head = save;
-	return next;
+	free(pending.items);
+	free(function_of);
+	free(used);
 }
 
-bool expect_token(struct parser *p, struct token *tok, enum token_kind kind)
+void print_stats(FILE *out)
 {
-	size_t save = p->tokenizer.head;
-	*tok = scan(&p->tokenizer);
-
-	if (tok->kind != kind) {
-		p->tokenizer.head = save;
-		return false;
+	fprintf(out, "peephole optimizer:\n");
+	for (size_t i = 0; i < ARRAY_LEN(PEEPHOLES); ++i) {
+		fprintf(out, "  %-18s %zu\n", PEEPHOLES[i].name, PEEPHOLES[i].hits);
 	}
-	return true;
+	fprintf(out, "loop optimizer:\n");
+	fprintf(out, "  %-18s %zu\n", "loops", loop_stats.loops);
+	fprintf(out, "  %-18s %zu\n", "promoted", loop_stats.promoted);
+	fprintf(out, "  %-18s %zu\n", "hoisted", loop_stats.hoisted);
+	fprintf(out, "  %-18s %zu\n", "vectorized", loop_stats.vectorized);
+	fprintf(out, "  %-18s %zu\n", "idioms", loop_stats.idioms);
+	fprintf(out, "  %-18s %zu\n", "reduced", loop_stats.reduced);
+	fprintf(out, "whole program:\n");
+	fprintf(out, "  %-18s %zu\n", "unused functions", unused_stats.functions);
+	fprintf(out, "  %-18s %zu\n", "unused globals", unused_stats.globals);
+	fprintf(out, "  %-18s %zu\n", "unused strings", unused_stats.strings);
+	fprintf(out, "  %-18s %zu\n", "inlined constants", unused_stats.constants);
 }
 
-bool expect_token2(struct parser *p, struct token *tok1, enum token_kind kind1, struct token *tok2, enum token_kind kind2)
+// Phases are listed with time spent in nested work indented below them
+void print_time_report(FILE *out)
 {
-	size_t save = p->tokenizer.head;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	struct { char const* name; unsigned depth; double seconds; } const phases[] = {
+		{ "read input",        0, compile_stats.read },
+		{ "parse and codegen", 0, compile_stats.parse },
+		{ "scan",              1, compile_stats.scan },
+		{ "string interning",  2, compile_stats.intern },
+		{ "symbol lookup",     1, compile_stats.lookup },
+		{ "optimize",          0, compile_stats.optimize },
+		{ "output",            0, compile_stats.output },
+		{ "functions",         1, compile_stats.functions },
+		{ "data",              1, compile_stats.data },
+	};
+	// Counters that are not known are SIZE_MAX, reported as null or -
+	struct { char const* name; size_t value; } const counters[] = {
+		{ "lines",             compile_stats.lines },
+		{ "tokens",            compile_stats.tokens },
+		{ "scans",             compile_stats.scans },
+		{ "interned strings",  compile_stats.interned },
+		{ "peak symbols",      compile_stats.peak_symbols },
+		{ "stack slots",       compile_stats.stack_slots },
+		{ "labels",            compile_stats.labels },
+		{ "bytes emitted",     compile_stats.bytes < 0 ? SIZE_MAX : (size_t)compile_stats.bytes },
+		{ "peak rss KiB",      usage.ru_maxrss },
+	};
 
-	if ((*tok1 = scan(&p->tokenizer)).kind == kind1
-	&&  (*tok2 = scan(&p->tokenizer)).kind == kind2) {
-		return true;
+	if (time_report == TIME_REPORT_JSON) {
+		fprintf(out, "{\"phases\": {");
+		for (size_t i = 0; i < ARRAY_LEN(phases); ++i) {
+			fprintf(out, "%s\"%s\": %.6f", i ? ", " : "", phases[i].name, phases[i].seconds);
+		}
+		fprintf(out, "}, \"counters\": {");
+		for (size_t i = 0; i < ARRAY_LEN(counters); ++i) {
+			fprintf(out, "%s\"%s\": ", i ? ", " : "", counters[i].name);
+			if (counters[i].value == SIZE_MAX) fprintf(out, "null");
+			else fprintf(out, "%zu", counters[i].value);
+		}
+		fprintf(out, "}}\n");
+		return;
 	}
 
-	p->tokenizer.head = save;
-	return false;
+	double total = compile_stats.read + compile_stats.parse + compile_stats.optimize + compile_stats.output;
+	fprintf(out, "time report:\n");
+	for (size_t i = 0; i < ARRAY_LEN(phases); ++i) {
+		int indent = 2 * phases[i].depth;
+		fprintf(out, "  %*s%-*s %10.3f ms %5.1f%%\n", indent, "", 20 - indent, phases[i].name,
+			phases[i].seconds * 1e3, total > 0 ? 100 * phases[i].seconds / total : 0);
+	}
+	fprintf(out, "  %-20s %10.3f ms\n", "total", total * 1e3);
+	fprintf(out, "counters:\n");
+	for (size_t i = 0; i < ARRAY_LEN(counters); ++i) {
+		if (counters[i].value == SIZE_MAX) fprintf(out, "  %-20s %10s\n", counters[i].name, "-");
+		else fprintf(out, "  %-20s %10zu\n", counters[i].name, counters[i].value);
+	}
 }
 
-
-bool expect_token_if(struct parser *p, struct token *tok, bool(*predicate)(enum token_kind))
+// Address of the external symbol, taken from its GOT entry unless linking statically
+void load_extern_address(struct compiler *compiler, enum reg dst, char const* name)
 {
-	size_t save = p->tokenizer.head;
-	if (predicate((*tok = scan(&p->tokenizer)).kind)) {
-		return true;
+	if (nolibc) {
+		emit2(compiler, OP_LEA, reg(dst), extern_address(name));
+	} else {
+		emit2(compiler, OP_MOV, reg(dst), got_address(name));
 	}
-	p->tokenizer.head = save;
-	return false;
 }
 
-void mov_into_reg(char const* dst, struct value src)
+void mov_into_reg(struct compiler *compiler, enum reg dst, struct value src)
 {
 	switch (src.kind) {
 	case LVALUE_AUTO:
 	case RVALUE:
-		printf("\tmov %s, [rbp-%zu]\n", dst, src.offset);
+		emit2(compiler, OP_MOV, reg(dst), stack(src.offset));
 		break;
 
 	case LVALUE_PTR:
-		printf("\tmov %s, [rbp-%zu]\n", dst, src.offset);
-		printf("\tmov %s, [%s]\n", dst, dst);
+		emit2(compiler, OP_MOV, reg(dst), stack(src.offset));
+		emit2(compiler, OP_MOV, reg(dst), deref(dst));
+		break;
+
+	case LVALUE_GLOBAL:
+		emit2(compiler, OP_MOV, reg(dst), symbol_address(src.id));
+		break;
+
+	case LVALUE_EXTERN:
+		if (nolibc) {
+			emit2(compiler, OP_MOV, reg(dst), extern_address(src.name));
+			break;
+		}
+		emit2(compiler, OP_MOV, reg(dst), got_address(src.name));
+		emit2(compiler, OP_MOV, reg(dst), deref(dst));
 		break;
 
 	case EMPTY:
@@ -744,6 +4976,135 @@ void mov_into_reg(char const* dst, struct value src)
 	}
 }
 
+// Memory operand of the lvalue which address is not kept in a stack slot
+struct operand global_location(struct compiler *compiler, struct value lvalue, enum reg scratch)
+{
+	if (lvalue.kind == LVALUE_GLOBAL) {
+		return symbol_address(lvalue.id);
+	}
+	assert(lvalue.kind == LVALUE_EXTERN);
+	if (nolibc) {
+		return extern_address(lvalue.name);
+	}
+	emit2(compiler, OP_MOV, reg(scratch), got_address(lvalue.name));
+	return deref(scratch);
+}
+
+// Take the pending condition from the compiler, so that code emitted next does not
+// materialize it
+struct pending_condition take_condition(struct compiler *compiler)
+{
+	struct pending_condition cond = compiler->condition;
+	compiler->condition = (struct pending_condition) {};
+	return cond;
+}
+
+void patch_jumps(struct compiler *compiler, struct jumps *jumps, struct operand target)
+{
+	for (size_t i = 0; i < jumps->count; ++i) {
+		compiler->code.items[jumps->items[i]].dst = target;
+	}
+	free(jumps->items);
+	*jumps = (struct jumps) {};
+}
+
+// Emit conditional jump which target is filled later by patch_jumps
+void emit_pending_jcc(struct compiler *compiler, enum condition cc, struct jumps *jumps)
+{
+	da_append(jumps, compiler->code.count);
+	emit_jcc(compiler, cc, (struct operand) {});
+}
+
+// Place label where pending jumps should land (if there are any)
+void land_jumps(struct compiler *compiler, struct jumps *jumps)
+{
+	if (jumps->count == 0) return;
+	size_t label = compiler->last_local_id++;
+	patch_jumps(compiler, jumps, local_label(label));
+	emit_label(compiler, local_label(label));
+}
+
+// Store value of the pending condition into its slot:
+//   setcc r11b
+//   movzx r11, r11b
+//   mov [rbp-offset], r11
+// .join:
+void materialize_condition(struct compiler *compiler)
+{
+	struct pending_condition cond = take_condition(compiler);
+	if (!cond.stored) {
+		emit_setcc(compiler, cond.cc, reg8(REG_R11));
+		emit2(compiler, OP_MOVZX, reg(REG_R11), reg8(REG_R11));
+		emit2(compiler, OP_MOV, stack(cond.offset), reg(REG_R11));
+	}
+	// Jumps out of && and || have already stored their values
+	size_t label = compiler->last_local_id++;
+	if (cond.true_jumps.count + cond.false_jumps.count > 0) {
+		patch_jumps(compiler, &cond.true_jumps, local_label(label));
+		patch_jumps(compiler, &cond.false_jumps, local_label(label));
+		emit_label(compiler, local_label(label));
+	}
+}
+
+// Make value a pending condition with flags set by `test value, value`
+struct pending_condition test_value(struct compiler *compiler, struct value value)
+{
+	if (compiler->condition.active && value.kind == RVALUE && compiler->condition.offset == value.offset) {
+		return take_condition(compiler);
+	}
+	if (compiler->condition.active) materialize_condition(compiler);
+	mov_into_reg(compiler, REG_RAX, value);
+	emit2(compiler, OP_TEST, reg(REG_RAX), reg(REG_RAX));
+	return (struct pending_condition) { .active = true, .offset = value.offset, .cc = CC_NE, .stored = true };
+}
+
+// Jump to the false_label when value is zero, continue otherwise.
+// Comparisons and logical operators branch directly on flags without storing 0 or 1 first.
+// Returns position of the final conditional jump.
+size_t jump_if_false(struct compiler *compiler, struct value value, size_t false_label)
+{
+	struct pending_condition cond = test_value(compiler, value);
+	size_t jump = compiler->code.count;
+	emit_jcc(compiler, invert_condition(cond.cc), local_label(false_label));
+	patch_jumps(compiler, &cond.false_jumps, local_label(false_label));
+	land_jumps(compiler, &cond.true_jumps);
+	return jump;
+}
+
+// Emits copy of the loop condition code[begin..end) that jumps back to the loop body
+// when condition holds. Labels defined by the condition are renamed, with the label
+// that follows the final jump becoming the body itself.
+void emit_loop_test(struct compiler *compiler, size_t begin, size_t jump, size_t end, size_t body)
+{
+	struct { size_t from, to; } renames[64];
+	size_t renames_count = 0;
+
+	for (size_t i = begin; i < end; ++i) {
+		struct instruction in = compiler->code.items[i];
+		if (in.op == OP_LABEL && in.dst.ref == REF_LOCAL) {
+			assert(renames_count < ARRAY_LEN(renames));
+			renames[renames_count].from = in.dst.id;
+			renames[renames_count].to = i > jump ? body : compiler->last_local_id++;
+			++renames_count;
+		}
+	}
+
+	for (size_t i = begin; i < end && i <= jump; ++i) {
+		struct instruction in = compiler->code.items[i];
+		if (i == jump) {
+			in.cc = invert_condition(in.cc);
+			in.dst = local_label(body);
+		}
+		for (size_t j = 0; j < renames_count; ++j) {
+			if (in.dst.kind == OPERAND_LABEL && in.dst.ref == REF_LOCAL && in.dst.id == renames[j].from) {
+				in.dst.id = renames[j].to;
+				break;
+			}
+		}
+		emit_instruction(compiler, in);
+	}
+}
+
 
 bool parse_expression(struct parser *p, struct compiler *compiler, struct value *result);
 bool parse_unary(struct parser *p, struct compiler *compiler, struct value *lhs);
@@ -764,9 +5125,9 @@ bool parse_return(struct parser *p, struct compiler *compiler)
 			exit(1);
 		}
 
-		mov_into_reg("rax", retval);
-		printf("\tleave\n");
-		printf("\tret\n");
+		mov_into_reg(compiler, REG_RAX, retval);
+		emit0(compiler, OP_LEAVE);
+		emit0(compiler, OP_RET);
 
 		struct token close;
 		if (!expect_token(p, &close, TOK_PAREN_CLOSE)) {
@@ -779,8 +5140,8 @@ bool parse_return(struct parser *p, struct compiler *compiler)
 			exit(2);
 		}
 	} else if (expect_token(p, &semicolon, TOK_SEMICOLON)) {
-		printf("\tleave\n");
-		printf("\tret\n");
+		emit0(compiler, OP_LEAVE);
+		emit0(compiler, OP_RET);
 	} else {
 		errorf(return_, "return expects ; or (, got %s\n", token_short_name(semicolon));
 		exit(2);
@@ -812,7 +5173,6 @@ bool parse_extern(struct parser *p, struct compiler *compiler)
 			}
 		}
 		if (!found) {
-			printf("\textern %s\n", name.text);
 			da_append(&compiler->defined_externs, name.text);
 		}
 
@@ -888,7 +5248,7 @@ bool parse_auto(struct parser *p, struct compiler *compiler)
 				.definition = name,
 			},
 			name);
-		printf("\t; auto [rbp-%zu] = %s (sized %zu)\n", s.offset, name.text, size_to_allocate);
+		emit_comment(compiler, "auto [rbp-%zu] = %s (sized %zu)", s.offset, name.text, size_to_allocate);
 
 
 		struct token semicolon, comma;
@@ -929,10 +5289,10 @@ bool parse_goto(struct parser *p, struct compiler *compiler)
 	if (label == (size_t)-1) {
 		struct label new = { .name = identifier.text, .defined = false, .first_usage = identifier };
 		da_append(&compiler->function_labels, new);
-		label = compiler->function_labels.count;
+		label = compiler->function_labels.count - 1;
 	}
 
-	printf("\tjmp .label_%zu\n", label);
+	emit1(compiler, OP_JMP, user_label(label));
 	return true;
 }
 
@@ -962,6 +5322,151 @@ bool parse_compund_statement(struct parser *p, struct compiler *compiler)
 	return true;
 }
 
+// Memory access narrower than a word and atomic operations, compiled inline when called
+// through extrn and none of the modules defines a function of the same name. Stores
+// return the value that was passed to them, read-modify-write operations return the
+// previous value of the word.
+static struct intrinsic
+{
+	char const* name;
+	size_t args;
+	bool store;
+	bool indexed; // address is first argument plus second, not scaled by word size
+	bool sign;    // loaded value is sign extended
+	unsigned size;
+	enum opcode atomic; // instruction used instead of plain access, if any
+} const INTRINSICS[] = {
+	{ .name = "char",   .args = 2, .indexed = true, .size = 1 },
+	{ .name = "lchar",  .args = 3, .indexed = true, .size = 1, .store = true },
+	{ .name = "u8",     .args = 1, .size = 1 },
+	{ .name = "i8",     .args = 1, .size = 1, .sign = true },
+	{ .name = "u16",    .args = 1, .size = 2 },
+	{ .name = "i16",    .args = 1, .size = 2, .sign = true },
+	{ .name = "u32",    .args = 1, .size = 4 },
+	{ .name = "i32",    .args = 1, .size = 4, .sign = true },
+	{ .name = "i8set",  .args = 2, .size = 1, .store = true },
+	{ .name = "i16set", .args = 2, .size = 2, .store = true },
+	{ .name = "i32set", .args = 2, .size = 4, .store = true },
+
+	// Loads are not reordered with other loads on x86-64, stores go through xchg
+	// to be sequentially consistent
+	{ .name = "atomic_load",  .args = 1, .size = 8 },
+	{ .name = "atomic_store", .args = 2, .size = 8, .store = true, .atomic = OP_XCHG },
+	{ .name = "atomic_xchg",  .args = 2, .size = 8, .atomic = OP_XCHG },
+	{ .name = "atomic_add",   .args = 2, .size = 8, .atomic = OP_XADD },
+	{ .name = "atomic_cas",   .args = 3, .size = 8, .atomic = OP_CMPXCHG },
+	{ .name = "atomic_fence", .args = 0, .atomic = OP_MFENCE },
+	{ .name = "spin_pause",   .args = 0, .atomic = OP_PAUSE },
+};
+
+struct intrinsic const* find_intrinsic(char const* name)
+{
+	for (size_t i = 0; i < ARRAY_LEN(INTRINSICS); ++i) {
+		if (strcmp(INTRINSICS[i].name, name) == 0) {
+			return &INTRINSICS[i];
+		}
+	}
+	return NULL;
+}
+
+// Code of the intrinsic replacing its call, with arguments in rdi, rsi and rdx and the result in rax.
+// atomic_cas(p, expected, new) returns the old value, which equals expected on success.
+void emit_intrinsic(struct function *fun, struct intrinsic const* intrinsic)
+{
+	switch (intrinsic->atomic) {
+	case OP_NOP:
+		break;
+
+	case OP_MFENCE:
+	case OP_PAUSE:
+		da_append(fun, ((struct instruction) { .op = intrinsic->atomic }));
+		da_append(fun, ((struct instruction) { .op = OP_XOR, .dst = reg(REG_RAX), .src = reg(REG_RAX) }));
+		return;
+
+	case OP_CMPXCHG:
+		da_append(fun, ((struct instruction) { .op = OP_MOV, .dst = reg(REG_RAX), .src = reg(REG_RSI) }));
+		da_append(fun, ((struct instruction) { .op = OP_CMPXCHG, .dst = deref(REG_RDI), .src = reg(REG_RDX) }));
+		return;
+
+	default:
+		if (intrinsic->store) da_append(fun, ((struct instruction) { .op = OP_MOV, .dst = reg(REG_RAX), .src = reg(REG_RSI) }));
+		da_append(fun, ((struct instruction) { .op = intrinsic->atomic, .dst = deref(REG_RDI), .src = reg(REG_RSI) }));
+		if (!intrinsic->store) da_append(fun, ((struct instruction) { .op = OP_MOV, .dst = reg(REG_RAX), .src = reg(REG_RSI) }));
+		return;
+	}
+
+	struct operand address = intrinsic->indexed ? indexed(REG_RDI, REG_RSI, 1) : deref(REG_RDI);
+	address.size = intrinsic->size;
+
+	if (intrinsic->store) {
+		enum reg value = ABI_REGISTERS[intrinsic->args - 1];
+		da_append(fun, ((struct instruction) { .op = OP_MOV, .dst = address, .src = sized_reg(value, intrinsic->size) }));
+		da_append(fun, ((struct instruction) { .op = OP_MOV, .dst = reg(REG_RAX), .src = reg(value) }));
+		return;
+	}
+
+	struct instruction load = { .op = OP_MOV, .dst = reg(REG_RAX), .src = address };
+	if (intrinsic->size == 4) {
+		if (intrinsic->sign) {
+			load.op = OP_MOVSXD;
+		} else {
+			// Writes to 32 bit registers clear upper half
+			load.dst = sized_reg(REG_RAX, 4);
+		}
+	} else if (intrinsic->size < 8) {
+		load.op = intrinsic->sign ? OP_MOVSX : OP_MOVZX;
+	}
+	da_append(fun, load);
+}
+
+// Intrinsics are known to be calls of the library only once every module is parsed,
+// since any of them may define a function of the same name, which is called instead
+void lower_intrinsics(struct compiler *compiler)
+{
+	for (size_t i = 0; i < compiler->intrinsic_calls.count; ++i) {
+		struct intrinsic_call const* call = &compiler->intrinsic_calls.items[i];
+		struct intrinsic const* intrinsic = find_intrinsic(call->name);
+		if (!find_definition(compiler, call->name) && call->args != intrinsic->args) {
+			errorf(call->open, "%s expects %zu arguments, got %zu\n", intrinsic->name, intrinsic->args, call->args);
+			exit(1);
+		}
+	}
+	if (compiler->intrinsic_calls.count == 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < compiler->functions.count; ++i) {
+		struct function *fun = &compiler->functions.items[i];
+		struct function lowered = *fun;
+		lowered.items = NULL;
+		lowered.count = lowered.capacity = 0;
+		for (size_t j = 0; j < fun->count; ++j) {
+			struct instruction const* in = &fun->items[j];
+			struct intrinsic const* intrinsic = NULL;
+			if (in->op == OP_CALL && (in->dst.ref == REF_PLT || in->dst.ref == REF_EXTERN)
+					&& !find_definition(compiler, in->dst.name)) {
+				intrinsic = find_intrinsic(in->dst.name);
+			}
+			if (!intrinsic) {
+				da_append(&lowered, *in);
+				continue;
+			}
+			// xor rax, rax before the call counts vector arguments of variadic functions
+			struct instruction *prev = lowered.count ? &lowered.items[lowered.count - 1] : NULL;
+			if (prev && prev->op == OP_XOR && prev->dst.kind == OPERAND_REG && prev->dst.reg == REG_RAX) {
+				--lowered.count;
+			}
+			size_t begin = lowered.count;
+			emit_intrinsic(&lowered, intrinsic);
+			for (size_t k = begin; k < lowered.count; ++k) {
+				lowered.items[k].line = in->line;
+			}
+		}
+		free(fun->items);
+		*fun = lowered;
+	}
+}
+
 bool parse_funccall(struct parser *p, struct compiler *compiler, struct value *result, struct symbol *symbol)
 {
 	struct token open;
@@ -989,10 +5494,6 @@ bool parse_funccall(struct parser *p, struct compiler *compiler, struct value *r
 		++args_count;
 	}
 
-	for (size_t i = 0; i < args_count; ++i) {
-		mov_into_reg(ABI_REGISTERS[i], args[i]);
-	}
-
 
 	struct token close;
 	if (!expect_token(p, &close, TOK_PAREN_CLOSE)) {
@@ -1001,18 +5502,28 @@ bool parse_funccall(struct parser *p, struct compiler *compiler, struct value *r
 		exit(2);
 	}
 
-	printf("\txor rax, rax\n");
+	if (symbol->kind == EXTERNAL && find_intrinsic(symbol->name)) {
+		da_append(&compiler->intrinsic_calls, ((struct intrinsic_call) { .name = symbol->name, .open = open, .args = args_count }));
+	}
+
+	for (size_t i = 0; i < args_count; ++i) {
+		mov_into_reg(compiler, ABI_REGISTERS[i], args[i]);
+	}
+	emit2(compiler, OP_XOR, reg(REG_RAX), reg(REG_RAX));
 
 	switch (symbol->kind) {
-		case EXTERNAL: printf("\tcall %s WRT ..plt\n", symbol->name); break;
-		case GLOBAL: printf("\tcall sym_%zu\n", symbol->id); break;
-		case LOCAL: printf("\tlea r10, QWORD [rbp-%zu]\n\tcall r10\n", symbol->offset); break;
+		case EXTERNAL: emit1(compiler, OP_CALL, plt_target(symbol->name)); break;
+		case GLOBAL: emit1(compiler, OP_CALL, symbol_target(symbol->id)); break;
+		case LOCAL:
+			emit2(compiler, OP_LEA, reg(REG_R10), qword(stack(symbol->offset)));
+			emit1(compiler, OP_CALL, reg(REG_R10));
+			break;
 		NOT_IMPLEMENTED_FOR(LOCAL_VECTOR);
 	}
 
 	result->kind = RVALUE;
 	result->offset = alloc_stack(compiler);
-	printf("\tmov [rbp-%zu], rax\n", result->offset);
+	emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 
 	return true;
 }
@@ -1045,15 +5556,15 @@ bool parse_constant(struct parser *p, struct compiler *compiler, struct value *l
 integer:
 		lhs->kind = RVALUE;
 		lhs->offset = alloc_stack(compiler);
-		printf("\tmov rax, %"PRIu64"\n", constant.ival);
-		printf("\tmov QWORD [rbp-%zu], rax\n", lhs->offset);
+		emit2(compiler, OP_MOV, reg(REG_RAX), imm(constant.ival));
+		emit2(compiler, OP_MOV, qword(stack(lhs->offset)), reg(REG_RAX));
 		return true;
 	}
 
 	if (expect_token(p, &constant, TOK_CHARACTER)) {
 		lhs->kind = RVALUE;
 		lhs->offset = alloc_stack(compiler);
-		printf("\tmov QWORD [rbp-%zu], %"PRIu64"\n", lhs->offset, constant.ival);
+		emit2(compiler, OP_MOV, qword(stack(lhs->offset)), imm(constant.ival));
 		return true;
 	}
 
@@ -1061,8 +5572,8 @@ integer:
 string:
 		lhs->kind = RVALUE;
 		lhs->offset = alloc_stack(compiler);
-		printf("\tlea rax, [strend-%zu]\n", string_offset(constant.text));
-		printf("\tmov [rbp-%zu], rax\n", lhs->offset);
+		emit2(compiler, OP_LEA, reg(REG_RAX), string_address(constant.text));
+		emit2(compiler, OP_MOV, stack(lhs->offset), reg(REG_RAX));
 		return true;
 	}
 
@@ -1157,12 +5668,64 @@ bool is_operator(enum token_kind kind)
 	return precedense(kind) != 0;
 }
 
-void emit_op(struct compiler *compiler, struct value *result, struct value lhsv, enum token_kind op, struct value rhsv, size_t end_label)
+// Left side of && and || is tested directly on flags when possible:
+//   a < b && c      ; result = a < b ? c : 0
+//   cmp rax, rdx
+//   mov [result], 0
+//   jge .false      ; patched when the whole condition is materialized or branched on
+// Right side is finished by emit_op which leaves the result as pending condition.
+struct pending_condition begin_logical(struct compiler *compiler, enum token_kind op, struct value lhs)
+{
+	bool is_and = op == TOK_LOGICAL_AND;
+	struct pending_condition cond;
+
+	if (compiler->condition.active && lhs.kind == RVALUE && compiler->condition.offset == lhs.offset) {
+		cond = take_condition(compiler);
+		if (!cond.stored) {
+			emit2(compiler, OP_MOV, qword(stack(cond.offset)), imm(!is_and));
+		}
+	} else {
+		size_t res = alloc_stack(compiler);
+		mov_into_reg(compiler, REG_RAX, lhs);
+		emit2(compiler, OP_MOV, stack(res), reg(REG_RAX));
+		emit2(compiler, OP_TEST, reg(REG_RAX), reg(REG_RAX));
+		cond = (struct pending_condition) { .active = true, .offset = res, .cc = CC_NE, .stored = true };
+	}
+
+	if (is_and) {
+		emit_pending_jcc(compiler, invert_condition(cond.cc), &cond.false_jumps);
+		land_jumps(compiler, &cond.true_jumps);
+	} else {
+		emit_pending_jcc(compiler, cond.cc, &cond.true_jumps);
+		land_jumps(compiler, &cond.false_jumps);
+	}
+	return cond;
+}
+
+void emit_op(struct compiler *compiler, struct value *result, struct value lhsv, enum token_kind op, struct value rhsv, size_t end_label, struct pending_condition *logical)
 {
-	if (op == TOK_LOGICAL_OR || op == TOK_LOGICAL_AND || op == TOK_QUESTION_MARK) {
-		mov_into_reg("rax", rhsv);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
-		printf(".local_%zu:\n", end_label);
+	if (op == TOK_LOGICAL_OR || op == TOK_LOGICAL_AND) {
+		struct pending_condition *rhs = &compiler->condition;
+		if (rhs->active && rhsv.kind == RVALUE && rhs->offset == rhsv.offset && !rhs->stored
+		&& rhs->true_jumps.count == 0 && rhs->false_jumps.count == 0) {
+			logical->cc = take_condition(compiler).cc;
+			logical->stored = false;
+		} else {
+			mov_into_reg(compiler, REG_RAX, rhsv);
+			emit2(compiler, OP_MOV, stack(logical->offset), reg(REG_RAX));
+			emit2(compiler, OP_TEST, reg(REG_RAX), reg(REG_RAX));
+			logical->cc = CC_NE;
+			logical->stored = true;
+		}
+		compiler->condition = *logical;
+		*result = (struct value) { .kind = RVALUE, .offset = logical->offset };
+		return;
+	}
+
+	if (op == TOK_QUESTION_MARK) {
+		mov_into_reg(compiler, REG_RAX, rhsv);
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
+		emit_label(compiler, local_label(end_label));
 		return;
 	}
 
@@ -1173,11 +5736,17 @@ void emit_op(struct compiler *compiler, struct value *result, struct value lhsv,
 
 	switch (op) {
 	case TOK_ASSIGN:
-		mov_into_reg("rax", rhsv);
+		mov_into_reg(compiler, REG_RAX, rhsv);
 		switch (lhsv.kind) {
-		case LVALUE_AUTO: printf("\tmov [rbp-%zu], rax\n", lhsv.offset); break;
-		case LVALUE_PTR:  printf("\tmov rcx, [rbp-%zu]\n"
-													   "\tmov [rcx], rax\n", lhsv.offset); break;
+		case LVALUE_AUTO: emit2(compiler, OP_MOV, stack(lhsv.offset), reg(REG_RAX)); break;
+		case LVALUE_PTR:
+			emit2(compiler, OP_MOV, reg(REG_RCX), stack(lhsv.offset));
+			emit2(compiler, OP_MOV, deref(REG_RCX), reg(REG_RAX));
+			break;
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			emit2(compiler, OP_MOV, global_location(compiler, lhsv, REG_RCX), reg(REG_RAX));
+			break;
 		case RVALUE:
 			// TODO: Line information
 			errorf((struct token){}, "trying to assign to rvalue\n");
@@ -1195,29 +5764,35 @@ void emit_op(struct compiler *compiler, struct value *result, struct value lhsv,
 	case TOK_ASSIGN_SHIFT_LEFT:
 	case TOK_ASSIGN_SHIFT_RIGHT:
 	case TOK_ASSIGN_OR:
-		mov_into_reg("rax", lhsv);
-		mov_into_reg("rcx", rhsv);
+		mov_into_reg(compiler, REG_RAX, lhsv);
+		mov_into_reg(compiler, REG_RCX, rhsv);
 
 		switch (op) {
-		case TOK_ASSIGN_MUL: printf("\timul rax, rcx\n"); break;
-		case TOK_ASSIGN_ADD: printf("\tadd rax, rcx\n"); break;
-		case TOK_ASSIGN_SUB: printf("\tsub rax, rcx\n"); break;
-		case TOK_ASSIGN_SHIFT_LEFT: printf("\tshl rax, cl\n"); break;
-		case TOK_ASSIGN_SHIFT_RIGHT: printf("\tshr rax, cl\n"); break;
-		case TOK_ASSIGN_OR: printf("\tor rax, rcx\n"); break;
-		case TOK_ASSIGN_AND: printf("\tand rax, rcx\n"); break;
+		case TOK_ASSIGN_MUL: emit2(compiler, OP_IMUL, reg(REG_RAX), reg(REG_RCX)); break;
+		case TOK_ASSIGN_ADD: emit2(compiler, OP_ADD, reg(REG_RAX), reg(REG_RCX)); break;
+		case TOK_ASSIGN_SUB: emit2(compiler, OP_SUB, reg(REG_RAX), reg(REG_RCX)); break;
+		case TOK_ASSIGN_SHIFT_LEFT: emit2(compiler, OP_SHL, reg(REG_RAX), reg8(REG_RCX)); break;
+		case TOK_ASSIGN_SHIFT_RIGHT: emit2(compiler, OP_SHR, reg(REG_RAX), reg8(REG_RCX)); break;
+		case TOK_ASSIGN_OR: emit2(compiler, OP_OR, reg(REG_RAX), reg(REG_RCX)); break;
+		case TOK_ASSIGN_AND: emit2(compiler, OP_AND, reg(REG_RAX), reg(REG_RCX)); break;
 		case TOK_ASSIGN_DIV:
-			printf("\tcqo\n");
-			printf("\tidiv QWORD rcx\n");
+			emit0(compiler, OP_CQO);
+			emit1(compiler, OP_IDIV, reg(REG_RCX));
 			break;
 		default:
 			assert(0 && "unreachable");
 		}
 
 		switch (lhsv.kind) {
-		case LVALUE_AUTO: printf("\tmov [rbp-%zu], rax\n", lhsv.offset); break;
-		case LVALUE_PTR:  printf("\tmov rcx, [rbp-%zu]\n"
-													   "\tmov [rcx], rax\n", lhsv.offset); break;
+		case LVALUE_AUTO: emit2(compiler, OP_MOV, stack(lhsv.offset), reg(REG_RAX)); break;
+		case LVALUE_PTR:
+			emit2(compiler, OP_MOV, reg(REG_RCX), stack(lhsv.offset));
+			emit2(compiler, OP_MOV, deref(REG_RCX), reg(REG_RAX));
+			break;
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			emit2(compiler, OP_MOV, global_location(compiler, lhsv, REG_RCX), reg(REG_RAX));
+			break;
 		case RVALUE:
 			// TODO: Line information
 			errorf((struct token){}, "trying to assign to rvalue\n");
@@ -1235,19 +5810,19 @@ void emit_op(struct compiler *compiler, struct value *result, struct value lhsv,
 	case TOK_AND:
 	case TOK_XOR:
 		{
-			static char const* BIN_INSTR[] = {
-				[TOK_AND] = "and",
-				[TOK_ASTERISK] = "imul",
-				[TOK_MINUS] = "sub",
-				[TOK_OR] = "or",
-				[TOK_PLUS] = "add",
-				[TOK_XOR] = "xor",
+			static enum opcode const BIN_INSTR[] = {
+				[TOK_AND] = OP_AND,
+				[TOK_ASTERISK] = OP_IMUL,
+				[TOK_MINUS] = OP_SUB,
+				[TOK_OR] = OP_OR,
+				[TOK_PLUS] = OP_ADD,
+				[TOK_XOR] = OP_XOR,
 			};
 			// TODO: We can optimize this (remove one move, add accepts memory as argument)
-			mov_into_reg("rax", lhsv);
-			mov_into_reg("rcx", rhsv);
-			printf("\t%s rax, rcx\n", BIN_INSTR[op]);
-			printf("\tmov [rbp-%zu], rax\n", res);
+			mov_into_reg(compiler, REG_RAX, lhsv);
+			mov_into_reg(compiler, REG_RCX, rhsv);
+			emit2(compiler, BIN_INSTR[op], reg(REG_RAX), reg(REG_RCX));
+			emit2(compiler, OP_MOV, stack(res), reg(REG_RAX));
 			return;
 		}
 
@@ -1255,19 +5830,19 @@ void emit_op(struct compiler *compiler, struct value *result, struct value lhsv,
 	// TODO: We can optimize this (remove one move, add accepts memory as argument)
 	// TODO: Proof that this is correct
 	case TOK_SHIFT_LEFT:
-		mov_into_reg("rax", lhsv);
-		mov_into_reg("rcx", rhsv);
-		printf("\tshl rax, cl\n");
-		printf("\tmov [rbp-%zu], rax\n", res);
+		mov_into_reg(compiler, REG_RAX, lhsv);
+		mov_into_reg(compiler, REG_RCX, rhsv);
+		emit2(compiler, OP_SHL, reg(REG_RAX), reg8(REG_RCX));
+		emit2(compiler, OP_MOV, stack(res), reg(REG_RAX));
 		return;
 
 	// TODO: We can optimize this (remove one move, add accepts memory as argument)
 	// TODO: Proof that this is correct
 	case TOK_SHIFT_RIGHT:
-		mov_into_reg("rax", lhsv);
-		mov_into_reg("rcx", rhsv);
-		printf("\tshr rax, cl\n");
-		printf("\tmov [rbp-%zu], rax\n", res);
+		mov_into_reg(compiler, REG_RAX, lhsv);
+		mov_into_reg(compiler, REG_RCX, rhsv);
+		emit2(compiler, OP_SHR, reg(REG_RAX), reg8(REG_RCX));
+		emit2(compiler, OP_MOV, stack(res), reg(REG_RAX));
 		return;
 
 
@@ -1278,30 +5853,29 @@ void emit_op(struct compiler *compiler, struct value *result, struct value lhsv,
 	case TOK_LESS_OR_EQ:
 	case TOK_NOT_EQUAL:
 		{
-			static char const* SET_SUFFIX[] = {
-				[TOK_EQUAL] = "e",
-				[TOK_GREATER] = "g",
-				[TOK_GREATER_OR_EQ] = "ge",
-				[TOK_LESS] = "l",
-				[TOK_LESS_OR_EQ] = "le",
-				[TOK_NOT_EQUAL] = "ne",
+			static enum condition const SET_CONDITION[] = {
+				[TOK_EQUAL] = CC_E,
+				[TOK_GREATER] = CC_G,
+				[TOK_GREATER_OR_EQ] = CC_GE,
+				[TOK_LESS] = CC_L,
+				[TOK_LESS_OR_EQ] = CC_LE,
+				[TOK_NOT_EQUAL] = CC_NE,
 			};
-			printf("\txor rcx, rcx\n");
-			mov_into_reg("rax", lhsv);
-			mov_into_reg("rdx", rhsv);
-			printf("\tcmp rax, rdx\n");
-			printf("\tset%s cl\n", SET_SUFFIX[op]);
-			printf("\tmov [rbp-%zu], rcx\n", res);
+			mov_into_reg(compiler, REG_RAX, lhsv);
+			mov_into_reg(compiler, REG_RDX, rhsv);
+			emit2(compiler, OP_CMP, reg(REG_RAX), reg(REG_RDX));
+			// Value is stored only when it's needed, branches use flags directly
+			compiler->condition = (struct pending_condition) { .active = true, .offset = res, .cc = SET_CONDITION[op] };
 			return;
 		}
 
 	case TOK_DIV:
 	case TOK_PERCENT:
-		mov_into_reg("rax", lhsv);
-		mov_into_reg("rcx", rhsv);
-		printf("\tcqo\n");
-		printf("\tidiv QWORD rcx\n");
-		printf("\tmov [rbp-%zu], %s\n", res, op == TOK_DIV ? "rax" : "rdx");
+		mov_into_reg(compiler, REG_RAX, lhsv);
+		mov_into_reg(compiler, REG_RCX, rhsv);
+		emit0(compiler, OP_CQO);
+		emit1(compiler, OP_IDIV, reg(REG_RCX));
+		emit2(compiler, OP_MOV, stack(res), reg(op == TOK_DIV ? REG_RAX : REG_RDX));
 		return;
 
 
@@ -1316,7 +5890,10 @@ void parse_rhs(struct parser *p, struct compiler *compiler, struct token op, str
 	// Infrastructure for ternary:
 	// result = condition ? then : else
 	struct value condition, then;
-	size_t else_label, end_label;
+	size_t else_label, end_label = 0;
+
+	// Infrastructure for && and ||, see begin_logical
+	struct pending_condition logical = {};
 
 	if (op.kind == TOK_QUESTION_MARK) {
 		else_label = compiler->last_local_id++;
@@ -1326,41 +5903,26 @@ void parse_rhs(struct parser *p, struct compiler *compiler, struct token op, str
 		// TODO: if both then and else branches are lvalues we can return an lvalue
 		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
 
-		mov_into_reg("rax", condition);
-		printf("\tcmp rax, 0\n");
-		printf("\tje .local_%zu\n", else_label);
+		jump_if_false(compiler, condition, else_label);
 
 		if (!parse_expression(p, compiler, &then)) {
 			errorf(op, "expected expression between ? and : of ternary operator\n");
 			exit(1);
 		}
 
-		mov_into_reg("rax", then);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
-		printf("\tjmp .local_%zu\n", end_label);
-		printf(".local_%zu:\n", else_label);
+		mov_into_reg(compiler, REG_RAX, then);
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
+		emit1(compiler, OP_JMP, local_label(end_label));
+		emit_label(compiler, local_label(else_label));
 
 		struct token colon;
 		if (!expect_token(p, &colon, TOK_COLON)) {
 			errorf(colon, "expected : after expression started with ?, got %s instead\n", token_short_name(colon));
 			exit(1);
 		}
-	} else if (op.kind == TOK_LOGICAL_AND) {
-		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		end_label = compiler->last_local_id++;
-		condition = lhs;
-		mov_into_reg("rax", condition);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
-		printf("\tcmp rax, 0\n");
-		printf("\tje .local_%zu\n", end_label);
-	} else if (op.kind == TOK_LOGICAL_OR) {
-		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		end_label = compiler->last_local_id++;
-		condition = lhs;
-		mov_into_reg("rax", condition);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
-		printf("\tcmp rax, 0\n");
-		printf("\tjne .local_%zu\n", end_label);
+	} else if (op.kind == TOK_LOGICAL_AND || op.kind == TOK_LOGICAL_OR) {
+		logical = begin_logical(compiler, op.kind, lhs);
+		*result = (struct value) { .kind = RVALUE, .offset = logical.offset };
 	}
 
 	// TODO: See if we can get away without allocating this varibale
@@ -1374,7 +5936,7 @@ void parse_rhs(struct parser *p, struct compiler *compiler, struct token op, str
 
 	struct token next;
 	if (!expect_token_if(p, &next, is_operator)) {
-		emit_op(compiler, result, lhs, op.kind, rhs, end_label);
+		emit_op(compiler, result, lhs, op.kind, rhs, end_label, &logical);
 		return;
 	}
 
@@ -1395,12 +5957,12 @@ void parse_rhs(struct parser *p, struct compiler *compiler, struct token op, str
 
 	if (bind_left) {
 		assert(op.kind != TOK_QUESTION_MARK && "is there ever situation where we bind left?");
-		emit_op(compiler, result, lhs, op.kind, rhs, end_label);
+		emit_op(compiler, result, lhs, op.kind, rhs, end_label, &logical);
 		parse_rhs(p, compiler, next, result, *result);
 	} else {
 		struct value rhs_result;
 		parse_rhs(p, compiler, next, &rhs_result, rhs);
-		emit_op(compiler, result, lhs, op.kind, rhs_result, end_label);
+		emit_op(compiler, result, lhs, op.kind, rhs_result, end_label, &logical);
 	}
 }
 
@@ -1463,26 +6025,21 @@ bool parse_atomic(struct parser *p, struct compiler *compiler, struct value *lhs
 
 	case LOCAL_VECTOR:
 		*lhs = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		printf("\tlea rax, [rbp-%zu]\n", symbol->offset);
-		printf("\tmov [rbp-%zu], rax\n", lhs->offset);
+		emit2(compiler, OP_LEA, reg(REG_RAX), stack(symbol->offset));
+		emit2(compiler, OP_MOV, stack(lhs->offset), reg(REG_RAX));
 		return true;
 
 	case GLOBAL:
-		*lhs = (struct value) { .kind = LVALUE_PTR, .offset = alloc_stack(compiler) };
-		printf("\tlea rax, [sym_%zu]\n", symbol->id);
-		printf("\tmov [rbp-%zu], rax\n", lhs->offset);
+		*lhs = (struct value) { .kind = LVALUE_GLOBAL, .id = symbol->id };
 		return true;
 
 	case EXTERNAL:
-		*lhs = (struct value) { .kind = LVALUE_PTR, .offset = alloc_stack(compiler) };
-		/* For values: printf("\tlea rax, [%s]\n", symbol->name);
-		 * For funcs:  printf("\tlea rax, [%s wrt ..plt]\n", symbol->name);
+		/* Address of both values and functions is taken from GOT, since we don't know which one it is.
 		 *
 		 * _If_ we would write a custom linker that would know if symbol is a function or a value the integration would be seemles.
 		 * Now we either need custom address of operator for functions or introduction of function extrn and value extrn which feels like violation of B spirit.
 		 * To put this simply, B is less compatible with modern x86_64 then I thought */
-		printf("\tlea rax, [%s]\n", symbol->name);
-		printf("\tmov [rbp-%zu], rax\n", lhs->offset);
+		*lhs = (struct value) { .kind = LVALUE_EXTERN, .name = symbol->name };
 		return true;
 	}
 
@@ -1506,10 +6063,10 @@ bool parse_primary_expression(struct parser *p, struct compiler *compiler, struc
 		}
 
 		*result = (struct value) { .kind = LVALUE_PTR, .offset = alloc_stack(compiler) };
-		mov_into_reg("rax", lhs);
-		mov_into_reg("rcx", index);
-		printf("\tlea rax, [rax+rcx*8]\n");
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
+		mov_into_reg(compiler, REG_RAX, lhs);
+		mov_into_reg(compiler, REG_RCX, index);
+		emit2(compiler, OP_LEA, reg(REG_RAX), indexed(REG_RAX, REG_RCX, 8));
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 
 		struct token close;
 		if (!expect_token(p, &close, ']')) {
@@ -1522,17 +6079,22 @@ bool parse_primary_expression(struct parser *p, struct compiler *compiler, struc
 	struct token post_inc;
 	if (expect_token(p, &post_inc, TOK_INCREMENT)) {
 		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		mov_into_reg("rax", lhs);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
+		mov_into_reg(compiler, REG_RAX, lhs);
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 
 		switch (lhs.kind) {
 		case LVALUE_AUTO:
-			printf("\tinc QWORD [rbp-%zu]\n", lhs.offset);
+			emit1(compiler, OP_INC, qword(stack(lhs.offset)));
 			break;
 
 		case LVALUE_PTR:
-			printf("\tmov rax, [rbp-%zu]\n", lhs.offset);
-			printf("\tinc QWORD [rax]\n");
+			emit2(compiler, OP_MOV, reg(REG_RAX), stack(lhs.offset));
+			emit1(compiler, OP_INC, qword(deref(REG_RAX)));
+			break;
+
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			emit1(compiler, OP_INC, qword(global_location(compiler, lhs, REG_RAX)));
 			break;
 
 		default:
@@ -1544,17 +6106,22 @@ bool parse_primary_expression(struct parser *p, struct compiler *compiler, struc
 	struct token post_dec;
 	if (expect_token(p, &post_dec, TOK_DECREMENT)) {
 		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		mov_into_reg("rax", lhs);
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
+		mov_into_reg(compiler, REG_RAX, lhs);
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 
 		switch (lhs.kind) {
 		case LVALUE_AUTO:
-			printf("\tdec QWORD [rbp-%zu]\n", lhs.offset);
+			emit1(compiler, OP_DEC, qword(stack(lhs.offset)));
 			break;
 
 		case LVALUE_PTR:
-			printf("\tmov rax, [rbp-%zu]\n", lhs.offset);
-			printf("\tdec QWORD [rax]\n");
+			emit2(compiler, OP_MOV, reg(REG_RAX), stack(lhs.offset));
+			emit1(compiler, OP_DEC, qword(deref(REG_RAX)));
+			break;
+
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			emit1(compiler, OP_DEC, qword(global_location(compiler, lhs, REG_RAX)));
 			break;
 
 		default:
@@ -1583,8 +6150,20 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 
 		case LVALUE_AUTO:
 			*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-			printf("\tlea rax, [rbp-%zu]\n", val.offset);
-			printf("\tmov [rbp-%zu], rax\n", result->offset);
+			emit2(compiler, OP_LEA, reg(REG_RAX), stack(val.offset));
+			emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
+			return true;
+
+		case LVALUE_GLOBAL:
+			*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
+			emit2(compiler, OP_LEA, reg(REG_RAX), symbol_address(val.id));
+			emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
+			return true;
+
+		case LVALUE_EXTERN:
+			*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
+			load_extern_address(compiler, REG_RAX, val.name);
+			emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 			return true;
 
 		case RVALUE:
@@ -1604,9 +6183,9 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 			exit(1);
 		}
 		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		mov_into_reg("rax", val);
-		printf("\tnot rax\n");
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
+		mov_into_reg(compiler, REG_RAX, val);
+		emit1(compiler, OP_NOT, reg(REG_RAX));
+		emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 		return true;
 	}
 
@@ -1617,12 +6196,17 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 			errorf(lnot, "expected primary expression for logicla not operator\n");
 			exit(1);
 		}
+		struct pending_condition *cond = &compiler->condition;
+		if (cond->active && val.kind == RVALUE && cond->offset == val.offset && !cond->stored
+		&& cond->true_jumps.count == 0 && cond->false_jumps.count == 0) {
+			cond->cc = invert_condition(cond->cc);
+			*result = val;
+			return true;
+		}
 		*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-		mov_into_reg("rcx", val);
-		printf("\txor rax, rax\n");
-		printf("\ttest rcx, rcx\n");
-		printf("\tsete al\n");
-		printf("\tmov [rbp-%zu], rax\n", result->offset);
+		mov_into_reg(compiler, REG_RAX, val);
+		emit2(compiler, OP_TEST, reg(REG_RAX), reg(REG_RAX));
+		compiler->condition = (struct pending_condition) { .active = true, .offset = result->offset, .cc = CC_E };
 		return true;
 	}
 
@@ -1637,13 +6221,19 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 		switch (val.kind) {
 		case LVALUE_AUTO:
 			*result = val;
-			printf("\tinc QWORD [rbp-%zu]\n", val.offset);
+			emit1(compiler, OP_INC, qword(stack(val.offset)));
 			break;
 
 		case LVALUE_PTR:
 			*result = val;
-			printf("\tmov rax, [rbp-%zu]\n", val.offset);
-			printf("\tinc QWORD [rax]\n");
+			emit2(compiler, OP_MOV, reg(REG_RAX), stack(val.offset));
+			emit1(compiler, OP_INC, qword(deref(REG_RAX)));
+			break;
+
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			*result = val;
+			emit1(compiler, OP_INC, qword(global_location(compiler, val, REG_RAX)));
 			break;
 
 		default:
@@ -1664,13 +6254,19 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 		switch (val.kind) {
 		case LVALUE_AUTO:
 			*result = val;
-			printf("\tdec QWORD [rbp-%zu]\n", val.offset);
+			emit1(compiler, OP_DEC, qword(stack(val.offset)));
 			break;
 
 		case LVALUE_PTR:
 			*result = val;
-			printf("\tmov rax, [rbp-%zu]\n", val.offset);
-			printf("\tdec QWORD [rax]\n");
+			emit2(compiler, OP_MOV, reg(REG_RAX), stack(val.offset));
+			emit1(compiler, OP_DEC, qword(deref(REG_RAX)));
+			break;
+
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			*result = val;
+			emit1(compiler, OP_DEC, qword(global_location(compiler, val, REG_RAX)));
 			break;
 
 		default:
@@ -1695,7 +6291,13 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 			*result = (struct value) { .kind = LVALUE_PTR, .offset = val.offset };
 			break;
 
-		NOT_IMPLEMENTED_FOR(LVALUE_PTR);
+		case LVALUE_PTR:
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			*result = (struct value) { .kind = LVALUE_PTR, .offset = alloc_stack(compiler) };
+			mov_into_reg(compiler, REG_RAX, val);
+			emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
+			break;
 
 		case EMPTY: assert(0 && "unreachable");
 		}
@@ -1713,15 +6315,17 @@ bool parse_unary(struct parser *p, struct compiler *compiler, struct value *resu
 		switch (val.kind) {
 		case RVALUE:
 		case LVALUE_AUTO:
-			printf("\tneg QWORD [rbp-%zu]\n", val.offset);
+			emit1(compiler, OP_NEG, qword(stack(val.offset)));
 			*result = val;
 			return true;
 
 		case LVALUE_PTR:
-			mov_into_reg("rax", val);
-			printf("\tneg rax\n");
+		case LVALUE_GLOBAL:
+		case LVALUE_EXTERN:
+			mov_into_reg(compiler, REG_RAX, val);
+			emit1(compiler, OP_NEG, reg(REG_RAX));
 			*result = (struct value) { .kind = RVALUE, .offset = alloc_stack(compiler) };
-			printf("\tmov [rbp-%zu], rax\n", result->offset);
+			emit2(compiler, OP_MOV, stack(result->offset), reg(REG_RAX));
 			return true;
 
 		NOT_IMPLEMENTED_FOR(EMPTY);
@@ -1740,6 +6344,97 @@ bool parse_expression(struct parser *p, struct compiler *compiler, struct value
 	return false;
 }
 
+// Moves code[begin..count) before code[at]
+void move_code(struct compiler *compiler, size_t begin, size_t at)
+{
+	struct instruction *code = compiler->code.items;
+	size_t n = compiler->code.count - begin;
+	struct instruction *moved = malloc(n * sizeof(*code));
+	memcpy(moved, &code[begin], n * sizeof(*code));
+	memmove(&code[at + n], &code[at], (begin - at) * sizeof(*code));
+	memcpy(&code[at], moved, n * sizeof(*code));
+	free(moved);
+}
+
+bool inside_loop(struct compiler *compiler)
+{
+	for (size_t i = 0; i < compiler->control.count; ++i) {
+		if (compiler->control.items[i].kind == TOK_WHILE) return true;
+	}
+	return false;
+}
+
+// Makes the arm code[begin..end) that follows the conditional jump of if statement the
+// target of the jump with inverted condition, so the other path becomes fallthrough.
+// Outside of loops the arm goes after the end of the function. Inside of them it goes
+// after the else arm, since jumps into the loop from outside would keep the loop from
+// being optimized. Code of the arm has to end with jump to where the paths join.
+void move_cold_arm(struct compiler *compiler, size_t jump, size_t begin, size_t end, size_t label, size_t join)
+{
+	if (compiler->condition.active) {
+		materialize_condition(compiler);
+	}
+	struct instruction *jcc = &compiler->code.items[jump];
+	assert(jcc->op == OP_JCC);
+	jcc->cc = invert_condition(jcc->cc);
+	jcc->dst = local_label(label);
+
+	struct instruction start = { .op = OP_LABEL, .dst = local_label(label) };
+	if (inside_loop(compiler)) {
+		insert_instruction(compiler, begin, start);
+		emit1(compiler, OP_JMP, local_label(join));
+		move_code(compiler, end + 1, begin);
+		return;
+	}
+
+	da_append(&compiler->cold, start);
+	for (size_t i = begin; i < end; ++i) {
+		da_append(&compiler->cold, compiler->code.items[i]);
+	}
+	struct instruction *code = compiler->code.items;
+	memmove(&code[begin], &code[end], (compiler->code.count - end) * sizeof(*code));
+	compiler->code.count -= end - begin;
+}
+
+// Cases that took at least 1/8 of executions of the switch are tested (hottest first)
+// before the chain of tests in the order of cases
+void hoist_hot_cases(struct compiler *compiler, struct control const* info, size_t dispatch)
+{
+	struct switch_case *cases = &compiler->cases.items[info->cases];
+	size_t count = compiler->cases.count - info->cases;
+	int64_t total = 0;
+	for (size_t i = 0; i < count; ++i) {
+		int64_t c = profile_count(current_function, cases[i].body);
+		if (c > 0) total += c;
+	}
+	if (total == 0) {
+		return;
+	}
+
+	size_t begin = compiler->code.count;
+	for (size_t hoisted = 0; hoisted < 4; ++hoisted) {
+		struct switch_case *hottest = NULL;
+		int64_t hottest_count = 0;
+		for (size_t i = 0; i < count; ++i) {
+			int64_t c = profile_count(current_function, cases[i].body);
+			if (cases[i].literal && cases[i].value == (int32_t)cases[i].value && c > hottest_count) {
+				hottest = &cases[i];
+				hottest_count = c;
+			}
+		}
+		if (!hottest || hottest_count * 8 < total) {
+			break;
+		}
+		if (compiler->code.count == begin) {
+			mov_into_reg(compiler, REG_RAX, info->lhs);
+		}
+		emit2(compiler, OP_CMP, reg(REG_RAX), imm(hottest->value));
+		emit_jcc(compiler, CC_E, local_label(hottest->body));
+		hottest->literal = false;
+	}
+	move_code(compiler, begin, dispatch);
+}
+
 bool parse_switch(struct parser *p, struct compiler *compiler)
 {
 	struct token switch_;
@@ -1773,9 +6468,11 @@ bool parse_switch(struct parser *p, struct compiler *compiler)
 	info.lhs = lhs;
 	info.next = compiler->last_local_id++;
 	info.end = compiler->last_local_id++;
+	info.cases = compiler->cases.count;
 	da_append(&compiler->control, info);
 
-	printf("\tjmp .local_%zu\n", info.next);
+	size_t dispatch = compiler->code.count;
+	emit1(compiler, OP_JMP, local_label(info.next));
 
 	if (!parse_statement(p, compiler)) {
 		errorf(close, "expected statement after switch\n");
@@ -1783,10 +6480,14 @@ bool parse_switch(struct parser *p, struct compiler *compiler)
 	}
 
 	assert(da_back(compiler->control).kind == TOK_SWITCH);
-	printf(".local_%zu:\n", da_back(compiler->control).next);
-	printf(".local_%zu:\n", da_back(compiler->control).end);
+	emit_label(compiler, local_label(da_back(compiler->control).next));
+	emit_label(compiler, local_label(da_back(compiler->control).end));
+	if (profile_counts.count) {
+		hoist_hot_cases(compiler, &da_back(compiler->control), dispatch);
+	}
 
 	leave_scope(compiler);
+	compiler->cases.count = da_back(compiler->control).cases;
 	compiler->control.count--;
 
 	return true;
@@ -1813,7 +6514,22 @@ bool parse_while(struct parser *p, struct compiler *compiler)
 	info.end = compiler->last_local_id++;
 	da_append(&compiler->control, info);
 
-	printf(".local_%zu:\n", info.next);
+	// With optimizations loops are rotated, so that each iteration executes only
+	// one conditional jump at the bottom:
+	//     cond; j!cc .end
+	//   .body:
+	//     body
+	//   .next:
+	//     cond; jcc .body
+	//   .end:
+	bool rotate = optimizations_enabled;
+	size_t body = compiler->last_local_id++;
+
+	if (!rotate) {
+		emit_label(compiler, local_label(info.next));
+	}
+
+	size_t test_begin = compiler->code.count;
 
 	struct value cond;
 	if (!parse_expression(p, compiler, &cond)) {
@@ -1821,9 +6537,9 @@ bool parse_while(struct parser *p, struct compiler *compiler)
 		exit(2);
 	}
 
-	mov_into_reg("rax", cond);
-	printf("\tcmp rax, 0\n");
-	printf("\tje .local_%zu\n", info.end);
+	size_t test_jump = jump_if_false(compiler, cond, info.end);
+	size_t test_end = compiler->code.count;
+	emit_label(compiler, local_label(body));
 
 	struct token close;
 	if (!expect_token(p, &close, TOK_PAREN_CLOSE)) {
@@ -1837,9 +6553,14 @@ bool parse_while(struct parser *p, struct compiler *compiler)
 		exit(2);
 	}
 	leave_scope(compiler);
-	printf("\tjmp .local_%zu\n", info.next);
-	printf(".local_%zu:\n", info.end);
-
+	if (rotate) {
+		emit_label(compiler, local_label(info.next));
+		emit_loop_test(compiler, test_begin, test_jump, test_end, body);
+	} else {
+		emit1(compiler, OP_JMP, local_label(info.next));
+	}
+	emit_label(compiler, local_label(info.end));
+	compiler->control.count--;
 
 	return true;
 }
@@ -1861,6 +6582,8 @@ bool parse_if(struct parser *p, struct compiler *compiler)
 
 	size_t else_label = compiler->last_local_id++;
 	size_t fi_label = compiler->last_local_id++;
+	// Counted with -finstrument=blocks, labels have to be the same in builds using the profile
+	size_t then_label = compiler->last_local_id++;
 
 	struct value cond;
 	if (!parse_expression(p, compiler, &cond)) {
@@ -1869,9 +6592,7 @@ bool parse_if(struct parser *p, struct compiler *compiler)
 	}
 
 	assert(cond.kind != EMPTY);
-	mov_into_reg("rax", cond);
-	printf("\tcmp rax, 0\n");
-	printf("\tje .local_%zu\n", else_label);
+	size_t jump = jump_if_false(compiler, cond, else_label);
 
 	struct token close;
 	if (!expect_token(p, &close, TOK_PAREN_CLOSE)) {
@@ -1880,20 +6601,32 @@ bool parse_if(struct parser *p, struct compiler *compiler)
 		exit(2);
 	}
 
+	if (instrument == INSTRUMENT_BLOCKS) {
+		emit_label(compiler, local_label(then_label));
+	}
+
 	if (!parse_statement(p, compiler)) {
 		errorf(close, "expected statement after if\n");
 		exit(2);
 	}
 
+	int64_t taken = profile_count(current_function, then_label);
+
 	struct token else_;
 	if (!expect_token(p, &else_, TOK_ELSE)) {
 		leave_scope(compiler);
-		printf(".local_%zu:\n", else_label);
+		// Label after the if counts both the taken and the skipped arm
+		if (taken >= 0 && 2 * taken < profile_count(current_function, else_label)) {
+			emit1(compiler, OP_JMP, local_label(else_label));
+			move_cold_arm(compiler, jump, jump + 1, compiler->code.count, then_label, else_label);
+		}
+		emit_label(compiler, local_label(else_label));
 		return true;
 	}
 
-	printf("\tjmp .local_%zu\n", fi_label);
-	printf(".local_%zu:\n", else_label);
+	emit1(compiler, OP_JMP, local_label(fi_label));
+	size_t else_begin = compiler->code.count;
+	emit_label(compiler, local_label(else_label));
 
 	if (!parse_statement(p, compiler)) {
 		errorf(else_, "expected statement after else\n");
@@ -1901,7 +6634,10 @@ bool parse_if(struct parser *p, struct compiler *compiler)
 	}
 
 	leave_scope(compiler);
-	printf(".local_%zu:\n", fi_label);
+	if (taken >= 0 && taken < profile_count(current_function, else_label)) {
+		move_cold_arm(compiler, jump, jump + 1, else_begin, then_label, fi_label);
+	}
+	emit_label(compiler, local_label(fi_label));
 	return true;
 }
 
@@ -1917,7 +6653,7 @@ bool parse_break(struct parser *p, struct compiler *compiler)
 		exit(1);
 	}
 
-	printf("\tjmp .local_%zu\n", compiler->control.items[compiler->control.count-1].end);
+	emit1(compiler, OP_JMP, local_label(compiler->control.items[compiler->control.count-1].end));
 	return true;
 }
 
@@ -1943,29 +6679,16 @@ bool parse_continue(struct parser *p, struct compiler *compiler)
 		exit(1);
 	}
 
-	printf("\tjmp .local_%zu\n", while_info->next);
+	emit1(compiler, OP_JMP, local_label(while_info->next));
 	return true;
 }
 
 bool parse_statement(struct parser *p, struct compiler *compiler)
 {
-	// TODO: Add compiler flag that would output this information
-#if 0
-	{
-		printf("\t;");
-		if (p->backlog.kind != TOK_EOF) {
-			dump_location(stdout, p->backlog);
-			char const* d = strchr(p->backlog.p, '\n');
-			fwrite(p->backlog.p, 1, d == NULL ? strlen(p->backlog.p) : d - p->backlog.p, stdout);
-		} else {
-			char const *s = p->tokenizer.source + p->tokenizer.head;
-			dump_location(stdout, (struct token) { .p = s });
-			char const* e = strchr(s, '\n');
-			fwrite(s, 1, e == NULL ? strlen(s) : e - s, stdout);
-		}
-		printf("\n");
+	struct token first = peek_token(p);
+	if (first.p) {
+		compiler->line = source_line(first.p);
 	}
-#endif
 
 	bool done_something;
 	do {
@@ -1992,7 +6715,7 @@ bool parse_statement(struct parser *p, struct compiler *compiler)
 			} else {
 				found->defined = true;
 			}
-			printf(".label_%zu:\n", found - compiler->function_labels.items);
+			emit_label(compiler, user_label(found - compiler->function_labels.items));
 			done_something = true;
 		}
 
@@ -2015,10 +6738,17 @@ bool parse_statement(struct parser *p, struct compiler *compiler)
 				exit(1);
 			}
 
-			printf("\tjmp .local_%zu\n", after_test);
-			printf(".local_%zu:\n", switch_info->next);
+			emit1(compiler, OP_JMP, local_label(after_test));
+			emit_label(compiler, local_label(switch_info->next));
 			switch_info->next = compiler->last_local_id++;
 
+			struct token literal = peek_token(p);
+			da_append(&compiler->cases, ((struct switch_case) {
+				.body = after_test,
+				.literal = literal.kind == TOK_INTEGER || literal.kind == TOK_CHARACTER,
+				.value = literal.ival,
+			}));
+
 			struct value rhs;
 			// TODO: Parsing wrong item here
 			if (!parse_atomic(p, compiler, &rhs)) {
@@ -2026,11 +6756,11 @@ bool parse_statement(struct parser *p, struct compiler *compiler)
 				exit(1);
 			}
 
-			mov_into_reg("rax", switch_info->lhs);
-			mov_into_reg("rcx", rhs);
-			printf("\tcmp rax, rcx\n");
-			printf("\tjne .local_%zu\n", switch_info->next);
-			printf(".local_%zu:\n", after_test);
+			mov_into_reg(compiler, REG_RAX, switch_info->lhs);
+			mov_into_reg(compiler, REG_RCX, rhs);
+			emit2(compiler, OP_CMP, reg(REG_RAX), reg(REG_RCX));
+			emit_jcc(compiler, CC_NE, local_label(switch_info->next));
+			emit_label(compiler, local_label(after_test));
 
 			struct token colon;
 			if (!expect_token(p, &colon, TOK_COLON)) {
@@ -2054,6 +6784,7 @@ bool parse_statement(struct parser *p, struct compiler *compiler)
 	size_t stack_offset = compiler->stack_current_offset;
 
 	if (parse_return(p, compiler) || parse_while(p, compiler) || parse_if(p, compiler) || parse_switch(p, compiler)) {
+		assert(!compiler->condition.active);
 		compiler->stack_current_offset = stack_offset;
 		return true;
 	}
@@ -2066,6 +6797,10 @@ bool parse_statement(struct parser *p, struct compiler *compiler)
 			errorf(semicolon, "expected ; at the end of the statement, got %s\n", token_short_name(semicolon));
 			exit(2);
 		}
+		// Slot of the pending condition may be reused by the next statement
+		if (compiler->condition.active) {
+			materialize_condition(compiler);
+		}
 		compiler->stack_current_offset = stack_offset;
 		return true;
 	}
@@ -2086,16 +6821,12 @@ bool parse_function_definition(struct parser *p, struct compiler *compiler, stru
 	struct symbol fun = define_symbol(compiler, ((struct symbol) { .kind = GLOBAL, .name = name.text, .definition = name }), name);
 
 	current_function = name.text;
-
-	// TODO:
-
-	printf("global %s\n", name.text);
-	printf("%s:\n", name.text);
-	printf("sym_%zu:\n", fun.id);
-	printf("\tpush rbp\n");
-	printf("\tmov rbp, rsp\n");
-	printf("\tjmp .alloc_stack\n");
-	printf(".start:\n");
+	size_t line = compiler->line = source_line(name.p);
+	if (instrument) {
+		char *record = malloc(strlen(name.text) + sizeof("__b_profile_"));
+		sprintf(record, "__b_profile_%s", name.text);
+		compiler->profile_record = record;
+	}
 
 	enter_scope(compiler);
 
@@ -2129,7 +6860,7 @@ bool parse_function_definition(struct parser *p, struct compiler *compiler, stru
 			.definition = arg,
 			}),
 			arg);
-		printf("\tmov [rbp-%zu], %s\n", arg_sym.offset, ABI_REGISTERS[i]);
+		emit2(compiler, OP_MOV, stack(arg_sym.offset), reg(ABI_REGISTERS[i]));
 	}
 
 
@@ -2140,16 +6871,20 @@ bool parse_function_definition(struct parser *p, struct compiler *compiler, stru
 	}
 
 	if (strcmp(name.text, "main") == 0) {
-		printf("\txor rax, rax\n");
+		emit2(compiler, OP_XOR, reg(REG_RAX), reg(REG_RAX));
 	}
 
-	printf("\tleave\n");
-	printf("\tret\n");
+	emit0(compiler, OP_LEAVE);
+	emit0(compiler, OP_RET);
+
+	// Cold arms jump back to where they were taken from
+	for (size_t i = 0; i < compiler->cold.count; ++i) {
+		da_append(&compiler->code, compiler->cold.items[i]);
+	}
+	compiler->cold.count = 0;
 
-	// TODO: This is silly
-	printf(".alloc_stack:\n");
-	printf("\tsub rsp, %zu\n", compiler->stack_capacity);
-	printf("\tjmp .start\n");
+	// Frame size is known only after the whole body was compiled
+	flush_function(compiler, name.text, fun.id, line);
 
 	leave_scope(compiler);
 	compiler->stack_capacity = 0;
@@ -2191,7 +6926,7 @@ void parse_definition_value_list(struct parser *p, struct compiler *compiler, st
 
 bool parse_global_variable_definition(struct parser *p, struct compiler *compiler, struct token name)
 {
-	struct token open, close, size;
+	struct token open, close, size = {};
 	struct data data = {};
 
 	if (expect_token(p, &open, '[')) {
@@ -2385,7 +7120,20 @@ int isalnumor_(int c)
 	return c == '_' || isalnum(c);
 }
 
+// Parser backtracks by resetting tokenizer head, so the same token may be scanned many times
 struct token scan(struct tokenizer *ctx)
+{
+	struct token tok;
+	TIMED(scan, tok = scan_token(ctx));
+	++compile_stats.scans;
+	if (ctx->head > compile_stats.furthest) {
+		compile_stats.furthest = ctx->head;
+		++compile_stats.tokens;
+	}
+	return tok;
+}
+
+struct token scan_token(struct tokenizer *ctx)
 {
 	struct token ret = {};
 
@@ -0,0 +1,101 @@
+#!/usr/bin/env bash
+# Times compilation of generated inputs with b and with b built from git revision BASE
+# (HEAD by default, so uncommitted changes are measured) on the same machine.
+# Fails when some input takes TOLERANCE times longer or needs TOLERANCE times more memory.
+# usage: bench/compiler.sh
+
+set -o pipefail
+
+B=${B:-./b}
+BASE=${BASE:-HEAD}
+TOLERANCE=${TOLERANCE:-1.5}
+RUNS=${RUNS:-3}
+CC=${CC:-cc}
+
+# kind and count passed to bench/gen.sh
+CASES=(
+	"functions 2000"
+	"globals 2000"
+	"expressions 300"
+	"strings 200000"
+	"switch 2000"
+)
+
+if [ -n "$1" ]; then
+	1>&2 echo "usage: $0"
+	exit 1
+fi
+
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
+
+if ! git show "${BASE}:b.c" >"${dir}/base.c" || ! ${CC} ${CFLAGS} "${dir}/base.c" -o "${dir}/b-base"; then
+	1>&2 echo "$0: failed to build b of ${BASE}"
+	exit 1
+fi
+
+# Field of --time-report output, like "parse and codegen" (milliseconds of phases) or "lines"
+stat() {
+	awk -v name="$1" '{
+		line = $0
+		sub(/^ +/, "", line)
+		if (match(line, / +[0-9.]+ ms/)) value = substr(line, RSTART, RLENGTH - 3)
+		else if (match(line, / +[0-9]+$/)) value = substr(line, RSTART)
+		else next
+		if (substr(line, 1, RSTART - 1) == name) { print value + 0; exit }
+	}' "$2"
+}
+
+# Best of RUNS of compiler $1 on input $2 into report $3, the least disturbed by other processes
+measure() {
+	local best="" total
+	for ((run = 0; run < RUNS; ++run)); do
+		if ! "$1" --time-report -o /dev/null "$2" 2>"${dir}/report"; then
+			1>&2 echo "$0: $1 failed to compile $2"
+			exit 1
+		fi
+		total=$(stat total "${dir}/report")
+		if [ -z "${best}" ] || awk -v a="${total}" -v b="${best}" 'BEGIN { exit !(a < b) }'; then
+			best="${total}"
+			cp "${dir}/report" "$3"
+		fi
+	done
+}
+
+failed=0
+printf "%-17s %7s %7s %9s %8s %8s %8s %12s %10s %9s %9s %s\n" \
+	case lines tokens parse_ms opt_ms out_ms total_ms tokens/s lines/s rss_KiB base_ms "vs ${BASE}"
+for c in "${CASES[@]}"; do
+	set -- $c
+	input="${dir}/$1.b"
+	bench/gen.sh "$1" "$2" >"${input}" || exit 1
+
+	measure "${B}" "${input}" "${dir}/new"
+	measure "${dir}/b-base" "${input}" "${dir}/base"
+
+	ms=$(stat total "${dir}/new")
+	rss=$(stat "peak rss KiB" "${dir}/new")
+	base_ms=$(stat total "${dir}/base")
+	base_rss=$(stat "peak rss KiB" "${dir}/base")
+
+	# Differences below 10ms are noise of process startup
+	verdict=$(awk -v ms="${ms}" -v rss="${rss}" -v base_ms="${base_ms}" -v base_rss="${base_rss}" -v t="${TOLERANCE}" 'BEGIN {
+		slow = ms > base_ms * t && ms - base_ms > 10
+		big = rss > base_rss * t
+		printf "%.2fx%s%s", ms / (base_ms > 0 ? base_ms : 1), slow ? " SLOWER" : "", big ? " MEMORY" : ""
+	}')
+	case "${verdict}" in *SLOWER*|*MEMORY*) failed=1 ;; esac
+
+	awk -v c="${c}" -v lines="$(stat lines "${dir}/new")" -v tokens="$(stat tokens "${dir}/new")" \
+		-v parse="$(stat "parse and codegen" "${dir}/new")" -v opt="$(stat optimize "${dir}/new")" -v out="$(stat output "${dir}/new")" \
+		-v ms="${ms}" -v rss="${rss}" -v base_ms="${base_ms}" -v verdict="${verdict}" 'BEGIN {
+		s = ms / 1000
+		printf "%-17s %7d %7d %9.1f %8.1f %8.1f %8.1f %12.0f %10.0f %9d %9.1f %s\n", \
+			c, lines, tokens, parse, opt, out, ms, tokens / s, lines / s, rss, base_ms, verdict
+	}'
+done
+
+if [ "${failed}" -ne 0 ]; then
+	1>&2 echo "$0: compile time or memory regressed more than ${TOLERANCE}x against ${BASE}"
+	exit 1
+fi
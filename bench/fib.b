@@ -0,0 +1,9 @@
+/* ops: 2692537 calls */
+fib(n) {
+	if (n < 2) return(n);
+	return(fib(n - 1) + fib(n - 2));
+}
+
+main() extrn printf; {
+	printf("%lld*n", fib(30));
+}
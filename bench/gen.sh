@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+# Generates B program stressing one part of the compiler, scaled by count
+# usage: bench/gen.sh functions|globals|expressions|strings|switch count
+
+set -o pipefail
+
+if [ $# -ne 2 ]; then
+	1>&2 echo "usage: $0 functions|globals|expressions|strings|switch count"
+	exit 1
+fi
+
+case "$1" in
+functions)
+	# Calls between many functions make symbol lookup walk long scopes
+	awk -v n="$2" 'BEGIN {
+		print "f0(a, b) { return(a + b); }"
+		for (i = 1; i < n; ++i) {
+			printf "f%d(a, b) {\n\tauto x, y;\n\tx = a * %d + b;\n\ty = 0;\n", i, i
+			printf "\twhile (y < 3) {\n\t\tif (x & 1) x = f%d(x, y); else x = x / 2;\n\t\t++y;\n\t}\n", i - 1
+			printf "\treturn(x);\n}\n"
+		}
+		printf "main() {\n\treturn(f%d(1, 2) & 127);\n}\n", n - 1
+	}'
+	;;
+globals)
+	# Every function reads a window of globals and vectors
+	awk -v n="$2" 'BEGIN {
+		for (i = 0; i < n; ++i) {
+			printf "g%d %d;\n", i, i
+			printf "v%d[4] %d, %d, %d;\n", i, i, i + 1, i + 2
+		}
+		for (i = 0; i < n; i += 16) {
+			printf "sum%d() {\n\tauto s;\n\ts = 0;\n", i
+			for (j = i; j < i + 16 && j < n; ++j) printf "\ts += g%d + v%d[1];\n\tg%d = s;\n", j, j, j
+			printf "\treturn(s);\n}\n"
+		}
+		printf "main() {\n\tauto s;\n\ts = 0;\n"
+		for (i = 0; i < n; i += 16) printf "\ts += sum%d();\n", i
+		printf "\treturn(s & 127);\n}\n"
+	}'
+	;;
+expressions)
+	# Long chains of binary operators and deeply nested parentheses
+	awk -v n="$2" 'BEGIN {
+		ops[0] = "+"; ops[1] = "-"; ops[2] = "*"; ops[3] = "&"; ops[4] = "|"; ops[5] = "^"
+		for (f = 0; f < 16; ++f) {
+			printf "e%d(a, b, c) {\n\tauto x;\n\tx = a", f
+			for (i = 0; i < n; ++i) printf " %s (b %s %d)", ops[i % 6], ops[(i + 1) % 3], i % 7 + 1
+			printf ";\n\tx = "
+			depth = n < 200 ? n : 200
+			for (i = 0; i < depth; ++i) printf "(c + "
+			printf "x"
+			for (i = 0; i < depth; ++i) printf ")"
+			printf ";\n\treturn(x);\n}\n"
+		}
+		printf "main() {\n\treturn(e0(1, 2, 3) & 127);\n}\n"
+	}'
+	;;
+strings)
+	# One huge literal and many distinct ones, all go through string interning
+	awk -v n="$2" 'BEGIN {
+		printf "main() extrn puts; {\n\tputs(\""
+		for (i = 0; i < n; ++i) printf "%c", 97 + i % 26
+		printf "\");\n"
+		for (i = 0; i < n / 64; ++i) printf "\tputs(\"string number %d*n\");\n", i
+		printf "}\n"
+	}'
+	;;
+switch)
+	# Wide switch with a case for every value
+	awk -v n="$2" 'BEGIN {
+		printf "dispatch(x) {\n\tauto r;\n\tr = 0;\n\tswitch (x) {\n"
+		for (i = 0; i < n; ++i) printf "\tcase %d: r = x * %d + %d; break;\n", i, i % 13, i
+		printf "\t}\n\treturn(r);\n}\n"
+		printf "main() {\n\treturn(dispatch(%d) & 127);\n}\n", n / 2
+	}'
+	;;
+*)
+	1>&2 echo "$0: unknown kind: $1"
+	exit 1
+	;;
+esac
@@ -0,0 +1,33 @@
+/* ops: 8388608 bytes */
+N 1048576;
+
+/* 64 bit FNV-1a */
+hash(s, n) extrn char; {
+	auto h, i;
+	h = -3750763034362895579;
+	i = 0;
+	while (i < n) {
+		h = (h ^ char(s, i)) * 1099511628211;
+		++i;
+	}
+	return(h);
+}
+
+main() extrn printf, malloc, lchar; {
+	auto s, i, h;
+
+	s = malloc(N);
+	i = 0;
+	while (i < N) {
+		lchar(s, i, 'a' + i % 26);
+		++i;
+	}
+
+	h = 0;
+	i = 0;
+	while (i < 8) {
+		h = h ^ hash(s, N - i);
+		++i;
+	}
+	printf("%lld*n", h);
+}
@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 1048576
+
+// 64 bit FNV-1a
+uint64_t hash(uint8_t const* s, int64_t n)
+{
+	uint64_t h = 14695981039346656037u;
+	for (int64_t i = 0; i < n; ++i) h = (h ^ s[i]) * 1099511628211u;
+	return h;
+}
+
+int main(void)
+{
+	uint8_t *s = malloc(N);
+	for (int64_t i = 0; i < N; ++i) s[i] = 'a' + i % 26;
+
+	uint64_t h = 0;
+	for (int64_t i = 0; i < 8; ++i) h ^= hash(s, N - i);
+	printf("%lld\n", (long long)h);
+}
@@ -0,0 +1,45 @@
+/* ops: 10000004 instructions */
+/* Register machine with switch dispatch, instructions are 4 words: opcode and 3 operands */
+HALT 0;
+LOADI 1;
+ADD 2;
+MULI 3;
+ANDI 4;
+INC 5;
+JLT 6;
+
+N 2000000;
+
+run(code, r) {
+	auto pc, in;
+	pc = 0;
+	while (1) {
+		in = &code[pc * 4];
+		++pc;
+		switch (in[0]) {
+		case 0: return(r[0]);
+		case 1: r[in[1]] = in[2]; break;
+		case 2: r[in[1]] += r[in[2]]; break;
+		case 3: r[in[1]] *= in[2]; break;
+		case 4: r[in[1]] = r[in[1]] & in[2]; break;
+		case 5: ++r[in[1]]; break;
+		case 6: if (r[in[1]] < r[in[2]]) pc = in[3]; break;
+		}
+	}
+}
+
+main() extrn printf; {
+	auto code[36], r[8];
+
+	code[0]  = LOADI; code[1]  = 0; code[2]  = 0;     code[3]  = 0;
+	code[4]  = LOADI; code[5]  = 1; code[6]  = 0;     code[7]  = 0;
+	code[8]  = LOADI; code[9]  = 2; code[10] = N;     code[11] = 0;
+	code[12] = MULI;  code[13] = 0; code[14] = 3;     code[15] = 0;
+	code[16] = ADD;   code[17] = 0; code[18] = 1;     code[19] = 0;
+	code[20] = ANDI;  code[21] = 0; code[22] = 65535; code[23] = 0;
+	code[24] = INC;   code[25] = 1; code[26] = 0;     code[27] = 0;
+	code[28] = JLT;   code[29] = 1; code[30] = 2;     code[31] = 3;
+	code[32] = HALT;  code[33] = 0; code[34] = 0;     code[35] = 0;
+
+	printf("%lld*n", run(code, r));
+}
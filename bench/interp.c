@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Register machine with switch dispatch, instructions are 4 words: opcode and 3 operands
+enum { HALT, LOADI, ADD, MULI, ANDI, INC, JLT };
+
+#define N 2000000
+
+int64_t run(int64_t const* code, int64_t *r)
+{
+	for (int64_t pc = 0;;) {
+		int64_t const* in = &code[pc * 4];
+		++pc;
+		switch (in[0]) {
+		case HALT: return r[0];
+		case LOADI: r[in[1]] = in[2]; break;
+		case ADD: r[in[1]] += r[in[2]]; break;
+		case MULI: r[in[1]] *= in[2]; break;
+		case ANDI: r[in[1]] &= in[2]; break;
+		case INC: ++r[in[1]]; break;
+		case JLT: if (r[in[1]] < r[in[2]]) pc = in[3]; break;
+		}
+	}
+}
+
+int main(void)
+{
+	int64_t code[] = {
+		LOADI, 0, 0,     0,
+		LOADI, 1, 0,     0,
+		LOADI, 2, N,     0,
+		MULI,  0, 3,     0,
+		ADD,   0, 1,     0,
+		ANDI,  0, 65535, 0,
+		INC,   1, 0,     0,
+		JLT,   1, 2,     3,
+		HALT,  0, 0,     0,
+	};
+	int64_t r[8];
+	printf("%lld\n", (long long)run(code, r));
+}
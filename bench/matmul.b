@@ -0,0 +1,40 @@
+/* ops: 3375000 multiply-adds */
+N 150;
+
+main() extrn printf, malloc; {
+	auto a, b, c, i, j, k, s;
+
+	a = malloc(N * N * 8);
+	b = malloc(N * N * 8);
+	c = malloc(N * N * 8);
+	i = 0;
+	while (i < N * N) {
+		a[i] = i % 7;
+		b[i] = i % 5 - 2;
+		++i;
+	}
+
+	i = 0;
+	while (i < N) {
+		j = 0;
+		while (j < N) {
+			s = 0;
+			k = 0;
+			while (k < N) {
+				s += a[i * N + k] * b[k * N + j];
+				++k;
+			}
+			c[i * N + j] = s;
+			++j;
+		}
+		++i;
+	}
+
+	s = 0;
+	i = 0;
+	while (i < N * N) {
+		s = s * 31 + c[i];
+		++i;
+	}
+	printf("%lld*n", s);
+}
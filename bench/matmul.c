@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 150
+
+int main(void)
+{
+	int64_t *a = malloc(N * N * 8), *b = malloc(N * N * 8), *c = malloc(N * N * 8);
+	for (int64_t i = 0; i < N * N; ++i) {
+		a[i] = i % 7;
+		b[i] = i % 5 - 2;
+	}
+
+	for (int64_t i = 0; i < N; ++i) {
+		for (int64_t j = 0; j < N; ++j) {
+			int64_t s = 0;
+			for (int64_t k = 0; k < N; ++k) s += a[i * N + k] * b[k * N + j];
+			c[i * N + j] = s;
+		}
+	}
+
+	// Wraps around like B words do
+	uint64_t s = 0;
+	for (int64_t i = 0; i < N * N; ++i) s = s * 31 + c[i];
+	printf("%lld\n", (long long)s);
+}
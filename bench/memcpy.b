@@ -0,0 +1,33 @@
+/* ops: 32768000 words */
+N 65536;
+
+main() extrn printf, malloc; {
+	auto src, dst, r, i, s;
+
+	src = malloc(N * 8);
+	dst = malloc(N * 8);
+	i = 0;
+	while (i < N) {
+		src[i] = i * 3;
+		++i;
+	}
+
+	r = 0;
+	while (r < 500) {
+		i = 0;
+		while (i < N) {
+			dst[i] = src[i];
+			++i;
+		}
+		src[r] = r;
+		++r;
+	}
+
+	s = 0;
+	i = 0;
+	while (i < N) {
+		s += dst[i];
+		++i;
+	}
+	printf("%lld*n", s);
+}
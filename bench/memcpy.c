@@ -0,0 +1,20 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 65536
+
+int main(void)
+{
+	int64_t *src = malloc(N * 8), *dst = malloc(N * 8);
+	for (int64_t i = 0; i < N; ++i) src[i] = i * 3;
+
+	for (int64_t r = 0; r < 500; ++r) {
+		for (int64_t i = 0; i < N; ++i) dst[i] = src[i];
+		src[r] = r;
+	}
+
+	int64_t s = 0;
+	for (int64_t i = 0; i < N; ++i) s += dst[i];
+	printf("%lld\n", (long long)s);
+}
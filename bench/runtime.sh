@@ -0,0 +1,75 @@
+#!/usr/bin/env bash
+# Runs B kernels from bench/ and their C references compiled with gcc -O0 and -O2.
+# Prints nanoseconds per operation (count of operations is in the first line of each
+# kernel), instructions retired per operation when perf is available and the ratio of
+# B time to C time. Outputs of all three builds must agree.
+# usage: bench/runtime.sh [kernel...]
+
+set -o pipefail
+
+B=${B:-./b}
+CC=${CC:-gcc}
+RUNS=${RUNS:-3}
+
+kernels=("$@")
+if [ ${#kernels[@]} -eq 0 ]; then
+	for src in bench/*.b; do kernels+=("$(basename "${src}" .b)"); done
+fi
+
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
+
+have_perf=false
+if command -v perf >/dev/null && perf stat -x, -e instructions:u true >/dev/null 2>&1; then
+	have_perf=true
+fi
+
+# Best wall time of RUNS in nanoseconds
+measure() {
+	local best="" start end
+	for ((run = 0; run < RUNS; ++run)); do
+		start=$(date +%s%N)
+		"$1" >/dev/null || return 1
+		end=$(date +%s%N)
+		if [ -z "${best}" ] || [ $((end - start)) -lt "${best}" ]; then best=$((end - start)); fi
+	done
+	echo "${best}"
+}
+
+instructions() {
+	if ${have_perf}; then
+		perf stat -x, -e instructions:u "$1" 2>&1 >/dev/null | awk -F, '/instructions/ { print $1 }'
+	fi
+}
+
+printf "%-8s %10s %9s %9s %9s %7s %7s %10s %10s\n" kernel ops b_ns/op O0_ns/op O2_ns/op b/O0 b/O2 b_ins/op O2_ins/op
+for k in "${kernels[@]}"; do
+	ops=$(awk 'NR == 1 { print $3 }' "bench/$k.b")
+
+	"${B}" "bench/$k.b" -o "${dir}/$k.asm" || exit 1
+	nasm "${dir}/$k.asm" -felf64 -o "${dir}/$k.o" || exit 1
+	"${CC}" "${dir}/$k.o" libb.a -o "${dir}/$k.b.out" -Wl,--gc-sections || exit 1
+	"${CC}" -O0 "bench/$k.c" -o "${dir}/$k.O0.out" || exit 1
+	"${CC}" -O2 "bench/$k.c" -o "${dir}/$k.O2.out" || exit 1
+
+	expected="$("${dir}/$k.O2.out")"
+	for build in b O0; do
+		if [ "$("${dir}/$k.${build}.out")" != "${expected}" ]; then
+			1>&2 echo "$0: $k built with ${build} printed different result than C with -O2"
+			exit 1
+		fi
+	done
+
+	b_ns=$(measure "${dir}/$k.b.out") || exit 1
+	O0_ns=$(measure "${dir}/$k.O0.out") || exit 1
+	O2_ns=$(measure "${dir}/$k.O2.out") || exit 1
+	b_ins=$(instructions "${dir}/$k.b.out")
+	O2_ins=$(instructions "${dir}/$k.O2.out")
+
+	awk -v k="$k" -v ops="${ops}" -v b="${b_ns}" -v O0="${O0_ns}" -v O2="${O2_ns}" -v b_ins="${b_ins}" -v O2_ins="${O2_ins}" 'BEGIN {
+		printf "%-8s %10d %9.3f %9.3f %9.3f %7.2f %7.2f", k, ops, b / ops, O0 / ops, O2 / ops, b / O0, b / O2
+		if (b_ins != "" && O2_ins != "") printf " %10.2f %10.2f", b_ins / ops, O2_ins / ops
+		else printf " %10s %10s", "-", "-"
+		printf "\n"
+	}'
+done
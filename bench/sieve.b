@@ -0,0 +1,31 @@
+/* ops: 10000000 numbers */
+N 1000000;
+
+main() extrn printf, malloc; {
+	auto flags, r, i, j, count;
+
+	flags = malloc(N * 8);
+	r = 0;
+	while (r < 10) {
+		i = 0;
+		while (i < N) {
+			flags[i] = 1;
+			++i;
+		}
+		count = 0;
+		i = 2;
+		while (i < N) {
+			if (flags[i]) {
+				++count;
+				j = i + i;
+				while (j < N) {
+					flags[j] = 0;
+					j += i;
+				}
+			}
+			++i;
+		}
+		++r;
+	}
+	printf("%lld*n", count);
+}
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 1000000
+
+int main(void)
+{
+	int64_t *flags = malloc(N * 8);
+	int64_t count = 0;
+	for (int64_t r = 0; r < 10; ++r) {
+		for (int64_t i = 0; i < N; ++i) flags[i] = 1;
+		count = 0;
+		for (int64_t i = 2; i < N; ++i) {
+			if (flags[i]) {
+				++count;
+				for (int64_t j = i + i; j < N; j += i) flags[j] = 0;
+			}
+		}
+	}
+	printf("%lld\n", (long long)count);
+}
@@ -1,7 +1,6 @@
 /* example work in progress */
 /* usage: examples/http [port] */
-
-/* TODO: errno isn't available due to beeing thread local */
+/* every client is served by its own coroutine from libb, waiting for requests doesn't block other clients */
 
 AF_INET 2;
 SOCK_STREAM 1;
@@ -9,6 +8,10 @@ SOL_SOCKET 1;
 SO_REUSEADDR 2;
 INADDR_ANY 0;
 O_RDONLY 0;
+O_NONBLOCK 04000;
+F_SETFL 4;
+EPOLLIN 1;
+EAGAIN 11;
 
 S_IFMT     0170000; /* mask to extract file mode bits */
 S_IFSOCK   0140000; /* socket */
@@ -103,7 +106,7 @@ http_new(port) {
 		return(1);
 	}
 
-	if (listen(server, 1) != 0) {
+	if (listen(server, 128) != 0) {
 		perror("failed to listen on a socket");
 		return(1);
 	}
@@ -120,19 +123,18 @@ remove_prefix_if_exists(s, len, prefix) extrn strncmp, strlen; {
 	return(0);
 }
 
-buf[128];
-
-http_accept_request(server, clientp, method, url, body) {
-	/* posix */ extrn accept, read;
+/* buf has 128 words */
+http_read_request(client, buf, method, url, body) {
+	/* posix */ extrn read;
 	/* libc  */ extrn perror, fprintf, stderr, memchr, memset;
-	/* libb  */ extrn i8set;
-	auto client, bufsize;
+	/* libb  */ extrn i8set, co_await_fd;
+	auto bufsize;
 	bufsize = 128 * 8;
 
-	if ((client = accept(server, 0, 0)) < 0) return(0);
-
 	auto r, p, sz, endp;
 
+	if (co_await_fd(client, EPOLLIN) < 0) return(0);
+
 	memset(buf, 0, bufsize);
 	r = read(client, buf, bufsize - 1);
 	if (r < 0) {
@@ -163,7 +165,6 @@ http_accept_request(server, clientp, method, url, body) {
 
 	*url = exchange(&p, endp);
 	*body = "";
-	*clientp = client;
 	return(1);
 }
 
@@ -294,10 +295,57 @@ try_file_response(client, url) {
 	return(1);
 }
 
-main(argc, argv) {
+http_serve(client) {
 	extrn close;
-	extrn strlen, strcmp, printf, sscanf, stderr, fprintf;
-	auto server, client, method, url, body, resp, port;
+	extrn strlen, strcmp, printf;
+	auto buf[128], method, url, body, resp;
+
+	if (!http_read_request(client, buf, &method, &url, &body)) {
+		close(client);
+		return;
+	}
+
+	log_time(); printf("%s %s", method, url);
+
+	if (strcmp(method, "GET") == 0) {
+		if (try_file_response(client, url)) {
+			return;
+		}
+
+		printf(" -> 404 %s*n", http_status_code_to_message(404));
+		resp = http_response_begin(client, 404);
+		http_response_content_type(resp, "text/html; charset=utf-8");
+		http_response_body(resp, page404, strlen(page404));
+		http_response_end(resp);
+		return;
+	}
+
+	printf(" -> 405 %s*n", http_status_code_to_message(405));
+	resp = http_response_begin(client, 405);
+	http_response_content_type(resp, "text/html; charset=utf-8");
+	http_response_body(resp, page405, strlen(page405));
+	http_response_end(resp);
+}
+
+http_accept_loop(server) extrn accept, perror, co_await_fd, co_spawn, get_errno, i32; {
+	auto client;
+
+	/* accept returns int, only the lower half of the word is meaningful */
+	while (co_await_fd(server, EPOLLIN) > 0) {
+		client = accept(server, 0, 0);
+		while (i32(&client) >= 0) {
+			co_spawn(&http_serve, client);
+			client = accept(server, 0, 0);
+		}
+		if (get_errno() != EAGAIN) perror("failed to accept a connection");
+	}
+}
+
+main(argc, argv) {
+	extrn close, fcntl;
+	extrn printf, sscanf, stderr, fprintf;
+	extrn co_spawn, co_run;
+	auto server, port;
 
 	if (argc == 2) {
 		if (sscanf(argv[1], "%lld", &port) != 1) {
@@ -309,31 +357,11 @@ main(argc, argv) {
 	}
 
 	server = http_new(port);
+	fcntl(server, F_SETFL, O_NONBLOCK);
 	log_time(); printf("Listening on http://localhost:%d*n", port);
 
-	client = method = url = body = 0;
-	while (http_accept_request(server, &client, &method, &url, &body)) {
-		log_time(); printf("%s %s", method, url);
-
-		if (strcmp(method, "GET") == 0) {
-			if (try_file_response(client, url)) {
-				continue;
-			}
-
-			printf(" -> 404 %s*n", http_status_code_to_message(404));
-			resp = http_response_begin(client, 404);
-			http_response_content_type(resp, "text/html; charset=utf-8");
-			http_response_body(resp, page404, strlen(page404));
-			http_response_end(resp);
-			continue;
-		}
-
-		printf(" -> 405 %s*n", http_status_code_to_message(405));
-		resp = http_response_begin(client, 405);
-		http_response_content_type(resp, "text/html; charset=utf-8");
-		http_response_body(resp, page405, strlen(page405));
-		http_response_end(resp);
-	}
+	co_spawn(&http_accept_loop, server);
+	co_run();
 
 	close(server);
 }
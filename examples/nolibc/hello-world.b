@@ -0,0 +1 @@
+main() extrn putstr; putstr("hello, world*n");
@@ -0,0 +1,19 @@
+/* Counts lines, words and bytes of standard input */
+main() extrn getchar, printn, putchar; {
+	auto c, lines, words, bytes, inword;
+	lines = words = bytes = inword = 0;
+
+	while ((c = getchar()) != -1) {
+		++bytes;
+		if (c == '*n') ++lines;
+		if (c == ' ' || c == '*n' || c == 9) inword = 0;
+		else if (!inword) {
+			inword = 1;
+			++words;
+		}
+	}
+
+	printn(lines, 10); putchar(' ');
+	printn(words, 10); putchar(' ');
+	printn(bytes, 10); putchar('*n');
+}
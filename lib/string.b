@@ -0,0 +1,38 @@
+/* Zero terminated strings accessed byte by byte */
+
+str_length(s) extrn char; {
+	auto n;
+	n = 0;
+	while (char(s, n)) ++n;
+	return (n);
+}
+
+str_equal(a, b) extrn char; {
+	auto i, c;
+	i = 0;
+	while ((c = char(a, i)) == char(b, i)) {
+		if (c == 0) return (1);
+		++i;
+	}
+	return (0);
+}
+
+/* Index of the first c in the first n bytes of s, n when there is none */
+str_find(s, n, c) extrn char; {
+	auto i;
+	i = 0;
+	while (i < n && char(s, i) != c) ++i;
+	return (i);
+}
+
+str_copy(dst, src) extrn char, lchar; {
+	auto i;
+	i = 0;
+	while (lchar(dst, i, char(src, i))) ++i;
+	return (dst);
+}
+
+str_concat(dst, src) extrn str_copy, str_length; {
+	str_copy(dst + str_length(dst), src);
+	return (dst);
+}
@@ -1,5 +1,1502 @@
+#ifdef LIBB_NOLIBC
+#define _MM_MALLOC_H_INCLUDED // Keeps immintrin.h from including stdlib.h
+#endif
+
+#include <cpuid.h>
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-int64_t i8set(int8_t *p, int64_t v) { return *p = v; }
+// Runtime library of B programs.
+//
+// Compiled normally it complements libc: putchar, getchar and exit come from libc and
+// the functions below write through stdio. Compiled with -DLIBB_NOLIBC it replaces libc:
+// system calls are made directly, output is buffered here and _start calls main.
+// Programs compiled with `b -nolibc` are linked with it statically, see Makefile.
+
+#ifndef LIBB_NOLIBC
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+#endif
+
+#ifndef LIBB_VERSION
+#define LIBB_VERSION 0
+#endif
+
+// Version of the library the program is linked with, set by the Makefile
+int64_t libb_version(void) { return LIBB_VERSION; }
 
+// Out of line versions of byte access and atomic functions that b compiles inline,
+// used when they are called through a function pointer.
+
+int64_t char_(uint8_t *s, int64_t i) __asm__("char");
+int64_t char_(uint8_t *s, int64_t i) { return s[i]; }
+int64_t lchar(uint8_t *s, int64_t i, int64_t c) { s[i] = c; return c; }
+
+int64_t u8(uint8_t *p) { return *p; }
+int64_t i8(int8_t *p) { return *p; }
+int64_t u16(uint16_t *p) { return *p; }
+int64_t i16(int16_t *p) { return *p; }
 int64_t u32(uint32_t *p) { return *p; }
+int64_t i32(int32_t *p) { return *p; }
+
+int64_t i8set(int8_t *p, int64_t v) { *p = v; return v; }
+int64_t i16set(int16_t *p, int64_t v) { *p = v; return v; }
+int64_t i32set(int32_t *p, int64_t v) { *p = v; return v; }
+
+int64_t atomic_load(int64_t *p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+int64_t atomic_store(int64_t *p, int64_t v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); return v; }
+int64_t atomic_xchg(int64_t *p, int64_t v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+int64_t atomic_add(int64_t *p, int64_t v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+int64_t atomic_fence(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); return 0; }
+int64_t spin_pause(void) { __builtin_ia32_pause(); return 0; }
+
+int64_t atomic_cas(int64_t *p, int64_t expected, int64_t v)
+{
+	__atomic_compare_exchange_n(p, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return expected;
+}
+
+#ifdef LIBB_NOLIBC
+
+enum {
+	SYS_read = 0,
+	SYS_write = 1,
+	SYS_open = 2,
+	SYS_close = 3,
+	SYS_mmap = 9,
+	SYS_mprotect = 10,
+	SYS_munmap = 11,
+	SYS_epoll_wait = 232,
+	SYS_epoll_ctl = 233,
+	SYS_exit_group = 231,
+	SYS_epoll_create1 = 291,
+};
+
+static int64_t syscall3(int64_t n, int64_t a, int64_t b, int64_t c)
+{
+	int64_t ret;
+	__asm__ volatile ("syscall"
+		: "=a"(ret)
+		: "a"(n), "D"(a), "S"(b), "d"(c)
+		: "rcx", "r11", "memory");
+	return ret;
+}
+
+static int64_t syscall6(int64_t n, int64_t a, int64_t b, int64_t c, int64_t d, int64_t e, int64_t f)
+{
+	int64_t ret;
+	register int64_t r10 __asm__("r10") = d;
+	register int64_t r8 __asm__("r8") = e;
+	register int64_t r9 __asm__("r9") = f;
+	__asm__ volatile ("syscall"
+		: "=a"(ret)
+		: "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+		: "rcx", "r11", "memory");
+	return ret;
+}
+
+int64_t read(int64_t fd, void *buf, int64_t n) { return syscall3(SYS_read, fd, (int64_t)buf, n); }
+int64_t write(int64_t fd, void const* buf, int64_t n) { return syscall3(SYS_write, fd, (int64_t)buf, n); }
+
+static struct {
+	size_t count;
+	uint8_t items[4096];
+} out;
+
+static struct {
+	size_t begin, end;
+	uint8_t items[4096];
+} in;
+
+int64_t flush(void)
+{
+	for (size_t written = 0; written < out.count;) {
+		int64_t n = write(1, out.items + written, out.count - written);
+		if (n <= 0) {
+			out.count = 0;
+			return -1;
+		}
+		written += n;
+	}
+	out.count = 0;
+	return 0;
+}
+
+static void emit(void const* s, size_t n)
+{
+	if (out.count + n > sizeof(out.items)) {
+		flush();
+		if (n > sizeof(out.items)) {
+			write(1, s, n);
+			return;
+		}
+	}
+	uint8_t const* src = s;
+	for (size_t i = 0; i < n; ++i) out.items[out.count + i] = src[i];
+	out.count += n;
+}
+
+int64_t putchar(int64_t c)
+{
+	if (out.count == sizeof(out.items)) flush();
+	out.items[out.count++] = c;
+	return c;
+}
+
+int64_t getchar(void)
+{
+	if (in.begin == in.end) {
+		flush();
+		int64_t n = read(0, in.items, sizeof(in.items));
+		if (n <= 0) return -1;
+		in.begin = 0;
+		in.end = n;
+	}
+	return in.items[in.begin++];
+}
+
+// Environment of the process, set by _start
+char **libb_environ;
+
+static char const* getenv(char const* name)
+{
+	for (char **e = libb_environ; e && *e; ++e) {
+		size_t n = 0;
+		while (name[n] && (*e)[n] == name[n]) ++n;
+		if (!name[n] && (*e)[n] == '=') return *e + n + 1;
+	}
+	return NULL;
+}
+
+// Threads can't be created without libc, _start calls libb_init instead of constructors
+#define LIBB_THREAD_LOCAL
+#define LIBB_CONSTRUCTOR
+
+// Read and write, private and anonymous mapping
+static void *map_pages(size_t size)
+{
+	int64_t p = syscall6(SYS_mmap, 0, size, 0x3, 0x22, -1, 0);
+	return p < 0 && p > -4096 ? NULL : (void*)p;
+}
+
+static void unmap_pages(void *p, size_t size)
+{
+	syscall3(SYS_munmap, (int64_t)p, size, 0);
+}
+
+static int64_t protect_none(void *p, size_t size)
+{
+	return syscall3(SYS_mprotect, (int64_t)p, size, 0);
+}
+
+// Same layout as struct epoll_event, which is packed on x86-64
+struct poll_event {
+	uint32_t events;
+	uint64_t data;
+} __attribute__((packed));
+
+static int64_t poll_create(void) { return syscall3(SYS_epoll_create1, 02000000, 0, 0); }
+static int64_t poll_ctl(int64_t epoll, int64_t op, int64_t fd, struct poll_event *event) { return syscall6(SYS_epoll_ctl, epoll, op, fd, (int64_t)event, 0, 0); }
+static int64_t poll_wait(int64_t epoll, struct poll_event *events, int64_t n) { return syscall6(SYS_epoll_wait, epoll, (int64_t)events, n, -1, 0, 0); }
+
+// Called by exit like a handler registered by atexit of libc
+static void (*exit_handler)(void);
+
+_Noreturn void exit(int64_t code)
+{
+	if (exit_handler) exit_handler();
+	flush();
+	for (;;) syscall3(SYS_exit_group, code, 0, 0);
+}
+
+// Stack is 16 byte aligned at the entry, [rsp] holds argc, argv follows it and
+// the environment follows the null that ends argv
+__asm__(
+	".globl _start\n"
+	"_start:\n"
+	"	xor %ebp, %ebp\n"
+	"	mov (%rsp), %rdi\n"
+	"	lea 16(%rsp,%rdi,8), %rax\n"
+	"	mov %rax, libb_environ(%rip)\n"
+	"	call libb_init\n"
+	"	mov (%rsp), %rdi\n"
+	"	lea 8(%rsp), %rsi\n"
+	"	call main\n"
+	"	mov %rax, %rdi\n"
+	"	call exit\n"
+);
+
+#else
+
+int64_t flush(void) { return fflush(stdout); }
+
+static void emit(void const* s, size_t n) { fwrite(s, 1, n, stdout); }
+
+#define LIBB_THREAD_LOCAL _Thread_local
+#define LIBB_CONSTRUCTOR __attribute__((constructor))
+
+static void *map_pages(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void unmap_pages(void *p, size_t size) { munmap(p, size); }
+
+static int64_t protect_none(void *p, size_t size) { return mprotect(p, size, PROT_NONE); }
+
+// System calls below return -errno on failure, like the ones made without libc
+struct poll_event {
+	uint32_t events;
+	uint64_t data;
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct poll_event) == sizeof(struct epoll_event), "struct epoll_event layout");
+
+static int64_t poll_create(void)
+{
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	return fd < 0 ? -errno : fd;
+}
+
+static int64_t poll_ctl(int64_t epoll, int64_t op, int64_t fd, struct poll_event *event)
+{
+	return epoll_ctl(epoll, op, fd, (struct epoll_event*)event) < 0 ? -errno : 0;
+}
+
+static int64_t poll_wait(int64_t epoll, struct poll_event *events, int64_t n)
+{
+	int count = epoll_wait(epoll, (struct epoll_event*)events, n, -1);
+	return count < 0 ? -errno : count;
+}
+
+#endif
+
+int64_t putstr(char const* s)
+{
+	size_t n = 0;
+	while (s[n]) ++n;
+	emit(s, n);
+	return n;
+}
+
+static char const digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Prints n in base b (2 to 36) like printn from the original B library,
+// negative numbers only in base 10
+int64_t printn(int64_t n, int64_t b)
+{
+	char buf[66];
+	char *p = buf + sizeof(buf);
+	uint64_t u = n;
+
+	if (b == 10) {
+		if (n < 0) u = -u;
+		while (u >= 100) {
+			p -= 2;
+			p[0] = digit_pairs[u % 100 * 2];
+			p[1] = digit_pairs[u % 100 * 2 + 1];
+			u /= 100;
+		}
+		if (u >= 10) {
+			p -= 2;
+			p[0] = digit_pairs[u * 2];
+			p[1] = digit_pairs[u * 2 + 1];
+		} else {
+			*--p = '0' + u;
+		}
+		if (n < 0) *--p = '-';
+	} else {
+		if (b < 2 || b > 36) return -1;
+		do {
+			*--p = "0123456789abcdefghijklmnopqrstuvwxyz"[u % b];
+			u /= b;
+		} while (u);
+	}
+
+	emit(p, buf + sizeof(buf) - p);
+	return buf + sizeof(buf) - p;
+}
+
+// Allocation counters of the calling thread, read from B with alloc_stat(n)
+enum {
+	ALLOC_ARENA_BYTES,  // 0: bytes returned by arena_alloc
+	ALLOC_ARENA_CHUNKS, // 1: chunks currently mapped by arenas
+	ALLOC_POOL_ALLOCS,  // 2: calls to pool_alloc
+	ALLOC_POOL_FREES,   // 3: calls to pool_free
+	ALLOC_POOL_MAPPED,  // 4: bytes currently mapped by the pool
+	ALLOC_STATS_COUNT,
+};
+
+static LIBB_THREAD_LOCAL int64_t alloc_stats[ALLOC_STATS_COUNT];
+
+int64_t alloc_stat(int64_t n)
+{
+	return n >= 0 && n < ALLOC_STATS_COUNT ? alloc_stats[n] : -1;
+}
+
+#define PAGE_SIZE 4096
+#define ROUND_UP(n, to) (((n) + (to) - 1) / (to) * (to))
+
+// Arena is a bump pointer allocator over a list of mapped chunks. The arena itself
+// lives at the beginning of its first chunk, which is kept by arena_reset.
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+};
+
+struct arena {
+	uint8_t *ptr, *end;
+	struct arena_chunk *chunks; // Most recent first
+	size_t chunk_size;
+};
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_FIRST_OFFSET (sizeof(struct arena_chunk) + sizeof(struct arena))
+
+static struct arena_chunk *arena_map_chunk(size_t size)
+{
+	struct arena_chunk *chunk = map_pages(size);
+	if (!chunk) return NULL;
+	chunk->size = size;
+	alloc_stats[ALLOC_ARENA_CHUNKS]++;
+	return chunk;
+}
+
+// Creates arena which chunks are at least size bytes (64 KiB when 0)
+struct arena *arena_new(int64_t size)
+{
+	size_t chunk_size = ROUND_UP((size > 0 ? (size_t)size : ARENA_CHUNK_SIZE) + ARENA_FIRST_OFFSET, PAGE_SIZE);
+	struct arena_chunk *chunk = arena_map_chunk(chunk_size);
+	if (!chunk) return NULL;
+
+	struct arena *a = (struct arena*)(chunk + 1);
+	chunk->next = NULL;
+	a->chunks = chunk;
+	a->chunk_size = chunk_size;
+	a->ptr = (uint8_t*)chunk + ARENA_FIRST_OFFSET;
+	a->end = (uint8_t*)chunk + chunk_size;
+	return a;
+}
+
+// Returns n bytes rounded up to the whole words, memory is not cleared
+void *arena_alloc(struct arena *a, int64_t n)
+{
+	size_t size = ROUND_UP((size_t)n, 8);
+	if ((size_t)(a->end - a->ptr) < size) {
+		size_t chunk_size = a->chunk_size;
+		if (size + sizeof(struct arena_chunk) > chunk_size) {
+			chunk_size = ROUND_UP(size + sizeof(struct arena_chunk), PAGE_SIZE);
+		}
+		struct arena_chunk *chunk = arena_map_chunk(chunk_size);
+		if (!chunk) return NULL;
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+		a->ptr = (uint8_t*)(chunk + 1);
+		a->end = (uint8_t*)chunk + chunk_size;
+	}
+
+	void *p = a->ptr;
+	a->ptr += size;
+	alloc_stats[ALLOC_ARENA_BYTES] += size;
+	return p;
+}
+
+// Frees everything allocated from the arena, keeping its first chunk
+int64_t arena_reset(struct arena *a)
+{
+	while (a->chunks->next) {
+		struct arena_chunk *next = a->chunks->next;
+		unmap_pages(a->chunks, a->chunks->size);
+		alloc_stats[ALLOC_ARENA_CHUNKS]--;
+		a->chunks = next;
+	}
+	a->ptr = (uint8_t*)a->chunks + ARENA_FIRST_OFFSET;
+	a->end = (uint8_t*)a->chunks + a->chunks->size;
+	return 0;
+}
+
+int64_t arena_free(struct arena *a)
+{
+	arena_reset(a);
+	alloc_stats[ALLOC_ARENA_CHUNKS]--;
+	unmap_pages(a->chunks, a->chunks->size);
+	return 0;
+}
+
+// Pool keeps a free list per size class, classes are powers of two from 1 to 512 words.
+// Word before each block holds its class, or for blocks too big for any class the
+// size of their own mapping. Free lists belong to the thread, so they need no locking.
+#define POOL_CLASSES 10
+#define POOL_SLAB_SIZE (64 * 1024)
+
+static LIBB_THREAD_LOCAL struct {
+	uint64_t *free[POOL_CLASSES];
+	uint8_t *ptr, *end; // Not yet used part of the current slab
+} pool;
+
+static size_t pool_class(size_t n)
+{
+	size_t words = n <= 8 ? 1 : (n + 7) / 8;
+	return words == 1 ? 0 : 64 - __builtin_clzll(words - 1);
+}
+
+void *pool_alloc(int64_t n)
+{
+	alloc_stats[ALLOC_POOL_ALLOCS]++;
+	size_t class = pool_class(n);
+
+	if (class >= POOL_CLASSES) {
+		size_t size = ROUND_UP((size_t)n + 8, PAGE_SIZE);
+		uint64_t *block = map_pages(size);
+		if (!block) return NULL;
+		alloc_stats[ALLOC_POOL_MAPPED] += size;
+		block[0] = size;
+		return block + 1;
+	}
+
+	uint64_t *p = pool.free[class];
+	if (p) {
+		pool.free[class] = (uint64_t*)p[0];
+		return p;
+	}
+
+	size_t size = 8 + ((size_t)8 << class);
+	if ((size_t)(pool.end - pool.ptr) < size) {
+		uint8_t *slab = map_pages(POOL_SLAB_SIZE);
+		if (!slab) return NULL;
+		alloc_stats[ALLOC_POOL_MAPPED] += POOL_SLAB_SIZE;
+		pool.ptr = slab;
+		pool.end = slab + POOL_SLAB_SIZE;
+	}
+	uint64_t *block = (uint64_t*)pool.ptr;
+	pool.ptr += size;
+	block[0] = class;
+	return block + 1;
+}
+
+int64_t pool_free(uint64_t *p)
+{
+	if (!p) return 0;
+	alloc_stats[ALLOC_POOL_FREES]++;
+
+	if (p[-1] >= POOL_CLASSES) {
+		alloc_stats[ALLOC_POOL_MAPPED] -= p[-1];
+		unmap_pages(p - 1, p[-1]);
+		return 0;
+	}
+
+	p[0] = (uint64_t)pool.free[p[-1]];
+	pool.free[p[-1]] = p;
+	return 0;
+}
+
+void *pool_realloc(uint64_t *p, int64_t n)
+{
+	if (!p) return pool_alloc(n);
+
+	size_t capacity = p[-1] < POOL_CLASSES ? (size_t)8 << p[-1] : p[-1] - 8;
+	if ((size_t)n <= capacity) return p;
+
+	uint64_t *q = pool_alloc(n);
+	if (!q) return NULL;
+	for (size_t i = 0; i < capacity / 8; ++i) q[i] = p[i];
+	pool_free(p);
+	return q;
+}
+
+// Word vector primitives. Each has SSE2 version, which every x86-64 CPU supports,
+// and AVX2 version selected by libb_init. Counts less than 1 are treated as 0;
+// searches return the count when nothing is found.
+
+#define AVX2 __attribute__((target("avx2")))
+
+static int64_t first_bit(unsigned mask) { return __builtin_ctz(mask); }
+
+// Mask with bit per 64-bit lane that is equal, SSE2 can compare only 32-bit halves
+static unsigned sse2_eq64(__m128i a, __m128i b)
+{
+	__m128i eq = _mm_cmpeq_epi32(a, b);
+	eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_movemask_pd(_mm_castsi128_pd(eq));
+}
+
+static int64_t wfind_sse2(int64_t const* a, int64_t n, int64_t x)
+{
+	int64_t i = 0;
+	__m128i v = _mm_set1_epi64x(x);
+	for (; i + 2 <= n; i += 2) {
+		unsigned mask = sse2_eq64(_mm_loadu_si128((__m128i const*)(a + i)), v);
+		if (mask) return i + first_bit(mask);
+	}
+	for (; i < n; ++i) if (a[i] == x) return i;
+	return i;
+}
+
+AVX2 static int64_t wfind_avx2(int64_t const* a, int64_t n, int64_t x)
+{
+	int64_t i = 0;
+	__m256i v = _mm256_set1_epi64x(x);
+	for (; i + 4 <= n; i += 4) {
+		__m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i const*)(a + i)), v);
+		unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+		if (mask) return i + first_bit(mask);
+	}
+	for (; i < n; ++i) if (a[i] == x) return i;
+	return i;
+}
+
+static int64_t wcompare_sse2(int64_t const* a, int64_t const* b, int64_t n)
+{
+	int64_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		unsigned mask = sse2_eq64(_mm_loadu_si128((__m128i const*)(a + i)), _mm_loadu_si128((__m128i const*)(b + i)));
+		if (mask != 0x3) return i + first_bit(~mask);
+	}
+	for (; i < n; ++i) if (a[i] != b[i]) return i;
+	return i;
+}
+
+AVX2 static int64_t wcompare_avx2(int64_t const* a, int64_t const* b, int64_t n)
+{
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i const*)(a + i)), _mm256_loadu_si256((__m256i const*)(b + i)));
+		unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+		if (mask != 0xf) return i + first_bit(~mask);
+	}
+	for (; i < n; ++i) if (a[i] != b[i]) return i;
+	return i;
+}
+
+static int64_t bfind_sse2(uint8_t const* s, int64_t n, uint8_t c)
+{
+	int64_t i = 0;
+	__m128i v = _mm_set1_epi8(c);
+	for (; i + 16 <= n; i += 16) {
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)(s + i)), v));
+		if (mask) return i + first_bit(mask);
+	}
+	for (; i < n; ++i) if (s[i] == c) return i;
+	return i;
+}
+
+AVX2 static int64_t bfind_avx2(uint8_t const* s, int64_t n, uint8_t c)
+{
+	int64_t i = 0;
+	__m256i v = _mm256_set1_epi8(c);
+	for (; i + 32 <= n; i += 32) {
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const*)(s + i)), v));
+		if (mask) return i + first_bit(mask);
+	}
+	for (; i < n; ++i) if (s[i] == c) return i;
+	return i;
+}
+
+static void wfill_sse2(int64_t *dst, int64_t x, int64_t n)
+{
+	int64_t i = 0;
+	__m128i v = _mm_set1_epi64x(x);
+	for (; i + 2 <= n; i += 2) _mm_storeu_si128((__m128i*)(dst + i), v);
+	for (; i < n; ++i) dst[i] = x;
+}
+
+AVX2 static void wfill_avx2(int64_t *dst, int64_t x, int64_t n)
+{
+	int64_t i = 0;
+	__m256i v = _mm256_set1_epi64x(x);
+	for (; i + 4 <= n; i += 4) _mm256_storeu_si256((__m256i*)(dst + i), v);
+	for (; i < n; ++i) dst[i] = x;
+}
+
+// Overlapping vectors are copied backwards when destination is after the source
+static void wcopy_sse2(int64_t *dst, int64_t const* src, int64_t n)
+{
+	if (dst > src && dst < src + n) {
+		int64_t i = n;
+		for (; i >= 2; i -= 2) _mm_storeu_si128((__m128i*)(dst + i - 2), _mm_loadu_si128((__m128i const*)(src + i - 2)));
+		if (i) dst[0] = src[0];
+		return;
+	}
+	int64_t i = 0;
+	for (; i + 2 <= n; i += 2) _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((__m128i const*)(src + i)));
+	if (i < n) dst[i] = src[i];
+}
+
+AVX2 static void wcopy_avx2(int64_t *dst, int64_t const* src, int64_t n)
+{
+	if (dst > src && dst < src + n) {
+		int64_t i = n;
+		for (; i >= 4; i -= 4) _mm256_storeu_si256((__m256i*)(dst + i - 4), _mm256_loadu_si256((__m256i const*)(src + i - 4)));
+		for (; i > 0; --i) dst[i - 1] = src[i - 1];
+		return;
+	}
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_si256((__m256i*)(dst + i), _mm256_loadu_si256((__m256i const*)(src + i)));
+	for (; i < n; ++i) dst[i] = src[i];
+}
+
+static struct {
+	int64_t (*wfind)(int64_t const*, int64_t, int64_t);
+	int64_t (*wcompare)(int64_t const*, int64_t const*, int64_t);
+	int64_t (*bfind)(uint8_t const*, int64_t, uint8_t);
+	void (*wfill)(int64_t*, int64_t, int64_t);
+	void (*wcopy)(int64_t*, int64_t const*, int64_t);
+} simd = { wfind_sse2, wcompare_sse2, bfind_sse2, wfill_sse2, wcopy_sse2 };
+
+// AVX2 needs support from both CPU and OS saving ymm registers
+LIBB_CONSTRUCTOR void libb_init(void)
+{
+	unsigned a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || (c & (bit_OSXSAVE | bit_AVX)) != (bit_OSXSAVE | bit_AVX)) return;
+	unsigned lo, hi;
+	__asm__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	if ((lo & 6) != 6) return;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX2)) return;
+
+	simd.wfind = wfind_avx2;
+	simd.wcompare = wcompare_avx2;
+	simd.bfind = bfind_avx2;
+	simd.wfill = wfill_avx2;
+	simd.wcopy = wcopy_avx2;
+}
+
+// Index of the first word equal to x
+int64_t wfind(int64_t const* a, int64_t n, int64_t x) { return n > 0 ? simd.wfind(a, n, x) : 0; }
+
+// Index of the first word that differs
+int64_t wcompare(int64_t const* a, int64_t const* b, int64_t n) { return n > 0 ? simd.wcompare(a, b, n) : 0; }
+
+// Index of the first byte equal to c, which is compared as a word like char(s, i) == c
+int64_t bfind(uint8_t const* s, int64_t n, int64_t c)
+{
+	if (n <= 0) return 0;
+	if (c < 0 || c > 255) return n;
+	return simd.bfind(s, n, c);
+}
+
+int64_t *wfill(int64_t *dst, int64_t x, int64_t n)
+{
+	if (n > 0) simd.wfill(dst, x, n);
+	return dst;
+}
+
+int64_t *wcopy(int64_t *dst, int64_t const* src, int64_t n)
+{
+	if (n > 0) simd.wcopy(dst, src, n);
+	return dst;
+}
+
+// Stackful coroutines scheduled on a single thread. Coroutines run until they call
+// co_yield or co_await_fd, which switch back to the scheduler in co_run; it resumes
+// ready coroutines in order and waits in epoll when all of them wait for a descriptor.
+
+#define CO_STACK_SIZE (64 * 1024)
+
+enum {
+	CO_EPOLLONESHOT = 1u << 30,
+	CO_EPOLL_CTL_ADD = 1,
+	CO_EPOLL_CTL_MOD = 3,
+	CO_ENOENT = 2,
+	CO_EINTR = 4,
+};
+
+struct coroutine {
+	void *rsp; // Saved stack pointer while not running
+	uint8_t *stack;
+	int64_t (*fn)(int64_t);
+	int64_t arg;
+	int64_t events; // Result of co_await_fd
+	struct coroutine *next;
+	bool done;
+};
+
+static LIBB_THREAD_LOCAL struct {
+	struct coroutine *current; // NULL while the scheduler runs
+	void *scheduler_rsp;
+	struct coroutine *head, *tail; // Ready to run
+	size_t alive, waiting;
+	int64_t epoll;
+	bool polling;
+} co;
+
+void libb_co_switch(void **save_rsp, void *rsp);
+
+// Saves registers preserved across calls by the System V ABI, which b relies on too:
+// rbp holds the frame and the loop optimizer keeps variables in rbx and r12-r15.
+// New coroutine starts in libb_co_start with the stack aligned for a call.
+__asm__(
+	".pushsection .text.libb_co_switch,\"ax\",@progbits\n"
+	".globl libb_co_switch\n"
+	"libb_co_switch:\n"
+	"	push %rbp\n"
+	"	push %rbx\n"
+	"	push %r12\n"
+	"	push %r13\n"
+	"	push %r14\n"
+	"	push %r15\n"
+	"	mov %rsp, (%rdi)\n"
+	"	mov %rsi, %rsp\n"
+	"	pop %r15\n"
+	"	pop %r14\n"
+	"	pop %r13\n"
+	"	pop %r12\n"
+	"	pop %rbx\n"
+	"	pop %rbp\n"
+	"	ret\n"
+	"libb_co_start:\n"
+	"	call libb_co_main\n"
+	"	ud2\n"
+	".popsection\n"
+);
+
+_Noreturn void libb_co_main(void)
+{
+	struct coroutine *c = co.current;
+	c->fn(c->arg);
+	c->done = true;
+	libb_co_switch(&c->rsp, co.scheduler_rsp);
+	__builtin_unreachable();
+}
+
+static void co_ready(struct coroutine *c)
+{
+	c->next = NULL;
+	if (co.tail) co.tail->next = c;
+	else co.head = c;
+	co.tail = c;
+}
+
+// Starts fn(arg) on the next run of the scheduler, lowest page of the stack guards it
+int64_t co_spawn(int64_t (*fn)(int64_t), int64_t arg)
+{
+	extern char libb_co_start[];
+
+	struct coroutine *c = pool_alloc(sizeof(*c));
+	if (!c) return 0;
+	c->stack = map_pages(CO_STACK_SIZE);
+	if (!c->stack) {
+		pool_free((uint64_t*)c);
+		return 0;
+	}
+	protect_none(c->stack, PAGE_SIZE);
+
+	// Registers popped by libb_co_switch (all zero) and its return address
+	uint64_t *top = (uint64_t*)(c->stack + CO_STACK_SIZE) - 9;
+	for (size_t i = 0; i < 6; ++i) top[i] = 0;
+	top[6] = (uint64_t)libb_co_start;
+
+	c->rsp = top;
+	c->fn = fn;
+	c->arg = arg;
+	c->done = false;
+	co.alive++;
+	co_ready(c);
+	return (int64_t)c;
+}
+
+int64_t co_yield(void)
+{
+	struct coroutine *c = co.current;
+	if (!c) return -1;
+	co_ready(c);
+	libb_co_switch(&c->rsp, co.scheduler_rsp);
+	return 0;
+}
+
+// Suspends until fd has one of the events (1 for reading, 4 for writing) and returns them
+int64_t co_await_fd(int64_t fd, int64_t events)
+{
+	struct coroutine *c = co.current;
+	if (!c) return -1;
+	if (!co.polling) {
+		co.epoll = poll_create();
+		if (co.epoll < 0) return -1;
+		co.polling = true;
+	}
+
+	struct poll_event event = { .events = events | CO_EPOLLONESHOT, .data = (uint64_t)c };
+	int64_t r = poll_ctl(co.epoll, CO_EPOLL_CTL_MOD, fd, &event);
+	if (r == -CO_ENOENT) r = poll_ctl(co.epoll, CO_EPOLL_CTL_ADD, fd, &event);
+	if (r < 0) return -1;
+
+	co.waiting++;
+	libb_co_switch(&c->rsp, co.scheduler_rsp);
+	return c->events;
+}
+
+// Runs coroutines until all of them finish
+int64_t co_run(void)
+{
+	if (co.current) return -1;
+
+	while (co.alive) {
+		if (!co.head) {
+			if (!co.waiting) return -1;
+			struct poll_event events[64];
+			int64_t n = poll_wait(co.epoll, events, 64);
+			if (n == -CO_EINTR) continue;
+			if (n < 0) return -1;
+			for (int64_t i = 0; i < n; ++i) {
+				struct coroutine *c = (struct coroutine*)events[i].data;
+				c->events = events[i].events;
+				co.waiting--;
+				co_ready(c);
+			}
+			continue;
+		}
+
+		struct coroutine *c = co.head;
+		co.head = c->next;
+		if (!co.head) co.tail = NULL;
+
+		co.current = c;
+		libb_co_switch(&co.scheduler_rsp, c->rsp);
+		co.current = NULL;
+
+		if (c->done) {
+			unmap_pages(c->stack, CO_STACK_SIZE);
+			pool_free((uint64_t*)c);
+			co.alive--;
+		}
+	}
+	return 0;
+}
+
+// Lock-free building blocks for B code shared between threads
+
+// Spinlock is a word that is zero when unlocked
+int64_t spin_trylock(int64_t *lock)
+{
+	return !__atomic_load_n(lock, __ATOMIC_RELAXED) && !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE);
+}
+
+int64_t spin_lock(int64_t *lock)
+{
+	while (!spin_trylock(lock)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) __builtin_ia32_pause();
+	}
+	return 0;
+}
+
+int64_t spin_unlock(int64_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// Ring buffer of words for one producer thread and one consumer thread.
+// Head and tail only grow, capacity is a power of two.
+struct ring {
+	int64_t head; // Next item to pop, written by consumer
+	char padding[56];
+	int64_t tail; // Next free item, written by producer
+	char padding2[56];
+	int64_t mask;
+	int64_t items[];
+};
+
+struct ring *ring_new(int64_t capacity)
+{
+	int64_t n = 1;
+	while (n < capacity) n *= 2;
+	struct ring *r = pool_alloc(sizeof(*r) + n * sizeof(r->items[0]));
+	if (!r) return NULL;
+	r->head = r->tail = 0;
+	r->mask = n - 1;
+	return r;
+}
+
+int64_t ring_free(struct ring *r) { return pool_free((uint64_t*)r); }
+
+// Returns 0 when the ring is full
+int64_t ring_push(struct ring *r, int64_t v)
+{
+	int64_t tail = r->tail;
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->mask) return 0;
+	r->items[tail & r->mask] = v;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Stores the oldest item into *v, returns 0 when the ring is empty
+int64_t ring_pop(struct ring *r, int64_t *v)
+{
+	int64_t head = r->head;
+	if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) return 0;
+	*v = r->items[head & r->mask];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Treiber stack of nodes whose first word links them together. The stack is a word
+// holding the top node in the lower 48 bits and a counter of pushes in the upper 16,
+// so that node popped and pushed back between load and compare exchange of another
+// thread doesn't go unnoticed. Popped nodes may still be read, so they must stay mapped.
+#define LIFO_POINTER(top) ((int64_t*)((top) & 0xffffffffffff))
+#define LIFO_TAG(top) ((uint64_t)(top) >> 48)
+
+int64_t lifo_push(int64_t *stack, int64_t *node)
+{
+	int64_t top = __atomic_load_n(stack, __ATOMIC_RELAXED);
+	int64_t next;
+	do {
+		node[0] = (int64_t)LIFO_POINTER(top);
+		next = (int64_t)node | (int64_t)((LIFO_TAG(top) + 1) << 48);
+	} while (!__atomic_compare_exchange_n(stack, &top, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return 0;
+}
+
+// Returns the top node or 0 when the stack is empty
+int64_t lifo_pop(int64_t *stack)
+{
+	int64_t top = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+	int64_t *node;
+	do {
+		node = LIFO_POINTER(top);
+		if (!node) return 0;
+	} while (!__atomic_compare_exchange_n(stack, &top, node[0] | (int64_t)(LIFO_TAG(top) << 48), true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	return (int64_t)node;
+}
+
+// Tasks run by a pool of worker threads, one per CPU. Every worker owns a Chase-Lev
+// deque: it pushes and pops spawned tasks at the bottom, idle workers steal from the
+// top. Each task counts its unfinished children, sync runs other tasks until they
+// are done. Without libc there are no threads and tasks run when they are spawned.
+
+#ifndef LIBB_NOLIBC
+
+#define TASK_DEQUE_SIZE 4096 // Power of two, spawn runs the task itself when full
+#define TASK_MAX_WORKERS 64
+
+struct task {
+	int64_t (*fn)(int64_t);
+	int64_t arg;
+	int64_t (*range_fn)(int64_t, int64_t); // Set for parallel_for ranges instead of fn
+	int64_t lo, hi, ctx, grain;
+	int64_t *parent; // Children counter of the spawning task
+};
+
+struct task_deque {
+	int64_t top;
+	char padding[56]; // Thieves don't share a cache line with the owner
+	int64_t bottom;
+	struct task *items[TASK_DEQUE_SIZE];
+};
+
+static struct {
+	pthread_once_t once;
+	int64_t count;
+	struct task_deque *deques;
+	int64_t pending, sleeping; // Tasks in deques, workers waiting for them
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+} workers = { .once = PTHREAD_ONCE_INIT, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static LIBB_THREAD_LOCAL struct {
+	struct task_deque *deque; // NULL on threads outside of the pool
+	int64_t index;
+	uint64_t seed;
+	int64_t *children; // Counter of the running task
+	int64_t root; // Children of code outside of any task
+} worker;
+
+static bool deque_push(struct task_deque *d, struct task *t)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if (b - top >= TASK_DEQUE_SIZE) return false;
+	__atomic_store_n(&d->items[b & (TASK_DEQUE_SIZE - 1)], t, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+static struct task *deque_pop(struct task_deque *d)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+	struct task *t = NULL;
+	if (top <= b) {
+		t = __atomic_load_n(&d->items[b & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+		if (top != b) return t;
+		// Last task, race with thieves for it
+		if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) t = NULL;
+	}
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return t;
+}
+
+static struct task *deque_steal(struct task_deque *d)
+{
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (top >= b) return NULL;
+	struct task *t = __atomic_load_n(&d->items[top & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return NULL;
+	return t;
+}
+
+static void task_execute(struct task *t);
+
+// Own deque first, then other workers starting from a random one
+static struct task *task_find(void)
+{
+	struct task *t = deque_pop(worker.deque);
+	if (!t) {
+		worker.seed = worker.seed * 6364136223846793005u + 1442695040888963407u;
+		int64_t start = (worker.seed >> 33) % workers.count;
+		for (int64_t i = 0; i < workers.count && !t; ++i) {
+			int64_t victim = (start + i) % workers.count;
+			if (victim != worker.index) t = deque_steal(&workers.deques[victim]);
+		}
+	}
+	if (t) __atomic_fetch_sub(&workers.pending, 1, __ATOMIC_SEQ_CST);
+	return t;
+}
+
+static void *worker_main(void *arg)
+{
+	worker.index = (int64_t)arg;
+	worker.deque = &workers.deques[worker.index];
+	worker.seed = worker.index;
+
+	for (;;) {
+		struct task *t = NULL;
+		for (int spins = 0; spins < 256 && !t; ++spins) {
+			t = task_find();
+			if (!t) __builtin_ia32_pause();
+		}
+		if (t) {
+			task_execute(t);
+			continue;
+		}
+
+		pthread_mutex_lock(&workers.lock);
+		__atomic_fetch_add(&workers.sleeping, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&workers.pending, __ATOMIC_SEQ_CST) == 0) pthread_cond_wait(&workers.wake, &workers.lock);
+		__atomic_fetch_sub(&workers.sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&workers.lock);
+	}
+	return NULL;
+}
+
+// Thread starting the pool becomes worker 0, LIBB_WORKERS overrides the number of CPUs
+static void workers_start(void)
+{
+	char const* env = getenv("LIBB_WORKERS");
+	workers.count = env ? atol(env) : get_nprocs();
+	if (workers.count < 1) workers.count = 1;
+	if (workers.count > TASK_MAX_WORKERS) workers.count = TASK_MAX_WORKERS;
+
+	workers.deques = map_pages(ROUND_UP(workers.count * sizeof(struct task_deque), PAGE_SIZE));
+	if (!workers.deques) {
+		workers.count = 0;
+		return;
+	}
+
+	worker.deque = &workers.deques[0];
+	worker.seed = 1;
+	for (int64_t i = 1; i < workers.count; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, worker_main, (void*)i) != 0) {
+			workers.count = i;
+			break;
+		}
+		pthread_detach(thread);
+	}
+}
+
+static void task_wait(int64_t *children)
+{
+	while (__atomic_load_n(children, __ATOMIC_ACQUIRE) > 0) {
+		struct task *t = task_find();
+		if (t) task_execute(t);
+		else __builtin_ia32_pause();
+	}
+}
+
+static void task_push(struct task *t)
+{
+	t->parent = worker.children ? worker.children : &worker.root;
+	__atomic_fetch_add(t->parent, 1, __ATOMIC_SEQ_CST);
+	if (!deque_push(worker.deque, t)) {
+		task_execute(t);
+		return;
+	}
+	__atomic_fetch_add(&workers.pending, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&workers.sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&workers.lock);
+		pthread_cond_signal(&workers.wake);
+		pthread_mutex_unlock(&workers.lock);
+	}
+}
+
+// Splits ranges in halves until they are small enough, then calls range_fn for every index
+static void task_execute(struct task *t)
+{
+	int64_t children = 0;
+	int64_t *saved = worker.children;
+	worker.children = &children;
+
+	if (t->range_fn) {
+		while (t->hi - t->lo > t->grain) {
+			struct task *half = pool_alloc(sizeof(*half));
+			if (!half) break;
+			*half = *t;
+			half->lo = t->lo + (t->hi - t->lo) / 2;
+			t->hi = half->lo;
+			task_push(half);
+		}
+		for (int64_t i = t->lo; i < t->hi; ++i) t->range_fn(i, t->ctx);
+	} else {
+		t->fn(t->arg);
+	}
+
+	task_wait(&children);
+	worker.children = saved;
+	__atomic_fetch_sub(t->parent, 1, __ATOMIC_RELEASE);
+	pool_free((uint64_t*)t);
+}
+
+static bool workers_ready(void)
+{
+	pthread_once(&workers.once, workers_start);
+	return worker.deque != NULL;
+}
+
+// Runs fn(arg) on some worker, possibly after the caller returns from its own task
+int64_t spawn(int64_t (*fn)(int64_t), int64_t arg)
+{
+	if (!workers_ready()) return fn(arg), 0;
+	struct task *t = pool_alloc(sizeof(*t));
+	if (!t) return fn(arg), 0;
+	*t = (struct task){ .fn = fn, .arg = arg };
+	task_push(t);
+	return 0;
+}
+
+// Waits for tasks spawned by the current task, helping to run them
+int64_t sync(void)
+{
+	if (!worker.deque) return 0;
+	task_wait(worker.children ? worker.children : &worker.root);
+	return 0;
+}
+
+// Calls fn(i, ctx) for every i from lo up to hi in parallel and waits for all of them
+int64_t parallel_for(int64_t lo, int64_t hi, int64_t (*fn)(int64_t, int64_t), int64_t ctx)
+{
+	if (lo >= hi) return 0;
+	if (!workers_ready()) {
+		for (int64_t i = lo; i < hi; ++i) fn(i, ctx);
+		return 0;
+	}
+
+	struct task *t = pool_alloc(sizeof(*t));
+	if (!t) return -1;
+	int64_t grain = (hi - lo) / (8 * workers.count);
+	*t = (struct task){ .range_fn = fn, .lo = lo, .hi = hi, .ctx = ctx, .grain = grain > 0 ? grain : 1 };
+
+	int64_t done = 1;
+	t->parent = &done;
+	task_execute(t);
+	return 0;
+}
+
+int64_t worker_count(void) { return workers_ready() ? workers.count : 1; }
+
+// Index of the calling worker, -1 on threads outside of the pool
+int64_t worker_index(void) { return worker.deque ? worker.index : -1; }
+
+// errno is thread local in libc, so B code can't reach it through extrn
+int64_t get_errno(void) { return errno; }
+int64_t set_errno(int64_t v) { errno = v; return v; }
+
+#else
+
+int64_t spawn(int64_t (*fn)(int64_t), int64_t arg) { fn(arg); return 0; }
+int64_t sync(void) { return 0; }
+
+int64_t parallel_for(int64_t lo, int64_t hi, int64_t (*fn)(int64_t, int64_t), int64_t ctx)
+{
+	for (int64_t i = lo; i < hi; ++i) fn(i, ctx);
+	return 0;
+}
+
+int64_t worker_count(void) { return 1; }
+int64_t worker_index(void) { return 0; }
+
+#endif
+
+// Profiler of programs compiled with `b -finstrument`. Prologue of every function calls
+// libb_profile_enter and epilogues call libb_profile_exit with r11 pointing to the record
+// of the function, which b places in .data. Counters of labels (-finstrument=blocks) are
+// incremented inline. Records register themselves on the first call and are written at
+// exit to $LIBB_PROFILE, prof.data by default (always prof.data without libc):
+//
+//   function <name> <calls> <cycles including callees> <self cycles>
+//   block <function> <label> <count>
+//   stack <caller;...;function> <self cycles>
+//
+// Stack lines without the first word are the collapsed stacks used by flame graphs.
+// Cycles are read by rdtsc. Block counters are not atomic, the other counters are.
+
+struct profile_block {
+	int64_t label, count;
+};
+
+struct profile_record {
+	int64_t calls, cycles, self;
+	char const* name;
+	struct profile_record *next;
+	int64_t registered;
+	int64_t blocks_count;
+	struct profile_block blocks[];
+};
+
+// Node of the calling context tree of a thread, one per distinct call stack
+struct profile_node {
+	struct profile_record *record; // NULL in the root
+	struct profile_node *parent, *child, *sibling, *next;
+	int64_t self;
+	uint64_t start, callees; // Of the running call, there is at most one per stack
+	bool recursive; // Function is on the stack already, its cycles are counted by the outer call
+};
+
+#define PROFILE_NODES_CHUNK 4096
+
+static struct profile_record *profile_records;
+static struct profile_node *profile_nodes;
+
+static LIBB_THREAD_LOCAL struct {
+	struct profile_node *current; // Root while no instrumented function runs
+	struct profile_node *free, *end;
+} profile;
+
+void libb_profile_enter(void);
+void libb_profile_exit(void);
+
+// Functions are entered and left with all registers that may hold arguments or
+// the return value preserved, the stack is aligned for the call of C code
+#define PROFILE_TRAMPOLINE(name, handler) \
+	".globl " name "\n" \
+	name ":\n" \
+	"	push %rax\n" \
+	"	push %rdi\n" \
+	"	push %rsi\n" \
+	"	push %rdx\n" \
+	"	push %rcx\n" \
+	"	push %r8\n" \
+	"	push %r9\n" \
+	"	push %r10\n" \
+	"	sub $8, %rsp\n" \
+	"	mov %r11, %rdi\n" \
+	"	call " handler "\n" \
+	"	add $8, %rsp\n" \
+	"	pop %r10\n" \
+	"	pop %r9\n" \
+	"	pop %r8\n" \
+	"	pop %rcx\n" \
+	"	pop %rdx\n" \
+	"	pop %rsi\n" \
+	"	pop %rdi\n" \
+	"	pop %rax\n" \
+	"	ret\n"
+
+__asm__(
+	".pushsection .text.libb_profile,\"ax\",@progbits\n"
+	PROFILE_TRAMPOLINE("libb_profile_enter", "libb_profile_call")
+	PROFILE_TRAMPOLINE("libb_profile_exit", "libb_profile_return")
+	".popsection\n"
+);
+
+static struct profile_node *profile_node(struct profile_record *record, struct profile_node *parent)
+{
+	if (profile.free == profile.end) {
+		profile.free = map_pages(PROFILE_NODES_CHUNK * sizeof(struct profile_node));
+		if (!profile.free) return NULL;
+		profile.end = profile.free + PROFILE_NODES_CHUNK;
+	}
+	struct profile_node *n = profile.free++;
+	*n = (struct profile_node) { .record = record, .parent = parent };
+	if (parent) {
+		n->sibling = parent->child;
+		parent->child = n;
+	}
+	for (struct profile_node *p = parent; p && !n->recursive; p = p->parent) {
+		n->recursive = p->record == record;
+	}
+	n->next = __atomic_load_n(&profile_nodes, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&profile_nodes, &n->next, n, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return n;
+}
+
+static struct {
+	char items[4096];
+	size_t count;
+} profile_out;
+
+static void profile_output(void const* s, size_t n);
+
+static void profile_write(char const* s)
+{
+	for (; *s; ++s) {
+		if (profile_out.count == sizeof(profile_out.items)) {
+			profile_output(profile_out.items, profile_out.count);
+			profile_out.count = 0;
+		}
+		profile_out.items[profile_out.count++] = *s;
+	}
+}
+
+static void profile_write_number(int64_t n)
+{
+	char buf[24], *p = buf + sizeof(buf);
+	uint64_t u = n < 0 ? -(uint64_t)n : (uint64_t)n;
+	*--p = '\0';
+	do *--p = '0' + u % 10; while (u /= 10);
+	if (n < 0) *--p = '-';
+	profile_write(" ");
+	profile_write(p);
+}
+
+static void profile_write_stack(struct profile_node const* n)
+{
+	if (n->parent && n->parent->record) {
+		profile_write_stack(n->parent);
+		profile_write(";");
+	}
+	profile_write(n->record->name);
+}
+
+#ifdef LIBB_NOLIBC
+
+static int64_t profile_fd = -1;
+
+static bool profile_open(void)
+{
+	char const* path = getenv("LIBB_PROFILE");
+	profile_fd = syscall3(SYS_open, (int64_t)(path ? path : "prof.data"), 01101, 0644);
+	return profile_fd >= 0;
+}
+
+static void profile_output(void const* s, size_t n) { write(profile_fd, s, n); }
+static void profile_close(void) { syscall3(SYS_close, profile_fd, 0, 0); }
+
+#else
+
+static FILE *profile_file;
+
+static bool profile_open(void)
+{
+	char const* path = getenv("LIBB_PROFILE");
+	profile_file = fopen(path ? path : "prof.data", "w");
+	return profile_file != NULL;
+}
+
+static void profile_output(void const* s, size_t n) { fwrite(s, 1, n, profile_file); }
+static void profile_close(void) { fclose(profile_file); }
+
+#endif
+
+static void profile_dump(void)
+{
+	if (!profile_open()) return;
+	for (struct profile_record *r = profile_records; r; r = r->next) {
+		profile_write("function ");
+		profile_write(r->name);
+		profile_write_number(r->calls);
+		profile_write_number(r->cycles);
+		profile_write_number(r->self);
+		profile_write("\n");
+		for (int64_t i = 0; i < r->blocks_count; ++i) {
+			profile_write("block ");
+			profile_write(r->name);
+			profile_write_number(r->blocks[i].label);
+			profile_write_number(r->blocks[i].count);
+			profile_write("\n");
+		}
+	}
+	for (struct profile_node *n = profile_nodes; n; n = n->next) {
+		if (n->record && n->self > 0) {
+			profile_write("stack ");
+			profile_write_stack(n);
+			profile_write_number(n->self);
+			profile_write("\n");
+		}
+	}
+	profile_output(profile_out.items, profile_out.count);
+	profile_out.count = 0;
+	profile_close();
+}
+
+static void profile_register(struct profile_record *r)
+{
+	if (__atomic_exchange_n(&r->registered, 1, __ATOMIC_ACQ_REL)) return;
+	r->next = __atomic_load_n(&profile_records, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&profile_records, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	static int64_t dump_registered;
+	if (!__atomic_exchange_n(&dump_registered, 1, __ATOMIC_ACQ_REL)) {
+#ifdef LIBB_NOLIBC
+		exit_handler = profile_dump;
+#else
+		atexit(profile_dump);
+#endif
+	}
+}
+
+void libb_profile_call(struct profile_record *r)
+{
+	uint64_t now = __rdtsc();
+	if (!r->registered) profile_register(r);
+	__atomic_fetch_add(&r->calls, 1, __ATOMIC_RELAXED);
+
+	if (!profile.current && !(profile.current = profile_node(NULL, NULL))) return;
+	struct profile_node *n = profile.current->child;
+	while (n && n->record != r) n = n->sibling;
+	if (!n && !(n = profile_node(r, profile.current))) return;
+	n->start = now;
+	n->callees = 0;
+	profile.current = n;
+}
+
+void libb_profile_return(struct profile_record *r)
+{
+	uint64_t now = __rdtsc();
+	// Calls left without return, like the ones of switched coroutines, are dropped
+	struct profile_node *n = profile.current;
+	while (n && n->record != r) n = n->parent;
+	if (!n) return;
+
+	uint64_t elapsed = now - n->start;
+	n->self += elapsed - n->callees;
+	if (!n->recursive) {
+		__atomic_fetch_add(&r->cycles, elapsed, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&r->self, elapsed - n->callees, __ATOMIC_RELAXED);
+	n->parent->callees += elapsed;
+	profile.current = n->parent;
+}
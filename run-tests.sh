@@ -0,0 +1,108 @@
+#!/usr/bin/env bash
+# Runs snapshot tests with snap.sh on all cores. Tests that passed before are skipped
+# while the compiler, libb (with and without libc), snap.sh and the test with its snapshots stay the same.
+# --profile-round-trip compiles every test with the profile of its own -finstrument=blocks run.
+# usage: ./run-tests.sh [-j jobs] [--no-cache] [--junit report.xml] [--profile-round-trip] [test.b...]
+
+set -o pipefail
+
+jobs=$(nproc)
+cache=.test-cache
+junit=""
+tests=()
+
+while [ $# -gt 0 ]; do
+	case "$1" in
+	-j) jobs="$2"; shift 2 ;;
+	--no-cache) cache=""; shift ;;
+	--junit) junit="$2"; shift 2 ;;
+	--profile-round-trip) export PROFILE_ROUND_TRIP=1; shift ;;
+	-*) 1>&2 echo "usage: $0 [-j jobs] [--no-cache] [--junit report.xml] [--profile-round-trip] [test.b...]"; exit 1 ;;
+	*) tests+=("$1"); shift ;;
+	esac
+done
+if [ ${#tests[@]} -eq 0 ]; then
+	tests=(tests/*.b tests/*.d)
+fi
+
+results="$(mktemp -d)"
+trap 'rm -rf "${results}"' EXIT
+if [ -n "${cache}" ]; then
+	mkdir -p "${cache}"
+fi
+
+# Key of the test is the hash of everything its result depends on
+toolchain=$( (cat b libb.a libb-nolibc.a snap.sh; echo "${PROFILE_ROUND_TRIP}") | sha256sum | cut -d' ' -f1)
+
+run_one() {
+	local t="$1" name key start status
+	name=$(basename "$t" .b)
+	key=$( (echo "${toolchain}"; cat "$t" "$t".* "$t"/* 2>/dev/null) | sha256sum | cut -d' ' -f1)
+
+	if [ -n "${cache}" ] && [ -f "${cache}/${key}" ]; then
+		echo cached >"${results}/${name}.status"
+		echo 0 >"${results}/${name}.time"
+		return
+	fi
+
+	start=$(date +%s%N)
+	./snap.sh "$t" >"${results}/${name}.output" 2>&1
+	status=$?
+	echo $(( $(date +%s%N) - start )) >"${results}/${name}.time"
+
+	if [ "${status}" -eq 0 ]; then
+		echo passed >"${results}/${name}.status"
+		if [ -n "${cache}" ]; then touch "${cache}/${key}"; fi
+	else
+		echo failed >"${results}/${name}.status"
+	fi
+}
+export -f run_one
+export toolchain cache results
+
+printf '%s\n' "${tests[@]}" | xargs -P "${jobs}" -I{} bash -c 'run_one "$1"' _ {}
+
+passed=0 failed=0 cached=0 total_ns=0
+for t in "${tests[@]}"; do
+	name=$(basename "$t" .b)
+	status=$(cat "${results}/${name}.status" 2>/dev/null || echo failed)
+	ns=$(cat "${results}/${name}.time" 2>/dev/null || echo 0)
+	total_ns=$((total_ns + ns))
+	case "${status}" in
+	passed) passed=$((passed + 1)) ;;
+	cached) cached=$((cached + 1)) ;;
+	*)
+		failed=$((failed + 1))
+		echo "FAILED $t"
+		sed 's/^/    /' "${results}/${name}.output" 2>/dev/null
+		;;
+	esac
+done
+echo "${passed} passed, ${cached} cached, ${failed} failed"
+
+if [ -n "${junit}" ]; then
+	{
+		echo '<?xml version="1.0" encoding="UTF-8"?>'
+		printf '<testsuite name="b" tests="%d" failures="%d" skipped="%d" time="%s">\n' \
+			${#tests[@]} "${failed}" "${cached}" "$(awk -v ns="${total_ns}" 'BEGIN { printf "%.3f", ns / 1e9 }')"
+		for t in "${tests[@]}"; do
+			name=$(basename "$t" .b)
+			status=$(cat "${results}/${name}.status" 2>/dev/null || echo failed)
+			time=$(awk -v ns="$(cat "${results}/${name}.time" 2>/dev/null || echo 0)" 'BEGIN { printf "%.3f", ns / 1e9 }')
+			printf '  <testcase classname="tests" name="%s" file="%s" time="%s">' "${name}" "$t" "${time}"
+			case "${status}" in
+			passed) ;;
+			cached) printf '<skipped message="unchanged since last pass"/>' ;;
+			*)
+				printf '<failure message="snapshot mismatch"><![CDATA['
+				sed 's/]]>/]]]]><![CDATA[>/g' "${results}/${name}.output" 2>/dev/null
+				printf ']]></failure>'
+				;;
+			esac
+			printf '</testcase>\n'
+		done
+		echo '</testsuite>'
+	} >"${junit}"
+fi
+
+[ "${failed}" -eq 0 ]
@@ -7,24 +7,88 @@ if [ -z "$1" ]; then
 	exit 1
 fi
 
-com_stderr="$(mktemp)"
-asm_path="$(mktemp tmp.XXXXX.asm -p /tmp/)"
-obj_path="$(mktemp tmp.XXXXX.o -p /tmp/)"
-exe_path="$(mktemp)"
-run_stdout="$(mktemp)"
-run_stderr="$(mktemp)"
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
 
+com_stderr="${dir}/com_stderr"
+asm_path="${dir}/a.asm"
+obj_path="${dir}/a.o"
+exe_path="${dir}/a.out"
+run_stdout="${dir}/run_stdout"
+run_stderr="${dir}/run_stderr"
 
-if ./b <"$1" >"${asm_path}" 2>"${com_stderr}"; then
+
+# Test tests/<name>.d/ is a program of many modules, compiled together in the order of names
+compile() {
+	local input="$1"
+	shift
+	if [ -d "${input}" ]; then
+		./b "$@" "${input}"/*.b
+	else
+		./b "$@" <"${input}"
+	fi
+}
+
+# Optional tests/<name>.b.flags holds flags of the compiler
+flags=""
+if [ -f "$1.flags" ]; then
+	flags=$(cat "$1.flags")
+fi
+
+# Programs compiled with -nolibc are linked statically with libb-nolibc.a, like examples/nolibc
+link() {
+	local obj="$1" exe="$2"
+	if [[ " ${flags} " == *" -nolibc "* ]]; then
+		ld -static --gc-sections "${obj}" libb-nolibc.a -o "${exe}"
+	else
+		gcc -o "${exe}" "${obj}" libb.a -Wl,--gc-sections
+	fi
+}
+
+# PROFILE_ROUND_TRIP=1 compiles the test with the profile of its own instrumented run, which
+# has to keep the output of the program the same (code layout and counts of labels change)
+if [ -n "${PROFILE_ROUND_TRIP}" ] && [[ "${flags}" != *--profile-use* ]]; then
+	: >"${dir}/train.data"
+	if compile "$1" ${flags} -finstrument=blocks >"${dir}/train.asm" 2>/dev/null \
+		&& nasm "${dir}/train.asm" -felf64 -o "${dir}/train.o" \
+		&& link "${dir}/train.o" "${dir}/train"; then
+		LIBB_PROFILE="${dir}/train.data" "${dir}/train" >/dev/null 2>&1 </dev/null
+	fi
+	flags="${flags} --profile-use=${dir}/train.data"
+fi
+
+# -g names the working directory in the debug info, snapshots have . in its place
+cwd_bytes=$(printf '%s' "${PWD}" | od -An -v -tx1 | tr -s ' \n' ' ' | sed 's/^ //; s/ $//; s/ /,0x/g')
+
+if compile "$1" ${flags} >"${asm_path}" 2>"${com_stderr}"; then
+	# Optional snapshot of the assembly, for tests of code layout and debug info
+	if [ -f "$1.asm" ] && [ -z "${PROFILE_ROUND_TRIP}" ]; then
+		sed "s/^\tdb 0x${cwd_bytes},0x00$/\tdb 0x2e,0x00/" "${asm_path}" >"${dir}/snapshot.asm"
+		if ! diff "${dir}/snapshot.asm" "$1.asm"; then exit 1; fi
+	fi
+	# Optional tests/<name>.b.time_report is the --time-report=json of the compilation with
+	# numbers replaced by 0. Piped output has no byte count, and the assembly has to stay the same
+	if [ -f "$1.time_report" ]; then
+		compile "$1" ${flags} --time-report=json 2>"${dir}/time_report" | cat >"${dir}/reported.asm"
+		if ! diff "${asm_path}" "${dir}/reported.asm"; then exit 1; fi
+		sed -E 's/: [0-9][0-9.e+-]*/: 0/g' "${dir}/time_report" | diff - "$1.time_report" || exit 1
+	fi
 	if ! nasm "${asm_path}" -felf64 -o "${obj_path}"; then
 		exit 1
 	fi
-	if ! gcc -o "${exe_path}" "${obj_path}"; then
+	if ! link "${obj_path}" "${exe_path}"; then
 		exit 1
 	fi
-	"$(realpath "${exe_path}")" >"${run_stdout}" 2>"${run_stderr}"
+	LIBB_PROFILE="${dir}/prof.data" "${exe_path}" >"${run_stdout}" 2>"${run_stderr}"
 	exit_code="$?"
 
+	# Profile of -finstrument without cycles, which differ from run to run
+	if [ -f "$1.profile" ] && [ -z "${PROFILE_ROUND_TRIP}" ]; then
+		awk '$1 == "function" { print $1, $2, $3 } $1 == "block" { print } $1 == "stack" { print $1, $2 }' \
+			"${dir}/prof.data" >"${dir}/profile"
+		if ! diff "${dir}/profile" "$1.profile"; then exit 1; fi
+	fi
+
 	if ! diff -N "${run_stdout}" "$1.run_stdout"; then exit 1; fi
 	if ! diff -N "${run_stderr}" "$1.run_stderr"; then exit 1; fi
 	if [ -f "$1.exit_code" ]; then
@@ -38,6 +102,3 @@ else
 		exit 1
 	fi
 fi
-
-
-rm -f "${com_stderr}" "${asm_path}" "${obj_path}" "${exe_path}"
@@ -0,0 +1,69 @@
+/* Arena and pool allocators of libb: chunk accounting of arena_reset and copying of pool_realloc */
+node_value 0;
+node_next  1;
+node_sizeof 2;
+
+push(arena, list, value) extrn arena_alloc; {
+	auto node;
+	node = arena_alloc(arena, node_sizeof * &0[1]);
+	node[node_value] = value;
+	node[node_next] = list;
+	return (node);
+}
+
+sum(list) {
+	auto s;
+	s = 0;
+	while (list) {
+		s += list[node_value];
+		list = list[node_next];
+	}
+	return (s);
+}
+
+main() extrn printf, arena_new, arena_alloc, arena_reset, arena_free, pool_alloc, pool_realloc, pool_free, alloc_stat; {
+	auto arena, request, list, i, v, p, capacity, wrong;
+
+	/* 10000 nodes of 16 bytes take three 64 KiB chunks, reset keeps only the first one */
+	arena = arena_new(0);
+	request = 0;
+	while (request < 3) {
+		list = 0;
+		i = 0;
+		while (i < 10000) list = push(arena, list, i++);
+		printf("request %d: sum %d, chunks %d", request, sum(list), alloc_stat(1));
+		arena_reset(arena);
+		printf(", after reset %d*n", alloc_stat(1));
+		++request;
+	}
+	printf("arena bytes %d*n", alloc_stat(0));
+
+	/* allocation bigger than a chunk gets a chunk of its own */
+	p = arena_alloc(arena, 100000);
+	p[100000 / 8 - 1] = 42;
+	printf("big: %d, chunks %d*n", p[100000 / 8 - 1], alloc_stat(1));
+	arena_free(arena);
+	printf("chunks after free %d*n", alloc_stat(1));
+
+	/* growth copies words through all size classes and into a mapping of its own */
+	capacity = 1;
+	v = pool_alloc(capacity * &0[1]);
+	i = 0;
+	while (i < 1000) {
+		if (i == capacity) v = pool_realloc(v, (capacity *= 2) * &0[1]);
+		v[i] = i;
+		++i;
+	}
+	wrong = 0;
+	i = 0;
+	while (i < 1000) { if (v[i] != i) ++wrong; ++i; }
+	printf("v[999] = %d, capacity %d, wrong %d, mapped %d*n", v[999], capacity, wrong, alloc_stat(4));
+	pool_free(v);
+	printf("mapped after free %d*n", alloc_stat(4));
+
+	/* freed block is reused by the next allocation of its class */
+	p = pool_alloc(24);
+	pool_free(p);
+	printf("reused %d*n", pool_alloc(20) == p);
+	printf("pool allocs %d, frees %d*n", alloc_stat(2), alloc_stat(3));
+}
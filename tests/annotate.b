@@ -0,0 +1,12 @@
+square(x) {
+	return (x * x);
+}
+
+main() extrn printf; {
+	auto i;
+	i = 0;
+	while (i < 3) {
+		printf("%d*n", square(i));
+		++i;
+	}
+}
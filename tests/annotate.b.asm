@@ -0,0 +1,68 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+; square: frame 32 bytes, 7 instructions
+global square
+square:
+sym_1:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	; (stdin):2: return (x * x);
+	mov rax, rdi
+	imul rax, rdi
+	leave
+	ret
+; main: frame 80 bytes, 28 instructions
+global main
+main:
+sym_3:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 80
+	mov [rbp-72], rbx
+	mov [rbp-80], r12
+	; (stdin):6: auto i;
+	; auto [rbp-8] = i (sized 1)
+	; (stdin):7: i = 0;
+	mov QWORD [rbp-8], 0
+	; (stdin):8: while (i < 3) {
+	mov rax, 0
+	mov rdx, 3
+	cmp rax, rdx
+	jge .local_1
+	mov rbx, [rbp-8]
+	lea r12, [strend-4]
+.local_2:
+	; (stdin):9: printf("%d*n", square(i));
+	mov rdi, rbx
+	xor rax, rax
+	call sym_1
+	mov rdi, r12
+	mov rsi, rax
+	xor rax, rax
+	call printf WRT ..plt
+	; (stdin):10: ++i;
+	inc rbx
+	; (stdin):11: }
+.local_0:
+	; (stdin):8: while (i < 3) {
+	mov rdx, 3
+	cmp rbx, rdx
+	jl .local_2
+.local_3:
+	; (stdin):11: }
+.local_1:
+	; (stdin):12: }
+	xor rax, rax
+	mov rbx, [rbp-72]
+	mov r12, [rbp-80]
+	leave
+	ret
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x25,0x64,0x0a,0x00
+strend:
@@ -0,0 +1,17 @@
+/* Functions of the program named like atomic intrinsics are called instead of them */
+atomic_add(p, v) {
+	*p = *p + 2 * v;
+	return (-1);
+}
+
+spin_pause() extrn printf; {
+	printf("own spin_pause*n");
+}
+
+main() extrn printf, atomic_add, atomic_load, spin_pause; {
+	auto x;
+	x = 10;
+	printf("%d*n", atomic_add(&x, 5));
+	spin_pause();
+	printf("%d*n", atomic_load(&x));
+}
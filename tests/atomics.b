@@ -0,0 +1,70 @@
+/* atomic intrinsics compiled inline and lock-free structures from libb */
+counter;
+lock;
+unlocked;
+stack;
+
+count(i, n) extrn atomic_add; {
+	atomic_add(&counter, n);
+}
+
+locked_count(i, n) extrn spin_lock, spin_unlock; {
+	spin_lock(&lock);
+	unlocked += n;
+	spin_unlock(&lock);
+}
+
+push_node(i, nodes) extrn lifo_push; {
+	lifo_push(&stack, nodes + i * 16);
+}
+
+main() extrn printf, atomic_load, atomic_store, atomic_xchg, atomic_add, atomic_cas, atomic_fence, spin_pause; {
+	extrn parallel_for, spin_trylock, spin_unlock, ring_new, ring_push, ring_pop, ring_free, lifo_pop, pool_alloc;
+	auto x, old, ring, v, i, nodes, node, sum;
+
+	x = 5;
+	printf("%d ", atomic_load(&x));
+	printf("%d ", atomic_store(&x, 7));
+	printf("%d ", atomic_xchg(&x, 9));
+	printf("%d ", atomic_add(&x, -4));
+	printf("%d*n", x);
+
+	old = atomic_cas(&x, 3, 10);
+	printf("%d %d ", old, x);
+	old = atomic_cas(&x, 5, 10);
+	printf("%d %d*n", old, x);
+	atomic_fence();
+	spin_pause();
+
+	parallel_for(0, 1000, &count, 3);
+	parallel_for(0, 1000, &locked_count, 2);
+	printf("%d %d*n", counter, unlocked);
+
+	printf("%d ", spin_trylock(&lock));
+	printf("%d ", spin_trylock(&lock));
+	spin_unlock(&lock);
+	printf("%d*n", spin_trylock(&lock));
+
+	ring = ring_new(3);
+	i = 0;
+	while (ring_push(ring, i * 10)) ++i;
+	printf("%d:", i);
+	while (ring_pop(ring, &v)) printf(" %d", v);
+	printf(" %d*n", ring_pop(ring, &v));
+	ring_free(ring);
+
+	nodes = pool_alloc(100 * 8 * 2);
+	i = 0;
+	while (i < 100) {
+		nodes[2 * i + 1] = i;
+		++i;
+	}
+	parallel_for(0, 100, &push_node, nodes);
+	sum = 0;
+	i = 0;
+	while (node = lifo_pop(&stack)) {
+		sum += node[1];
+		++i;
+	}
+	printf("%d %d*n", i, sum);
+}
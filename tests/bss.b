@@ -0,0 +1,21 @@
+/* globals without non-zero values are reserved in .bss */
+buf[65536];
+zeros 0, 0, 0;
+counter;
+
+/* initialized head followed by zero tail */
+table[1000] 7, 8;
+
+main() extrn printf; {
+	auto i, sum;
+
+	i = 0; sum = 0;
+	while (i < 65536) sum += buf[i++];
+	printf("%d %d %d %d %d*n", sum, zeros, (&zeros)[2], counter, table[999]);
+
+	buf[65535] = 5;
+	counter = buf[65535] + table[0] + table[1];
+	(&zeros)[1] = 3;
+	table[500] = 9;
+	printf("%d %d %d %d %d*n", buf[65535], (&zeros)[1], counter, table[500], table[501]);
+}
@@ -0,0 +1,39 @@
+length(s) extrn char; {
+	auto n;
+	n = 0;
+	while (char(s, n)) ++n;
+	return (n);
+}
+
+upper(s) extrn char, lchar; {
+	auto i, c;
+	i = 0;
+	while (c = char(s, i)) {
+		if (c >= 'a' && c <= 'z') lchar(s, i, c - 'a' + 'A');
+		++i;
+	}
+}
+
+main() extrn printf, malloc, free, char, lchar, u8, i8, u16, i16, u32, i32, i8set, i16set, i32set; {
+	auto s, w;
+
+	s = malloc(16);
+	lchar(s, 0, 'h'); lchar(s, 1, 'e'); lchar(s, 2, 'y'); lchar(s, 3, 0);
+	printf("%s %d*n", s, length(s));
+	upper(s);
+	printf("%s %c*n", s, char(s, 1));
+
+	w = malloc(8);
+	w[0] = -1;
+	printf("%d %d %d*n", u8(w), u16(w), u32(w));
+	printf("%d %d %d*n", i8(w), i16(w), i32(w));
+
+	w[0] = 0;
+	printf("%d*n", i8set(w + 1, 0x7f));
+	i16set(w + 2, 0x1234);
+	i32set(w + 4, -2);
+	printf("%x %x %d %d*n", w[0], u16(w + 2), i32(w + 4), u8(w + 1));
+
+	free(w);
+	free(s);
+}
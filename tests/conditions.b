@@ -0,0 +1,32 @@
+count(n) {
+	auto i, s;
+	i = 0; s = 0;
+	while (i < n && s != 7) {
+		s = s + 1;
+		i++;
+	}
+	return (s);
+}
+
+main() extrn printf; {
+	auto a, b, c, x;
+
+	a = 3; b = 5; c = 0;
+	printf("%d %d %d %d*n", a < b, a > b, !(a < b), !c);
+	printf("%d %d*n", a < b && b < 10, a < b && b > 10);
+	printf("%d %d*n", a > b || b == 5, a > b || c);
+	printf("%d %d*n", (a < b && c) || b == 5, !(a < b || c));
+	printf("%d %d*n", a && b, c || b);
+
+	x = a < b;
+	printf("x = %d*n", x);
+	x = a >= b ? 10 : 20;
+	printf("x = %d*n", x);
+
+	if (a < b && (c == 0 || a == 0)) printf("if 1*n");
+	if (!(a < b) || c) printf("not printed*n");
+	else printf("else 2*n");
+	if (!!a) printf("if 3*n");
+
+	printf("count %d %d*n", count(3), count(100));
+}
@@ -0,0 +1,30 @@
+SIZE 4;
+SHIFT 3;
+GREETING "hello";
+pair 5, 6;
+
+/* modified by another function, so it is not a constant */
+state 1;
+
+/* address is taken, so it is not a constant either */
+escaped 7;
+
+/* read only vector keeps its items in memory */
+primes[] 2, 3, 5, 7;
+
+change() state = 100;
+
+main() extrn printf; {
+	auto v[SIZE], i, p;
+
+	i = 0; while (i < SIZE) { v[i] = i << SHIFT; ++i; }
+	printf("%s %d %d %d*n", GREETING, v[SIZE - 1], pair, primes[3]);
+
+	printf("state = %d*n", state);
+	change();
+	printf("state = %d*n", state);
+
+	p = &escaped;
+	*p = 8;
+	printf("escaped = %d*n", escaped);
+}
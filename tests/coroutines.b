@@ -0,0 +1,53 @@
+/* Coroutines of libb: co_yield interleaves them, co_await_fd suspends until a pipe is readable */
+worker(id) extrn printf, co_yield; {
+	auto i;
+	i = 0;
+	while (i < 3) {
+		printf("worker %d step %d*n", id, i);
+		co_yield();
+		++i;
+	}
+}
+
+/* Answers every message from in with one to out */
+server(fds) extrn printf, read, write, i32, co_await_fd; {
+	auto buf, round;
+	round = 0;
+	while (round < 2) {
+		/* descriptor is added to epoll on the first wait and modified on the second */
+		if (co_await_fd(i32(fds), 1) != 1) printf("unexpected events*n");
+		buf = 0;
+		read(i32(fds), &buf, 8);
+		printf("server got %s*n", &buf);
+		write(i32(fds + 12), "pong", 4);
+		++round;
+	}
+}
+
+client(fds) extrn printf, read, write, i32, co_await_fd; {
+	auto buf, round;
+	round = 0;
+	while (round < 2) {
+		write(i32(fds + 4), "ping", 4);
+		if (co_await_fd(i32(fds + 8), 1) != 1) printf("unexpected events*n");
+		buf = 0;
+		read(i32(fds + 8), &buf, 8);
+		printf("client got %s*n", &buf);
+		++round;
+	}
+}
+
+main() extrn printf, pipe, co_spawn, co_run; {
+	auto fds[2];
+
+	co_spawn(&worker, 1);
+	co_spawn(&worker, 2);
+	printf("run %d*n", co_run());
+
+	/* client writes to the first pipe, server answers through the second one */
+	pipe(fds);
+	pipe(fds + 8);
+	co_spawn(&server, fds);
+	co_spawn(&client, fds);
+	printf("run %d*n", co_run());
+}
@@ -0,0 +1,52 @@
+unused_table[4] "never printed", 1, 2, 3;
+table[2] "table string", 42;
+
+unused_helper() extrn printf; {
+	printf("unused helper*n");
+}
+
+unused(x) {
+	unused_helper();
+	return (x * unused_table[1]);
+}
+
+/* referenced only by its address */
+address_taken() {
+	return (7);
+}
+
+twice(x) {
+	return (x * 2);
+	x = 100;
+}
+
+apply(x) {
+	return (twice(x) + 1);
+}
+
+skip(n) extrn printf; {
+	auto i;
+	i = 0;
+	while (1) {
+		if (i == n) goto done;
+		++i;
+		continue;
+		printf("never*n");
+	}
+	printf("never*n");
+done:
+	return (i);
+}
+
+main() extrn printf, later; {
+	printf("%d %d*n", apply(5), skip(3));
+	printf("%s %d*n", table[0], table[1]);
+	later();
+	printf("%d*n", &address_taken != 0);
+	return (0);
+	printf("never*n");
+}
+
+later() extrn printf; {
+	printf("called through extrn*n");
+}
@@ -0,0 +1,131 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+	extern later
+global address_taken
+address_taken:
+sym_7:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 16
+	mov rax, 7
+	leave
+	ret
+global twice
+twice:
+sym_8:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	mov rax, rdi
+	imul rax, 2
+	leave
+	ret
+global apply
+apply:
+sym_10:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 64
+	xor rax, rax
+	call sym_8
+	add rax, 1
+	leave
+	ret
+global skip
+skip:
+sym_12:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 80
+	mov [rbp-72], rbx
+	mov [rbp-80], r12
+	; auto [rbp-16] = i (sized 1)
+	mov rbx, 0
+	mov r12, rdi
+.local_2:
+	cmp rbx, r12
+	je .local_7
+.local_3:
+	inc rbx
+.local_0:
+	mov rax, 1
+	test rax, rax
+	jmp .local_2
+.local_7:
+	mov [rbp-16], rbx
+.label_0:
+	mov rax, [rbp-16]
+	mov rbx, [rbp-72]
+	mov r12, [rbp-80]
+	leave
+	ret
+global main
+main:
+sym_16:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 64
+	lea rax, [strend-20]
+	mov [rbp-8], rax
+	mov rdi, 5
+	xor rax, rax
+	call sym_10
+	mov [rbp-24], rax
+	mov rdi, 3
+	xor rax, rax
+	call sym_12
+	mov rdi, [rbp-8]
+	mov rsi, [rbp-24]
+	mov rdx, rax
+	xor rax, rax
+	call printf WRT ..plt
+	lea rax, [strend-27]
+	mov [rbp-8], rax
+	mov rax, [sym_2]
+	mov [rbp-24], rax
+	mov rax, [sym_2]
+	mov rcx, 1
+	lea rax, [rax+rcx*8]
+	mov rdi, [rbp-8]
+	mov rsi, [rbp-24]
+	mov rsi, [rsi]
+	mov rdx, [rax]
+	xor rax, rax
+	call printf WRT ..plt
+	xor rax, rax
+	call later WRT ..plt
+	lea rax, [strend-24]
+	mov [rbp-8], rax
+	lea rax, [sym_7]
+	mov rdx, 0
+	cmp rax, rdx
+	mov rdi, [rbp-8]
+	setne r11b
+	movzx rsi, r11b
+	xor rax, rax
+	call printf WRT ..plt
+	mov rax, 0
+	leave
+	ret
+global later
+later:
+sym_19:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 16
+	lea rdi, [strend-49]
+	xor rax, rax
+	call printf WRT ..plt
+	leave
+	ret
+section ".data" write
+vec_2:
+	dq strend - 13,42
+section ".data.rel.ro" progbits alloc write align=8
+sym_2: dq vec_2
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x63,0x61,0x6c,0x6c,0x65,0x64,0x20,0x74,0x68,0x72,0x6f,0x75,0x67,0x68,0x20,0x65,0x78,0x74,0x72,0x6e,0x0a,0x00,0x25,0x73,0x20,0x25,0x64,0x0a,0x00,0x25,0x64,0x20,0x25,0x64,0x0a,0x00,0x74,0x61,0x62,0x6c,0x65,0x20,0x73,0x74,0x72,0x69,0x6e,0x67,0x00
+strend:
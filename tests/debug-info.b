@@ -0,0 +1,16 @@
+/* i and s live in registers inside the loop, so they have no location */
+sum(v, n) {
+	auto i, s;
+	i = 0; s = 0;
+	while (i < n) {
+		s += v[i];
+		++i;
+	}
+	return (s);
+}
+
+main() extrn printf; {
+	auto nums[4];
+	nums[0] = 1; nums[1] = 2; nums[2] = 3; nums[3] = 4;
+	printf("%d*n", sum(nums, 4));
+}
@@ -0,0 +1,310 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+global sum:function (sym_1.pc_40 - sym_1)
+sum:
+sym_1:
+	push rbp
+.pc_1:
+	mov rbp, rsp
+.pc_2:
+	sub rsp, 176
+	mov [rbp-136], rbx
+	mov [rbp-144], r12
+	mov [rbp-152], r13
+	mov [rbp-160], r14
+	mov [rbp-168], r15
+.pc_8:
+	mov [rbp-16], rsi
+	mov [rbp-24], rdi
+.pc_10:
+	; auto [rbp-32] = i (sized 1)
+	; auto [rbp-40] = s (sized 1)
+.pc_12:
+	mov QWORD [rbp-32], 0
+	mov QWORD [rbp-40], 0
+.pc_14:
+	mov rax, 0
+	cmp rax, rsi
+	jge .local_1
+	mov rbx, [rbp-32]
+	mov r12, [rbp-40]
+	mov r13, [rbp-24]
+	mov r14, [rbp-16]
+	lea r15, [r13+rbx*8]
+.local_2:
+.pc_23:
+	add r12, [r15]
+.pc_24:
+	inc rbx
+	add r15, 8
+.pc_26:
+.local_0:
+.pc_27:
+	cmp rbx, r14
+	jl .local_2
+.local_3:
+	mov [rbp-40], r12
+.pc_31:
+.local_1:
+.pc_32:
+	mov rax, [rbp-40]
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	mov r14, [rbp-160]
+	mov r15, [rbp-168]
+	leave
+.pc_39:
+	ret
+.pc_40:
+global main:function (sym_6.pc_37 - sym_6)
+main:
+sym_6:
+	push rbp
+.pc_1:
+	mov rbp, rsp
+.pc_2:
+	sub rsp, 128
+.pc_3:
+	; auto [rbp-32] = nums (sized 4)
+.pc_4:
+	lea rax, [rbp-32]
+	mov [rbp-56], rax
+	mov rax, 1
+	mov rcx, [rbp-56]
+	mov [rcx], rax
+	lea rax, [rbp-24]
+	mov [rbp-56], rax
+	mov rax, 2
+	mov rcx, [rbp-56]
+	mov [rcx], rax
+	lea rax, [rbp-16]
+	mov [rbp-56], rax
+	mov rax, 3
+	mov rcx, [rbp-56]
+	mov [rcx], rax
+	lea rax, [rbp-8]
+	mov [rbp-56], rax
+	mov rax, 4
+	mov rcx, [rbp-56]
+	mov [rcx], rax
+.pc_24:
+	lea rax, [strend-4]
+	mov [rbp-40], rax
+	lea rdi, [rbp-32]
+	mov rsi, 4
+	xor rax, rax
+	call sym_1
+	mov rdi, [rbp-40]
+	mov rsi, rax
+	xor rax, rax
+	call printf WRT ..plt
+.pc_34:
+	xor rax, rax
+	leave
+.pc_36:
+	ret
+.pc_37:
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x25,0x64,0x0a,0x00
+strend:
+section .eh_frame progbits alloc noexec nowrite align=8
+__b_cie:
+	dd __b_cie_end - __b_cie - 4
+	dd 0 ; CIE id
+	db 1,0x7a,0x52,0x00,1,0x78,16 ; version, "zR", code and data alignment, return address column
+	db 1,0x1b ; augmentation: FDE addresses are pc relative
+	db 0x0c,0x07,0x08,0x90,0x01 ; DW_CFA_def_cfa rsp 8, DW_CFA_offset rip
+	times 2 db 0
+__b_cie_end:
+__b_fde_1:
+	dd __b_fde_1_end - __b_fde_1 - 4
+	dd __b_fde_1 + 4 - __b_cie
+	dd sym_1 - $
+	dd sym_1.pc_40 - sym_1
+	db 0 ; augmentation data length
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_1.pc_1 - sym_1
+	db 0x0e,0x10,0x86,0x02 ; DW_CFA_def_cfa_offset 16, DW_CFA_offset rbp
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_1.pc_2 - sym_1.pc_1
+	db 0x0d,0x06 ; DW_CFA_def_cfa_register rbp
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_1.pc_8 - sym_1.pc_2
+	db 0x83,0x13 ; DW_CFA_offset rbx
+	db 0x8c,0x14 ; DW_CFA_offset r12
+	db 0x8d,0x15 ; DW_CFA_offset r13
+	db 0x8e,0x16 ; DW_CFA_offset r14
+	db 0x8f,0x17 ; DW_CFA_offset r15
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_1.pc_39 - sym_1.pc_8
+	db 0x0a,0x0c,0x07,0x08,0xc6 ; DW_CFA_remember_state, DW_CFA_def_cfa rsp 8, DW_CFA_restore rbp
+	db 0xc3 ; DW_CFA_restore rbx
+	db 0xcc ; DW_CFA_restore r12
+	db 0xcd ; DW_CFA_restore r13
+	db 0xce ; DW_CFA_restore r14
+	db 0xcf ; DW_CFA_restore r15
+	times 1 db 0
+__b_fde_1_end:
+__b_fde_6:
+	dd __b_fde_6_end - __b_fde_6 - 4
+	dd __b_fde_6 + 4 - __b_cie
+	dd sym_6 - $
+	dd sym_6.pc_37 - sym_6
+	db 0 ; augmentation data length
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_6.pc_1 - sym_6
+	db 0x0e,0x10,0x86,0x02 ; DW_CFA_def_cfa_offset 16, DW_CFA_offset rbp
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_6.pc_2 - sym_6.pc_1
+	db 0x0d,0x06 ; DW_CFA_def_cfa_register rbp
+	db 0x04 ; DW_CFA_advance_loc4
+	dd sym_6.pc_36 - sym_6.pc_2
+	db 0x0a,0x0c,0x07,0x08,0xc6 ; DW_CFA_remember_state, DW_CFA_def_cfa rsp 8, DW_CFA_restore rbp
+	times 5 db 0
+__b_fde_6_end:
+section .debug_abbrev progbits noalloc noexec nowrite align=1
+__b_abbrev:
+	db 1,0x11,1,0x25,0x08,0x13,0x05,0x03,0x08,0x1b,0x08,0x10,0x17,0x11,0x01,0x55,0x17,0,0 ; compile unit
+	db 2,0x2e,1,0x03,0x08,0x3f,0x19,0x11,0x01,0x12,0x06,0x40,0x18,0x3a,0x0b,0x3b,0x0f,0,0 ; subprogram
+	db 3,0x34,0,0x03,0x08,0x02,0x18,0x49,0x13,0,0 ; variable
+	db 4,0x24,0,0x03,0x08,0x3e,0x0b,0x0b,0x0b,0,0 ; base type
+	db 5,0x34,0,0x03,0x08,0x49,0x13,0,0 ; variable without location
+	db 0
+section .debug_info progbits noalloc noexec nowrite align=1
+__b_info:
+	dd __b_info_end - __b_info - 4
+	dw 4
+	dd __b_abbrev
+	db 8 ; address size
+	db 1 ; compile unit
+	db 0x62,0x00
+	dw 1 ; DW_LANG_C89, the closest to B
+	db 0x28,0x73,0x74,0x64,0x69,0x6e,0x29,0x00
+	db 0x2e,0x00
+	dd __b_line
+	dq 0
+	dd __b_ranges
+__b_word:
+	db 4 ; base type
+	db 0x77,0x6f,0x72,0x64,0x00
+	db 0x05,8 ; DW_ATE_signed
+	db 2 ; subprogram
+	db 0x73,0x75,0x6d,0x00
+	dq sym_1
+	dd sym_1.pc_40 - sym_1
+	db 0x01,0x9c,0x01,0x02 ; frame base DW_OP_call_frame_cfa, file, line
+	db 3 ; variable
+	db 0x6e,0x00
+	db 0x02,0x91,0x60 ; DW_OP_fbreg
+	dd __b_word - __b_info
+	db 3 ; variable
+	db 0x76,0x00
+	db 0x02,0x91,0x58 ; DW_OP_fbreg
+	dd __b_word - __b_info
+	db 5 ; variable without location
+	db 0x69,0x00
+	dd __b_word - __b_info
+	db 5 ; variable without location
+	db 0x73,0x00
+	dd __b_word - __b_info
+	db 0
+	db 2 ; subprogram
+	db 0x6d,0x61,0x69,0x6e,0x00
+	dq sym_6
+	dd sym_6.pc_37 - sym_6
+	db 0x01,0x9c,0x01,0x0c ; frame base DW_OP_call_frame_cfa, file, line
+	db 3 ; variable
+	db 0x6e,0x75,0x6d,0x73,0x00
+	db 0x03,0x91,0x50,0x9f ; DW_OP_fbreg, DW_OP_stack_value
+	dd __b_word - __b_info
+	db 0
+	db 0
+__b_info_end:
+section .debug_ranges progbits noalloc noexec nowrite align=1
+__b_ranges:
+	dq sym_1, sym_1.pc_40
+	dq sym_6, sym_6.pc_37
+	dq 0, 0
+section .debug_line progbits noalloc noexec nowrite align=1
+__b_line:
+	dd __b_line_end - __b_line - 4
+	dw 4
+	dd __b_line_program - __b_line - 10
+	db 1,1,1,0xfb,14,13 ; instruction length, ops per instruction, is_stmt, line base and range, opcode base
+	db 0,1,1,1,1,0,0,0,1,0,0,1 ; lengths of standard opcodes
+	db 0 ; no include directories
+	db 0x28,0x73,0x74,0x64,0x69,0x6e,0x29,0x00
+	db 0,0,0 ; directory, time and size
+	db 0 ; end of files
+__b_line_program:
+	db 0x00,0x09,0x02 ; DW_LNE_set_address
+	dq sym_1
+	db 0x03,0x01,0x01 ; DW_LNS_advance_line, DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_10 - sym_1
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_12 - sym_1.pc_10
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_14 - sym_1.pc_12
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_23 - sym_1.pc_14
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_24 - sym_1.pc_23
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_26 - sym_1.pc_24
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x7d ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_27 - sym_1.pc_26
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x03 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_31 - sym_1.pc_27
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_32 - sym_1.pc_31
+	db 0x01 ; DW_LNS_copy
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_1.pc_40 - sym_1.pc_32
+	db 0x00,0x01,0x01 ; DW_LNE_end_sequence
+	db 0x00,0x09,0x02 ; DW_LNE_set_address
+	dq sym_6
+	db 0x03,0x0b,0x01 ; DW_LNS_advance_line, DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_6.pc_3 - sym_6
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_6.pc_4 - sym_6.pc_3
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_6.pc_24 - sym_6.pc_4
+	db 0x01 ; DW_LNS_copy
+	db 0x03,0x01 ; DW_LNS_advance_line
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_6.pc_34 - sym_6.pc_24
+	db 0x01 ; DW_LNS_copy
+	db 0x09 ; DW_LNS_fixed_advance_pc
+	dw sym_6.pc_37 - sym_6.pc_34
+	db 0x00,0x01,0x01 ; DW_LNE_end_sequence
+__b_line_end:
@@ -0,0 +1,4 @@
+/* Modules share one global scope, so both of them can't define f */
+f() {
+	return(1);
+}
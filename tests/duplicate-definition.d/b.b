@@ -0,0 +1,7 @@
+main() extrn f; {
+	f();
+}
+
+f() {
+	return(2);
+}
@@ -0,0 +1,32 @@
+counter;
+limit 3;
+values[3] 10, 20, 30;
+pointer;
+
+bump() {
+	++counter;
+	counter++;
+	counter += 10;
+	return (counter);
+}
+
+main() extrn printf, fputs, stdout; {
+	auto i;
+
+	i = 0;
+	while (i < limit) { bump(); ++i; }
+	printf("counter = %d*n", counter);
+
+	/* globals through pointers */
+	pointer = &counter;
+	*pointer = 5;
+	printf("counter = %d, deref = %d*n", counter, *pointer);
+	pointer = values;
+	printf("%d %d*n", *pointer, values[2]);
+	--values[1];
+	printf("%d*n", values[1]);
+
+	/* extrn data is reached through GOT */
+	fputs("to stdout*n", stdout);
+	printf("%d*n", &stdout != 0);
+}
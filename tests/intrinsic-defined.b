@@ -0,0 +1,10 @@
+/* Function of the program named like an intrinsic is called instead of the intrinsic */
+main() extrn printf, u8, u16; {
+	auto x;
+	x = 300;
+	printf("%d %d*n", u8(&x), u16(&x));
+}
+
+u8(p) {
+	return (42);
+}
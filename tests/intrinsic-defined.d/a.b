@@ -0,0 +1,6 @@
+/* Function named like an intrinsic in another module is called instead of it, with its own number of arguments */
+main() extrn printf, u8, i32; {
+	auto x;
+	x = -300;
+	printf("%d %d*n", u8(&x, 1), i32(&x));
+}
@@ -0,0 +1,3 @@
+u8(p, q) {
+	return (42 + q);
+}
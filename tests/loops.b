@@ -0,0 +1,67 @@
+sum(v, n) {
+	auto i, s;
+	i = 0; s = 0;
+	while (i < n) s += v[i++];
+	return (s);
+}
+
+find(v, n, x) {
+	auto i;
+	i = 0;
+	while (i < n) {
+		if (v[i] == x) return (i);
+		++i;
+	}
+	return (-1);
+}
+
+fib(n) {
+	auto a, b, t;
+	a = 0; b = 1;
+	while (n-- > 0) {
+		t = a + b;
+		a = b;
+		b = t;
+	}
+	return (a);
+}
+
+main() extrn printf; {
+	auto v[8], i, j, p, count;
+
+	i = 0; while (i < 8) { v[i] = i * i; ++i; }
+	printf("i = %d, sum = %d*n", i, sum(v, 8));
+	printf("find %d %d*n", find(v, 8, 25), find(v, 8, 26));
+
+	/* calls inside of the loop keep loop variables */
+	i = 0; while (i < 10) { printf("%d ", fib(i)); ++i; }
+	printf("*n");
+
+	/* break, continue and nested loops */
+	count = 0; i = 0;
+	while (1) {
+		if (i >= 5) break;
+		j = 0;
+		while (j < 5) {
+			++j;
+			if (j == 2) continue;
+			count += i * j;
+		}
+		++i;
+	}
+	printf("count = %d, i = %d, j = %d*n", count, i, j);
+
+	/* variable modified through pointer inside of the loop */
+	i = 0; p = &j; j = 0;
+	while (i < 3) { *p += 10; ++i; }
+	printf("j = %d*n", j);
+
+	/* leaving loop with goto */
+	i = 0;
+	while (i < 100) {
+		if (i == 7) goto out;
+		++i;
+	}
+out:
+	printf("out at %d*n", i);
+}
@@ -0,0 +1,333 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+global sum
+sum:
+sym_1:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 176
+	mov [rbp-136], rbx
+	mov [rbp-144], r12
+	mov [rbp-152], r13
+	mov [rbp-160], r14
+	mov [rbp-168], r15
+	mov [rbp-16], rsi
+	mov [rbp-24], rdi
+	; auto [rbp-32] = i (sized 1)
+	; auto [rbp-40] = s (sized 1)
+	mov QWORD [rbp-32], 0
+	mov QWORD [rbp-40], 0
+	mov rax, 0
+	cmp rax, rsi
+	jge .local_1
+	mov rbx, [rbp-32]
+	mov r12, [rbp-40]
+	mov r13, [rbp-24]
+	mov r14, [rbp-16]
+	lea r15, [r13+rbx*8]
+.local_2:
+	inc rbx
+	add r15, 8
+	add r12, [r15-8]
+.local_0:
+	cmp rbx, r14
+	jl .local_2
+.local_39:
+	mov [rbp-40], r12
+.local_1:
+	mov rax, [rbp-40]
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	mov r14, [rbp-160]
+	mov r15, [rbp-168]
+	leave
+	ret
+global find
+find:
+sym_6:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 176
+	mov [rbp-136], rbx
+	mov [rbp-144], r12
+	mov [rbp-152], r13
+	mov [rbp-160], r14
+	mov [rbp-168], r15
+	mov [rbp-8], rdx
+	mov [rbp-16], rsi
+	mov [rbp-24], rdi
+	; auto [rbp-32] = i (sized 1)
+	mov QWORD [rbp-32], 0
+	mov rax, 0
+	cmp rax, rsi
+	jge .local_4
+	mov rbx, [rbp-32]
+	mov r12, [rbp-24]
+	mov r13, [rbp-8]
+	mov r14, [rbp-16]
+	lea r15, [r12+rbx*8]
+.local_5:
+	cmp QWORD [r15], r13
+	jne .local_6
+	mov rax, rbx
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	mov r14, [rbp-160]
+	mov r15, [rbp-168]
+	leave
+	ret
+.local_6:
+	inc rbx
+	add r15, 8
+.local_3:
+	cmp rbx, r14
+	jl .local_5
+.local_40:
+.local_4:
+	mov QWORD [rbp-40], 1
+	neg QWORD [rbp-40]
+	mov rax, [rbp-40]
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	mov r14, [rbp-160]
+	mov r15, [rbp-168]
+	leave
+	ret
+global fib
+fib:
+sym_11:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 160
+	mov [rbp-136], rbx
+	mov [rbp-144], r12
+	mov [rbp-152], r13
+	mov [rbp-8], rdi
+	; auto [rbp-16] = a (sized 1)
+	; auto [rbp-24] = b (sized 1)
+	; auto [rbp-32] = t (sized 1)
+	mov QWORD [rbp-16], 0
+	mov QWORD [rbp-24], 1
+	dec QWORD [rbp-8]
+	test rdi, rdi
+	jle .local_10
+	mov rbx, [rbp-24]
+	mov r12, [rbp-16]
+	mov r13, [rbp-8]
+.local_11:
+	mov rax, r12
+	add rax, rbx
+	mov r12, rbx
+	mov rbx, rax
+.local_9:
+	mov rax, r13
+	dec r13
+	test rax, rax
+	jg .local_11
+.local_41:
+	mov [rbp-16], r12
+.local_10:
+	mov rax, [rbp-16]
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	leave
+	ret
+global main
+main:
+sym_16:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 288
+	mov [rbp-264], rbx
+	mov [rbp-272], r12
+	mov [rbp-280], r13
+	mov [rbp-288], r14
+	; auto [rbp-64] = v (sized 8)
+	; auto [rbp-72] = i (sized 1)
+	; auto [rbp-80] = j (sized 1)
+	; auto [rbp-88] = p (sized 1)
+	; auto [rbp-96] = count (sized 1)
+	mov QWORD [rbp-72], 0
+	mov rax, 0
+	mov rdx, 8
+	cmp rax, rdx
+	jge .local_13
+	lea rbx, [rbp-64]
+.local_14:
+	mov rcx, [rbp-72]
+	lea r12, [rbx+rcx*8]
+	mov rax, rcx
+	imul rax, rax
+	mov rcx, r12
+	mov [rcx], rax
+	inc QWORD [rbp-72]
+.local_12:
+	mov rax, [rbp-72]
+	mov rdx, 8
+	cmp rax, rdx
+	jl .local_14
+.local_42:
+.local_13:
+	lea rax, [strend-18]
+	mov [rbp-104], rax
+	lea rdi, [rbp-64]
+	mov rsi, 8
+	xor rax, rax
+	call sym_1
+	mov rdi, [rbp-104]
+	mov rsi, [rbp-72]
+	mov rdx, rax
+	xor rax, rax
+	call printf WRT ..plt
+	lea rax, [strend-30]
+	mov [rbp-104], rax
+	lea rdi, [rbp-64]
+	mov rsi, 8
+	mov rdx, 25
+	xor rax, rax
+	call sym_6
+	mov [rbp-136], rax
+	lea rdi, [rbp-64]
+	mov rsi, 8
+	mov rdx, 26
+	xor rax, rax
+	call sym_6
+	mov rdi, [rbp-104]
+	mov rsi, [rbp-136]
+	mov rdx, rax
+	xor rax, rax
+	call printf WRT ..plt
+	mov QWORD [rbp-72], 0
+	mov rax, 0
+	mov rdx, 10
+	cmp rax, rdx
+	jge .local_16
+	lea rbx, [strend-34]
+.local_17:
+	mov rdi, [rbp-72]
+	xor rax, rax
+	call sym_11
+	mov rdi, rbx
+	mov rsi, rax
+	xor rax, rax
+	call printf WRT ..plt
+	inc QWORD [rbp-72]
+.local_15:
+	mov rax, [rbp-72]
+	mov rdx, 10
+	cmp rax, rdx
+	jl .local_17
+.local_43:
+.local_16:
+	lea rdi, [strend-20]
+	xor rax, rax
+	call printf WRT ..plt
+	mov QWORD [rbp-72], 0
+	mov r13, 0
+	mov r14, [rbp-152]
+.local_20:
+	cmp QWORD [rbp-72], 5
+	jge .local_45
+.local_21:
+	mov QWORD [rbp-80], 0
+	cmp QWORD [rbp-80], 5
+	jge .local_25
+	mov rbx, r13
+	mov r12, r14
+.local_26:
+	inc QWORD [rbp-80]
+	cmp QWORD [rbp-80], 2
+	je .local_24
+.local_27:
+	mov rax, [rbp-72]
+	imul rax, [rbp-80]
+	mov r12, rax
+	add rbx, r12
+.local_24:
+	cmp QWORD [rbp-80], 5
+	jl .local_26
+.local_44:
+	mov r13, rbx
+	mov r14, r12
+.local_25:
+	inc QWORD [rbp-72]
+.local_18:
+	mov rax, 1
+	test rax, rax
+	jmp .local_20
+.local_45:
+	mov [rbp-96], r13
+.local_19:
+	lea rdi, [strend-62]
+	mov rsi, [rbp-96]
+	mov rdx, [rbp-72]
+	mov rcx, [rbp-80]
+	xor rax, rax
+	call printf WRT ..plt
+	mov QWORD [rbp-72], 0
+	lea rax, [rbp-80]
+	mov [rbp-88], rax
+	mov QWORD [rbp-80], 0
+	mov rax, [rbp-72]
+	mov rdx, 3
+	cmp rax, rdx
+	jge .local_31
+	mov rbx, [rbp-88]
+.local_32:
+	mov rax, [rbx]
+	add rax, 10
+	mov rcx, rbx
+	mov [rcx], rax
+	inc QWORD [rbp-72]
+.local_30:
+	mov rax, [rbp-72]
+	mov rdx, 3
+	cmp rax, rdx
+	jl .local_32
+.local_31:
+	lea rdi, [strend-42]
+	mov rsi, [rbp-80]
+	xor rax, rax
+	call printf WRT ..plt
+	mov QWORD [rbp-72], 0
+	mov rax, 0
+	mov rdx, 100
+	cmp rax, rdx
+	jge .local_34
+.local_35:
+	mov rax, [rbp-72]
+	mov rdx, 7
+	cmp rax, rdx
+	je .label_0
+.local_36:
+	inc QWORD [rbp-72]
+.local_33:
+	mov rax, [rbp-72]
+	mov rdx, 100
+	cmp rax, rdx
+	jl .local_35
+.local_34:
+.label_0:
+	lea rdi, [strend-73]
+	mov rsi, [rbp-72]
+	xor rax, rax
+	call printf WRT ..plt
+	xor rax, rax
+	mov rbx, [rbp-264]
+	mov r12, [rbp-272]
+	mov r13, [rbp-280]
+	mov r14, [rbp-288]
+	leave
+	ret
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x6f,0x75,0x74,0x20,0x61,0x74,0x20,0x25,0x64,0x0a,0x00,0x63,0x6f,0x75,0x6e,0x74,0x20,0x3d,0x20,0x25,0x64,0x2c,0x20,0x69,0x20,0x3d,0x20,0x25,0x64,0x2c,0x20,0x6a,0x20,0x3d,0x20,0x25,0x64,0x0a,0x00,0x25,0x64,0x20,0x00,0x66,0x69,0x6e,0x64,0x20,0x25,0x64,0x20,0x25,0x64,0x0a,0x00,0x69,0x20,0x3d,0x20,0x25,0x64,0x2c,0x20,0x73,0x75,0x6d,0x20,0x3d,0x20,0x25,0x64,0x0a,0x00
+strend:
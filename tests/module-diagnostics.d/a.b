@@ -0,0 +1,4 @@
+/* Errors are reported with the file and line of the module that holds them */
+main() extrn printf, twice; {
+	printf("%d*n", twice(21));
+}
@@ -0,0 +1,3 @@
+twice(x) {
+	return(x + x;
+}
@@ -0,0 +1,62 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+global main
+main:
+sym_1:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 80
+	mov [rbp-72], rbx
+	mov [rbp-80], r12
+	; auto [rbp-16] = i (sized 1)
+	mov QWORD [rbp-16], 0
+	mov rax, 0
+	mov rdx, 10
+	cmp rax, rdx
+	jge .local_1
+	mov rbx, [rbp-16]
+.local_2:
+	mov rdi, rbx
+	xor rax, rax
+	call sym_9
+	mov r12, rax
+	mov rax, [sym_8]
+	add rax, r12
+	lea rcx, [sym_8]
+	mov [rcx], rax
+	inc rbx
+.local_0:
+	mov rdx, 10
+	cmp rbx, rdx
+	jl .local_2
+.local_3:
+.local_1:
+	lea rdi, [strend-29]
+	mov rsi, 10
+	mov rdx, [sym_8]
+	xor rax, rax
+	call printf WRT ..plt
+	xor rax, rax
+	mov rbx, [rbp-72]
+	mov r12, [rbp-80]
+	leave
+	ret
+global square
+square:
+sym_9:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	mov rax, rdi
+	imul rax, rdi
+	leave
+	ret
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+sym_8: resq 1
+section ".rodata"
+db 0x00,0x73,0x75,0x6d,0x20,0x6f,0x66,0x20,0x73,0x71,0x75,0x61,0x72,0x65,0x73,0x20,0x62,0x65,0x6c,0x6f,0x77,0x20,0x25,0x64,0x3a,0x20,0x25,0x64,0x0a,0x00
+strend:
@@ -0,0 +1,11 @@
+/* Modules compiled together: extrn of a function of util.b is a direct call, of its never written global the constant */
+main() extrn printf, square, limit, total; {
+	auto i;
+
+	i = 0;
+	while (i < limit) {
+		total += square(i);
+		++i;
+	}
+	printf("sum of squares below %d: %d*n", limit, total);
+}
@@ -0,0 +1,6 @@
+limit 10;
+total;
+
+square(x) {
+	return(x * x);
+}
@@ -0,0 +1,15 @@
+/* Statically linked with libb-nolibc.a: output is buffered by libb and
+   written by exit after main returns, the last line has no newline */
+main() extrn putchar, putstr, printn; {
+	printn(255, 16); putchar(' ');
+	printn(255, 8); putchar(' ');
+	printn(5, 2); putchar(' ');
+	printn(71, 36); putchar('*n');
+
+	printn(0, 10); putchar(' ');
+	printn(-7, 10); putchar(' ');
+	printn(-1234567, 10); putchar(' ');
+	printn(-1, 16); putchar('*n');
+
+	putstr("flushed at exit");
+}
@@ -0,0 +1,28 @@
+/* Stores through pointers must not be forwarded past by the optimizer */
+main() extrn printf; {
+	auto a, p, v[3], x, i;
+
+	a = 1;
+	p = &a;
+	*p = 2;
+	printf("a = %d*n", a);
+
+	v[0] = 10;
+	p = v;
+	p[0] = 20;
+	printf("v[0] = %d*n", v[0]);
+
+	x = 3;
+	p = &x;
+	x = x + 1;
+	*p = *p * 2;
+	printf("x = %d*n", x);
+
+	i = 0;
+	x = 0;
+	while (i < 5) {
+		x = x + i;
+		i = i + 1;
+	}
+	printf("x = %d, i = %d*n", x, i);
+}
@@ -0,0 +1,4 @@
+/* --profile-use with the profile of another program is an error instead of laying out code by unrelated counts */
+main() extrn printf; {
+	printf("hello*n");
+}
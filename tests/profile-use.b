@@ -0,0 +1,30 @@
+/* --profile-use with a fixed profile: hot and cold sections, cold if arms placed after the function, hot cases tested first */
+never() extrn printf; {
+	printf("never called*n");
+}
+
+step(x) {
+	if (x < 0) return(-x);
+	return(x + 1);
+}
+
+kind(x) {
+	switch (x) {
+	case 1: return(10);
+	case 2: return(20);
+	case 3: return(30);
+	}
+	return(0);
+}
+
+main() extrn printf; {
+	auto i, sum;
+
+	i = sum = 0;
+	while (i < 100) {
+		sum += step(i) + kind(3);
+		++i;
+	}
+	if (sum < 0) never();
+	printf("sum %d, never %d*n", sum, step(-5));
+}
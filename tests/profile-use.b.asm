@@ -0,0 +1,153 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+section ".text.unlikely" progbits alloc exec nowrite align=16
+global never
+never:
+sym_1:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	lea rdi, [strend-14]
+	xor rax, rax
+	call printf WRT ..plt
+	leave
+	ret
+section ".text.hot" progbits alloc exec nowrite align=16
+global step
+step:
+sym_3:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	mov [rbp-8], rdi
+	test rdi, rdi
+	jl .local_2
+.local_0:
+	mov rax, [rbp-8]
+	add rax, 1
+	leave
+	ret
+.local_2:
+	neg QWORD [rbp-8]
+	mov rax, [rbp-8]
+	leave
+	ret
+section ".text.hot" progbits alloc exec nowrite align=16
+global kind
+kind:
+sym_5:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 64
+	mov [rbp-8], rdi
+	cmp rdi, 3
+	je .local_9
+.local_3:
+	cmp QWORD [rbp-8], 1
+	jne .local_6
+.local_5:
+	mov rax, 10
+	leave
+	ret
+.local_6:
+	cmp QWORD [rbp-8], 2
+	jne .local_8
+.local_7:
+	mov rax, 20
+	leave
+	ret
+.local_8:
+	cmp QWORD [rbp-8], 3
+	jne .local_10
+.local_9:
+	mov rax, 30
+	leave
+	ret
+.local_10:
+.local_4:
+	mov rax, 0
+	leave
+	ret
+section ".text" progbits alloc exec nowrite align=16
+global main
+main:
+sym_7:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 176
+	mov [rbp-136], rbx
+	mov [rbp-144], r12
+	mov [rbp-152], r13
+	mov [rbp-160], r14
+	mov [rbp-168], r15
+	; auto [rbp-8] = i (sized 1)
+	; auto [rbp-16] = sum (sized 1)
+	mov QWORD [rbp-16], 0
+	mov QWORD [rbp-8], 0
+	mov rax, 0
+	mov rdx, 100
+	cmp rax, rdx
+	jge .local_12
+	mov rbx, [rbp-8]
+	mov r12, [rbp-16]
+.local_13:
+	mov rdi, rbx
+	xor rax, rax
+	call sym_3
+	mov r13, rax
+	mov rdi, 3
+	xor rax, rax
+	call sym_5
+	mov r14, rax
+	mov rax, r13
+	add rax, r14
+	mov r15, rax
+	mov rax, r12
+	mov rcx, r15
+	add rax, rcx
+	mov r12, rax
+	inc rbx
+.local_11:
+	mov rdx, 100
+	cmp rbx, rdx
+	jl .local_13
+.local_17:
+	mov [rbp-16], r12
+.local_12:
+	mov rax, [rbp-16]
+	mov rdx, 0
+	cmp rax, rdx
+	jl .local_16
+.local_14:
+	lea rax, [strend-32]
+	mov [rbp-24], rax
+	mov QWORD [rbp-32], 5
+	neg QWORD [rbp-32]
+	mov rdi, [rbp-32]
+	xor rax, rax
+	call sym_3
+	mov rdi, [rbp-24]
+	mov rsi, [rbp-16]
+	mov rdx, rax
+	xor rax, rax
+	call printf WRT ..plt
+	xor rax, rax
+	mov rbx, [rbp-136]
+	mov r12, [rbp-144]
+	mov r13, [rbp-152]
+	mov r14, [rbp-160]
+	mov r15, [rbp-168]
+	leave
+	ret
+.local_16:
+	xor rax, rax
+	call sym_1
+	jmp .local_14
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x73,0x75,0x6d,0x20,0x25,0x64,0x2c,0x20,0x6e,0x65,0x76,0x65,0x72,0x20,0x25,0x64,0x0a,0x00,0x6e,0x65,0x76,0x65,0x72,0x20,0x63,0x61,0x6c,0x6c,0x65,0x64,0x0a,0x00
+strend:
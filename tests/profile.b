@@ -0,0 +1,25 @@
+/* -finstrument=blocks: calls of functions, executions of labels and calling contexts in prof.data */
+fib(n) {
+	if (n < 2) return(n);
+	return(fib(n - 1) + fib(n - 2));
+}
+
+classify(x) {
+	switch (x % 3) {
+	case 0: return(0);
+	case 1: return(1);
+	}
+	return(2);
+}
+
+main() extrn printf; {
+	auto i, counts[3];
+
+	counts[0] = counts[1] = counts[2] = 0;
+	i = 0;
+	while (i < 10) {
+		counts[classify(i)] += 1;
+		++i;
+	}
+	printf("fib(10) = %d, classes %d %d %d*n", fib(10), counts[0], counts[1], counts[2]);
+}
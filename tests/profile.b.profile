@@ -0,0 +1,26 @@
+function fib 177
+block fib 2 89
+block fib 0 88
+function classify 10
+block classify 3 10
+block classify 5 4
+block classify 6 6
+block classify 7 3
+block classify 8 3
+block classify 4 3
+function main 1
+block main 11 10
+block main 9 10
+block main 10 1
+stack main;fib;fib;fib;fib;fib;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib;fib
+stack main;fib;fib;fib;fib
+stack main;fib;fib;fib
+stack main;fib;fib
+stack main;fib
+stack main;classify
+stack main
@@ -0,0 +1,45 @@
+find(a, n, x) {
+	auto i;
+	i = 0;
+	while (i < n && a[i] != x) ++i;
+	return (i);
+}
+
+find_from(a, i, last, x) {
+	while (i <= last && a[i] != x) ++i;
+	return (i);
+}
+
+mismatch(a, b, n) {
+	auto i;
+	i = 0;
+	while (i < n && a[i] == b[i]) ++i;
+	return (i);
+}
+
+index(s, n, c) extrn char; {
+	auto i;
+	i = 0;
+	while (i < n && char(s, i) != c) ++i;
+	return (i);
+}
+
+main() extrn printf, wfill, wcopy; {
+	auto a[40], b[40], i;
+
+	i = 0; while (i < 40) { a[i] = i * i; ++i; }
+	printf("%d %d %d %d %d*n", find(a, 40, 0), find(a, 40, 361), find(a, 40, 362), find(a, 0, 0), find(a, -3, 0));
+	printf("%d %d %d*n", find_from(a, 5, 39, 36), find_from(a, 5, 39, 16), find_from(a, 41, 39, 0));
+
+	wcopy(b, a, 40);
+	printf("%d ", mismatch(a, b, 40));
+	b[17] = 0;
+	printf("%d ", mismatch(a, b, 40));
+	printf("%d*n", mismatch(a, b, 3));
+
+	wfill(b, 7, 40);
+	wcopy(b + 8, b, 5);
+	printf("%d %d %d*n", b[0], b[39], mismatch(a, b, 40));
+
+	printf("%d %d %d %d*n", index("hello, world", 12, 'w'), index("hello", 5, 'z'), index("hello", 5, 'h' + 256), index("", 0, 'a'));
+}
@@ -0,0 +1,14 @@
+/* String helpers of libb written in B, see lib/string.b */
+main() extrn printf, str_length, str_equal, str_find, str_copy, str_concat; {
+	auto buf[8];
+
+	printf("length %d %d %d*n", str_length(""), str_length("a"), str_length("hello, world"));
+	printf("equal %d %d %d %d*n", str_equal("abc", "abc"), str_equal("abc", "abd"), str_equal("ab", "abc"), str_equal("", ""));
+	printf("find %d %d %d*n", str_find("hello", 5, 'l'), str_find("hello", 5, 'z'), str_find("hello", 2, 'l'));
+
+	printf("copy %s*n", str_copy(buf, "word"));
+	printf("concat %s*n", str_concat(buf, " and more"));
+	printf("concat %s, length %d*n", str_concat(buf, ""), str_length(buf));
+	str_copy(buf, "");
+	printf("empty [%s] %d*n", buf, str_length(buf));
+}
@@ -0,0 +1,61 @@
+/* spawn, sync and parallel_for from libb, results don't depend on the number of workers */
+
+/* args[0] is n, fib stores the result to args[1] */
+fib(args) extrn spawn, sync; {
+	auto n, a[2], b[2];
+	n = args[0];
+	if (n < 2) {
+		args[1] = n;
+		return;
+	}
+	a[0] = n - 1;
+	b[0] = n - 2;
+	spawn(&fib, a);
+	fib(b);
+	sync();
+	args[1] = a[1] + b[1];
+}
+
+square(i, out) {
+	out[i] = i * i;
+}
+
+collatz(i, out) {
+	auto n, steps;
+	n = i + 1;
+	steps = 0;
+	while (n != 1) {
+		if (n & 1) n = 3 * n + 1; else n = n / 2;
+		++steps;
+	}
+	out[i] = steps;
+}
+
+sum(a, n) {
+	auto s, i;
+	s = 0;
+	i = 0;
+	while (i < n) s += a[i++];
+	return (s);
+}
+
+main() extrn printf, parallel_for, pool_alloc, pool_free; {
+	auto args[2], out, i;
+
+	i = 0;
+	while (i <= 20) {
+		args[0] = i;
+		fib(args);
+		printf("%d ", args[1]);
+		i += 5;
+	}
+	printf("*n");
+
+	out = pool_alloc(10000 * 8);
+	parallel_for(0, 10000, &square, out);
+	printf("%d %d %lld*n", out[0], out[9999], sum(out, 10000));
+	parallel_for(0, 10000, &collatz, out);
+	printf("%d %d %d*n", out[26], out[9999], sum(out, 10000));
+	parallel_for(5, 5, &collatz, out);
+	pool_free(out);
+}
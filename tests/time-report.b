@@ -0,0 +1,7 @@
+/* --time-report=json on stderr doesn't change the assembly */
+main() extrn printf; {
+	auto i;
+	i = 0;
+	while (i < 3) ++i;
+	printf("%d*n", i);
+}
@@ -0,0 +1,40 @@
+vadd(a, b, c, n) {
+	auto i;
+	i = 0;
+	while (i < n) { a[i] = b[i] + c[i]; ++i; }
+}
+
+vmix(a, b, c, n, k) {
+	auto i;
+	i = 0;
+	while (i < n) {
+		a[i] = ((b[i] - c[i]) & 255 | k) ^ (b[i] << 3) + (c[i] >> 1);
+		++i;
+	}
+}
+
+print(v, n) extrn printf; {
+	auto i;
+	i = 0;
+	while (i < n) printf("%d ", v[i++]);
+	printf("*n");
+}
+
+main() {
+	auto a[20], b[20], c[20], i;
+
+	i = 0; while (i < 20) { b[i] = i; c[i] = 100 - 3 * i; a[i] = 0; ++i; }
+
+	/* lengths covering vector loops and scalar remainder */
+	vadd(a, b, c, 0); print(a, 4);
+	vadd(a, b, c, 1); print(a, 4);
+	vadd(a, b, c, 11); print(a, 12);
+	vmix(a, b, c, 19, 4096); print(a, 20);
+
+	/* overlapping arrays keep the order of scalar loop: b[i+1] = b[i] + b[i] doubles b[0] */
+	b[0] = 1;
+	vadd(b + 8, b, b, 10); print(b, 12);
+	i = 0; while (i < 20) { b[i] = i; ++i; }
+	vadd(b, b + 8, c, 10); print(b, 12);
+	vadd(c, c, c, 20); print(c, 20);
+}
@@ -0,0 +1,10 @@
+/* -fwhole-program: extrn of a function defined here is a direct call, of a never written global the constant */
+scale 3;
+
+triple(x) extrn scale; {
+	return(x * scale);
+}
+
+main() extrn printf, triple; {
+	printf("%d*n", triple(14));
+}
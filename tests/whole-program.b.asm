@@ -0,0 +1,38 @@
+BITS 64
+DEFAULT rel
+section ".text" exec nowrite
+	extern printf
+global triple
+triple:
+sym_2:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	mov rax, rdi
+	imul rax, 3
+	leave
+	ret
+global main
+main:
+sym_5:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	lea rax, [strend-4]
+	mov [rbp-8], rax
+	mov rdi, 14
+	xor rax, rax
+	call sym_2
+	mov rdi, [rbp-8]
+	mov rsi, rax
+	xor rax, rax
+	call printf WRT ..plt
+	xor rax, rax
+	leave
+	ret
+section ".data" write
+section ".data.rel.ro" progbits alloc write align=8
+section ".bss" nobits write
+section ".rodata"
+db 0x00,0x25,0x64,0x0a,0x00
+strend: